@@ -0,0 +1,748 @@
+#ifndef CPU_INTERSECTION_H
+#define CPU_INTERSECTION_H
+
+#include "cpu/scene_data.h"
+#include "cpu/simd.h"
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+using namespace glm;
+
+// Scalar mirrors of the intersection routines in raytrace.comp. Any change to the shader
+// must be reflected here so that CPU and GPU output stay comparable.
+namespace CPU::CPU_ISA {
+  constexpr float INF = std::numeric_limits<float>::infinity();
+
+  struct Ray {
+    vec3 point;
+    vec3 direction;
+    float length;
+    int intersectable_index;
+    // Instance of a mesh the intersectable belongs to, or -1
+    int instance_index;
+  };
+
+  inline Ray create_ray(const vec3& point, const vec3& direction) {
+    return { point + direction * 1e-2f, direction, INF, -1, -1 };
+  }
+
+  // Sphere intersection
+  inline bool intersects(Ray& ray, int intersectable_index, const vec3& center, float r2) {
+    // offset of sphere center from ray point
+    vec3 l = center - ray.point;
+    // projection of l onto ray direction
+    float s = dot(l, ray.direction);
+    float l2 = dot(l, l);
+
+    // sphere is behind ray
+    if (l2 > r2 && s < 0.0f) {
+      return false;
+    }
+
+    // distance from center to ray
+    float m2 = l2 - s * s;
+
+    // ray misses sphere
+    if (m2 > r2) {
+      return false;
+    }
+
+    // distance to sphere edge
+    float q = std::sqrt(r2 - m2);
+
+    // determine if ray originates outside/inside sphere
+    float t = s + (l2 > r2 ? -q : q);
+
+    if (t >= ray.length) {
+      return false;
+    }
+
+    ray.length = t;
+    ray.intersectable_index = intersectable_index;
+    return true;
+  }
+
+  // Triangle intersection
+  inline bool intersects(Ray& ray, int intersectable_index, const vec3& vertex,
+                         const vec3& normal, const vec3& edge1, const vec3& edge2) {
+    float a = dot(-normal, ray.direction);
+
+    float f = 1.0f / a;
+    vec3 s = ray.point - vertex;
+    float t = f * dot(normal, s);
+
+    if (t < 0.0f || t >= ray.length) {
+      return false;
+    }
+
+    vec3 m = cross(s, ray.direction);
+    float u = f * dot(m, edge2);
+
+    if (u < 0.0f) {
+      return false;
+    }
+
+    float v = f * dot(-m, edge1);
+
+    if (v < 0.0f || u + v > 1.0f) {
+      return false;
+    }
+
+    ray.length = t;
+    ray.intersectable_index = intersectable_index;
+    return true;
+  }
+
+  // AABB intersection
+  inline bool intersects(Ray& ray, int intersectable_index, const vec3& bound1,
+                         const vec3& bound2) {
+    vec3 inv_direction = 1.0f / ray.direction;
+    // Find slab bounds on AABB
+    vec3 t1 = (bound1 - ray.point) * inv_direction;
+    vec3 t2 = (bound2 - ray.point) * inv_direction;
+    vec3 tvmin = min(t1, t2);
+    vec3 tvmax = max(t1, t2);
+
+    // Find tighest components of min and max
+    float tmin = max(tvmin.x, max(tvmin.y, tvmin.z));
+    float tmax = min(tvmax.x, min(tvmax.y, tvmax.z));
+
+    // Determine if ray misses or is in front of AABB
+    if (tmin > tmax || tmax < 0.0f) {
+      return false;
+    }
+
+    // Ray may originate inside the AABB, in which case it exits at tmax
+    float t = tmin > 0.0f ? tmin : tmax;
+
+    // Determine if intersection is not closer than an existing one
+    if (t >= ray.length) {
+      return false;
+    }
+
+    ray.length = t;
+    ray.intersectable_index = intersectable_index;
+    return true;
+  }
+
+  inline void intersects_sphere(const SceneData& scene, Ray& ray, int intersectable_index) {
+    const vec4& center_r2 = scene.intersectables[intersectable_index].data[0];
+    intersects(ray, intersectable_index, vec3(center_r2), center_r2.w);
+  }
+
+  // First vertex, edges and unnormalized normal of an indexed triangle, as primitive blocks hold
+  struct TriangleGeometry {
+    vec3 vertex;
+    vec3 e1;
+    vec3 e2;
+    vec3 normal;
+  };
+
+  inline TriangleGeometry get_triangle(const SceneData& scene, int intersectable_index) {
+    const ivec3& triangle = scene.triangles[intersectable_index - scene.num_spheres -
+                                            scene.num_aabbs];
+    const vec3 vertex(scene.vertices[triangle.x]);
+    const vec3 e1 = vec3(scene.vertices[triangle.y]) - vertex;
+    const vec3 e2 = vec3(scene.vertices[triangle.z]) - vertex;
+    return { vertex, e1, e2, cross(e1, e2) };
+  }
+
+  inline void intersects_triangle(const SceneData& scene, Ray& ray, int intersectable_index) {
+    const TriangleGeometry triangle = get_triangle(scene, intersectable_index);
+    intersects(ray, intersectable_index, triangle.vertex, triangle.normal, triangle.e1,
+               triangle.e2);
+  }
+
+  inline void intersects_aabb(const SceneData& scene, Ray& ray, int intersectable_index) {
+    const vec4* data = scene.intersectables[intersectable_index].data;
+    intersects(ray, intersectable_index, vec3(data[0]), vec3(data[1]));
+  }
+
+  // Node bounds intersection, returns the entry distance or INF if the node can be skipped
+  inline float intersects_node(const Ray& ray, const vec3& inv_direction, const BVHNode& node) {
+    vec3 t1 = (node.min - ray.point) * inv_direction;
+    vec3 t2 = (node.max - ray.point) * inv_direction;
+    vec3 tvmin = min(t1, t2);
+    vec3 tvmax = max(t1, t2);
+
+    float tmin = max(tvmin.x, max(tvmin.y, tvmin.z));
+    float tmax = min(tvmax.x, min(tvmax.y, tvmax.z));
+
+    if (tmin > tmax || tmax < 0.0f || tmin >= ray.length) {
+      return INF;
+    }
+
+    return tmin;
+  }
+
+  inline void intersects_primitive(const SceneData& scene, Ray& ray, int intersectable_index) {
+    if (intersectable_index < scene.num_spheres) {
+      intersects_sphere(scene, ray, intersectable_index);
+    } else if (intersectable_index < scene.num_spheres + scene.num_aabbs) {
+      intersects_aabb(scene, ray, intersectable_index);
+    } else {
+      // Scene and mesh triangles follow every other primitive
+      intersects_triangle(scene, ray, intersectable_index);
+    }
+  }
+
+  // Sphere intersection of every lane of a block, the same math as the single sphere test
+  inline void intersects_spheres(Ray& ray, const PrimitiveBlock& block) {
+    using Floats = SIMD::Floats<PrimitiveBlock::SIZE>;
+
+    const Floats lx = Floats::load(block.data[0]) - Floats::broadcast(ray.point.x);
+    const Floats ly = Floats::load(block.data[1]) - Floats::broadcast(ray.point.y);
+    const Floats lz = Floats::load(block.data[2]) - Floats::broadcast(ray.point.z);
+    const Floats r2 = Floats::load(block.data[3]);
+
+    const Floats s = lx * Floats::broadcast(ray.direction.x) +
+                     ly * Floats::broadcast(ray.direction.y) +
+                     lz * Floats::broadcast(ray.direction.z);
+    const Floats l2 = lx * lx + ly * ly + lz * lz;
+    const Floats m2 = l2 - s * s;
+
+    // Behind the ray or missed
+    const int outside = greater_mask(l2, r2);
+    const int miss = (outside & less_mask(s, Floats::broadcast(0.0f))) | greater_mask(m2, r2);
+
+    int hit = ~miss & ((1 << block.count) - 1);
+    if (!hit) {
+      return;
+    }
+
+    float s_lanes[PrimitiveBlock::SIZE];
+    float r2_m2[PrimitiveBlock::SIZE];
+    s.store(s_lanes);
+    (r2 - m2).store(r2_m2);
+
+    for (; hit; hit &= hit - 1) {
+      const int lane = __builtin_ctz(static_cast<unsigned int>(hit));
+      const float q = std::sqrt(r2_m2[lane]);
+      const float t = s_lanes[lane] + ((outside & (1 << lane)) ? -q : q);
+
+      if (t < ray.length) {
+        ray.length = t;
+        ray.intersectable_index = block.indices[lane];
+      }
+    }
+  }
+
+  // Triangle intersection of every lane of a block, the same math as the single triangle test
+  inline void intersects_triangles(Ray& ray, const PrimitiveBlock& block) {
+    using Floats = SIMD::Floats<PrimitiveBlock::SIZE>;
+
+    const auto row = [&block](int index) { return Floats::load(block.data[index]); };
+    const Floats zero = Floats::broadcast(0.0f);
+    const Floats dx = Floats::broadcast(ray.direction.x);
+    const Floats dy = Floats::broadcast(ray.direction.y);
+    const Floats dz = Floats::broadcast(ray.direction.z);
+    const Floats nx = row(9);
+    const Floats ny = row(10);
+    const Floats nz = row(11);
+
+    const Floats sx = Floats::broadcast(ray.point.x) - row(0);
+    const Floats sy = Floats::broadcast(ray.point.y) - row(1);
+    const Floats sz = Floats::broadcast(ray.point.z) - row(2);
+
+    const Floats a = zero - (nx * dx + ny * dy + nz * dz);
+    const Floats f = Floats::broadcast(1.0f) / a;
+    const Floats t = f * (nx * sx + ny * sy + nz * sz);
+
+    // m = cross(s, direction)
+    const Floats mx = sy * dz - dy * sz;
+    const Floats my = sz * dx - dz * sx;
+    const Floats mz = sx * dy - dx * sy;
+
+    const Floats u = f * (mx * row(6) + my * row(7) + mz * row(8));
+    const Floats v = f * (zero - (mx * row(3) + my * row(4) + mz * row(5)));
+
+    const int miss = less_mask(t, zero) |
+                     greater_equal_mask(t, Floats::broadcast(ray.length)) |
+                     less_mask(u, zero) |
+                     less_mask(v, zero) |
+                     greater_mask(u + v, Floats::broadcast(1.0f));
+
+    int hit = ~miss & ((1 << block.count) - 1);
+    if (!hit) {
+      return;
+    }
+
+    float t_lanes[PrimitiveBlock::SIZE];
+    t.store(t_lanes);
+
+    // The first of equally near triangles wins, as when testing them in order
+    for (; hit; hit &= hit - 1) {
+      const int lane = __builtin_ctz(static_cast<unsigned int>(hit));
+      if (t_lanes[lane] < ray.length) {
+        ray.length = t_lanes[lane];
+        ray.intersectable_index = block.indices[lane];
+      }
+    }
+  }
+
+  // Intersects the primitives listed by entries offset to offset + count of a leaf
+  inline void intersects_leaf(const SceneData& scene, Ray& ray, int offset, int count) {
+    if (!scene.primitive_blocks) {
+      for (int i = offset; i < offset + count; i++) {
+        intersects_primitive(scene, ray, scene.primitive_indices[i]);
+      }
+      return;
+    }
+
+    for (int i = scene.block_offsets[offset]; i < scene.block_offsets[offset + count]; i++) {
+      const PrimitiveBlock& block = scene.primitive_blocks[i];
+
+      switch (block.type) {
+        case PrimitiveBlock::Type::Triangles:
+          intersects_triangles(ray, block);
+          break;
+        case PrimitiveBlock::Type::Spheres:
+          intersects_spheres(ray, block);
+          break;
+        case PrimitiveBlock::Type::Other:
+          for (int lane = 0; lane < block.count; lane++) {
+            intersects_primitive(scene, ray, block.indices[lane]);
+          }
+          break;
+      }
+    }
+  }
+
+  // Any hit in the leaf entries offset to offset + count closer than ray.length, for occlusion.
+  // Blocks are tested whole, but the leaf is left at the first block with a hit.
+  inline bool occludes_leaf(const SceneData& scene, Ray& ray, int offset, int count) {
+    const float max_distance = ray.length;
+
+    if (!scene.primitive_blocks) {
+      for (int i = offset; i < offset + count; i++) {
+        intersects_primitive(scene, ray, scene.primitive_indices[i]);
+        if (ray.length < max_distance) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    for (int i = scene.block_offsets[offset]; i < scene.block_offsets[offset + count]; i++) {
+      const PrimitiveBlock& block = scene.primitive_blocks[i];
+
+      switch (block.type) {
+        case PrimitiveBlock::Type::Triangles:
+          intersects_triangles(ray, block);
+          break;
+        case PrimitiveBlock::Type::Spheres:
+          intersects_spheres(ray, block);
+          break;
+        case PrimitiveBlock::Type::Other:
+          for (int lane = 0; lane < block.count && !(ray.length < max_distance); lane++) {
+            intersects_primitive(scene, ray, block.indices[lane]);
+          }
+          break;
+      }
+
+      if (ray.length < max_distance) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  // Ordered traversal of the BVH starting at root, calling intersects_leaf(ray, offset, count)
+  // for the entries of each leaf reached. Shared by the primitive and instance BVHs, which
+  // raytrace.comp has to spell out separately.
+  template <typename F>
+  inline void traverse(const SceneData& scene, Ray& ray, int root, F&& intersects_leaf) {
+    constexpr int STACK_SIZE = BVH::STACK_SIZE;
+
+    if (root < 0) {
+      return;
+    }
+
+    const BVHNode* nodes = scene.nodes;
+    const vec3 inv_direction = 1.0f / ray.direction;
+    int stack[STACK_SIZE];
+    int stack_size = 0;
+    int node_index = intersects_node(ray, inv_direction, nodes[root]) < INF ? root : -1;
+
+    while (node_index >= 0) {
+      const BVHNode& node = nodes[node_index];
+
+      if (node.count > 0) {
+        intersects_leaf(ray, node.offset, node.count);
+      } else {
+        // Visit the nearer child first, saving the other for later
+        int near_index = node_index + 1;
+        int far_index = node.offset;
+        float t_near = intersects_node(ray, inv_direction, nodes[near_index]);
+        float t_far = intersects_node(ray, inv_direction, nodes[far_index]);
+
+        if (t_far < t_near) {
+          std::swap(near_index, far_index);
+          std::swap(t_near, t_far);
+        }
+
+        if (t_near < INF) {
+          if (t_far < INF && stack_size < STACK_SIZE) {
+            stack[stack_size++] = far_index;
+          }
+          node_index = near_index;
+          continue;
+        }
+      }
+
+      node_index = -1;
+
+      // Skip saved nodes that are now further than the closest hit
+      while (stack_size > 0) {
+        int saved_index = stack[--stack_size];
+        if (intersects_node(ray, inv_direction, nodes[saved_index]) < INF) {
+          node_index = saved_index;
+          break;
+        }
+      }
+    }
+  }
+
+  // Slab test of a ray against the bounds of every child of a wide node at once, the same math
+  // as the AABB intersection. Returns a mask of the children to visit and writes their entry
+  // distances.
+  template <int WIDTH>
+  inline int intersects_wide_bounds(const SIMD::Floats<WIDTH> (&point)[3],
+                                    const SIMD::Floats<WIDTH> (&inv_direction)[3], float length,
+                                    const SIMD::Floats<WIDTH> (&bounds_min)[3],
+                                    const SIMD::Floats<WIDTH> (&bounds_max)[3], float* t_entry) {
+    using Floats = SIMD::Floats<WIDTH>;
+
+    Floats t1x = (bounds_min[0] - point[0]) * inv_direction[0];
+    Floats t2x = (bounds_max[0] - point[0]) * inv_direction[0];
+    Floats t1y = (bounds_min[1] - point[1]) * inv_direction[1];
+    Floats t2y = (bounds_max[1] - point[1]) * inv_direction[1];
+    Floats t1z = (bounds_min[2] - point[2]) * inv_direction[2];
+    Floats t2z = (bounds_max[2] - point[2]) * inv_direction[2];
+
+    Floats tmin = max(min(t1x, t2x), max(min(t1y, t2y), min(t1z, t2z)));
+    Floats tmax = min(max(t1x, t2x), min(max(t1y, t2y), max(t1z, t2z)));
+
+    int skip = greater_mask(tmin, tmax) |
+               less_mask(tmax, Floats::broadcast(0.0f)) |
+               greater_equal_mask(tmin, Floats::broadcast(length));
+
+    tmin.store(t_entry);
+    return ~skip & ((1 << WIDTH) - 1);
+  }
+
+  template <int WIDTH>
+  inline int intersects_wide_node(const SIMD::Floats<WIDTH> (&point)[3],
+                                  const SIMD::Floats<WIDTH> (&inv_direction)[3], float length,
+                                  const WideBVHNode<WIDTH>& node, float* t_entry) {
+    using Floats = SIMD::Floats<WIDTH>;
+
+    const Floats bounds_min[3] = {
+      Floats::load(node.min_x), Floats::load(node.min_y), Floats::load(node.min_z)
+    };
+    const Floats bounds_max[3] = {
+      Floats::load(node.max_x), Floats::load(node.max_y), Floats::load(node.max_z)
+    };
+
+    return intersects_wide_bounds(point, inv_direction, length, bounds_min, bounds_max, t_entry);
+  }
+
+  // Dequantizes the child bounds before the slab test, unused slots are masked out
+  inline int intersects_wide_node(const SIMD::Floats<4> (&point)[3],
+                                  const SIMD::Floats<4> (&inv_direction)[3], float length,
+                                  const QuantizedBVHNode& node, float* t_entry) {
+    using Floats = SIMD::Floats<4>;
+
+    const unsigned char* quantized_min[3] = { node.min_x, node.min_y, node.min_z };
+    const unsigned char* quantized_max[3] = { node.max_x, node.max_y, node.max_z };
+    Floats bounds_min[3];
+    Floats bounds_max[3];
+
+    for (int axis = 0; axis < 3; axis++) {
+      const Floats origin = Floats::broadcast(node.origin[axis]);
+      const Floats step = Floats::broadcast(node.get_step(axis));
+      bounds_min[axis] = origin + Floats::load_bytes(quantized_min[axis]) * step;
+      bounds_max[axis] = origin + Floats::load_bytes(quantized_max[axis]) * step;
+    }
+
+    return intersects_wide_bounds(point, inv_direction, length, bounds_min, bounds_max, t_entry) &
+           static_cast<int>(node.child_mask);
+  }
+
+  // Ordered traversal of a wide BVH, intersecting every primitive in the leaves reached
+  template <int WIDTH, typename Node>
+  inline void traverse_wide(const SceneData& scene, const Node* nodes, Ray& ray, int root) {
+    // Each wide node on the path saves all but one of its children, and the path has no more
+    // wide nodes than the binary BVH it was collapsed from has levels
+    constexpr int STACK_SIZE = (WIDTH - 1) * BVH::STACK_SIZE + 1;
+    using Floats = SIMD::Floats<WIDTH>;
+
+    if (root < 0) {
+      return;
+    }
+
+    const vec3 inv_direction = 1.0f / ray.direction;
+    const Floats wide_point[3] = {
+      Floats::broadcast(ray.point.x), Floats::broadcast(ray.point.y), Floats::broadcast(ray.point.z)
+    };
+    const Floats wide_inv_direction[3] = {
+      Floats::broadcast(inv_direction.x), Floats::broadcast(inv_direction.y),
+      Floats::broadcast(inv_direction.z)
+    };
+
+    // Children to visit, either a wide node with a count of 0 or a leaf
+    struct Entry {
+      int offset;
+      int count;
+      float t;
+    };
+
+    Entry stack[STACK_SIZE];
+    int stack_size = 0;
+    stack[stack_size++] = { root, 0, -INF };
+
+    while (stack_size > 0) {
+      const Entry entry = stack[--stack_size];
+
+      // Skip saved children that are now further than the closest hit
+      if (entry.t >= ray.length) {
+        continue;
+      }
+
+      if (entry.count > 0) {
+        intersects_leaf(scene, ray, entry.offset, entry.count);
+        continue;
+      }
+
+      const Node& node = nodes[entry.offset];
+      float t_entry[WIDTH];
+      int mask = intersects_wide_node(wide_point, wide_inv_direction, ray.length, node, t_entry);
+
+      // Sort the children to visit from far to near, so the nearest is popped first
+      int children[WIDTH];
+      int num_children = 0;
+
+      for (; mask; mask &= mask - 1) {
+        const int child = __builtin_ctz(static_cast<unsigned int>(mask));
+        int i = num_children++;
+        while (i > 0 && t_entry[children[i - 1]] < t_entry[child]) {
+          children[i] = children[i - 1];
+          i--;
+        }
+        children[i] = child;
+      }
+
+      // Drop the furthest children if the stack is full
+      for (int i = std::max(num_children - (STACK_SIZE - stack_size), 0); i < num_children; i++) {
+        const int child = children[i];
+        stack[stack_size++] = { node.offsets[child], node.counts[child], t_entry[child] };
+      }
+    }
+  }
+
+  // Any-hit traversal of the BVH starting at root for occlusion, stopping at the first leaf for
+  // which occludes_leaf(ray, offset, count) is true. Any hit will do, so the children are not
+  // sorted: the first one is descended into and the second saved. Nodes are culled against
+  // ray.length, which is the distance to the light and never shrinks.
+  template <typename F>
+  inline bool traverse_any(const SceneData& scene, Ray& ray, int root, F&& occludes_leaf) {
+    constexpr int STACK_SIZE = BVH::STACK_SIZE;
+
+    if (root < 0) {
+      return false;
+    }
+
+    const BVHNode* nodes = scene.nodes;
+    const vec3 inv_direction = 1.0f / ray.direction;
+    int stack[STACK_SIZE];
+    int stack_size = 0;
+    int node_index = root;
+
+    while (true) {
+      const BVHNode& node = nodes[node_index];
+
+      if (intersects_node(ray, inv_direction, node) < INF) {
+        if (node.count > 0) {
+          if (occludes_leaf(ray, node.offset, node.count)) {
+            return true;
+          }
+        } else {
+          if (stack_size < STACK_SIZE) {
+            stack[stack_size++] = node.offset;
+          }
+          node_index = node_index + 1;
+          continue;
+        }
+      }
+
+      if (stack_size == 0) {
+        return false;
+      }
+      node_index = stack[--stack_size];
+    }
+  }
+
+  // Any-hit traversal of a wide BVH, children are saved in slot order without sorting
+  template <int WIDTH, typename Node>
+  inline bool occludes_wide(const SceneData& scene, const Node* nodes, Ray& ray, int root) {
+    // Sized as in traverse_wide
+    constexpr int STACK_SIZE = (WIDTH - 1) * BVH::STACK_SIZE + 1;
+    using Floats = SIMD::Floats<WIDTH>;
+
+    if (root < 0) {
+      return false;
+    }
+
+    const vec3 inv_direction = 1.0f / ray.direction;
+    const Floats wide_point[3] = {
+      Floats::broadcast(ray.point.x), Floats::broadcast(ray.point.y), Floats::broadcast(ray.point.z)
+    };
+    const Floats wide_inv_direction[3] = {
+      Floats::broadcast(inv_direction.x), Floats::broadcast(inv_direction.y),
+      Floats::broadcast(inv_direction.z)
+    };
+
+    int stack[STACK_SIZE];
+    int stack_size = 0;
+    stack[stack_size++] = root;
+
+    while (stack_size > 0) {
+      const Node& node = nodes[stack[--stack_size]];
+      float t_entry[WIDTH];
+      int mask = intersects_wide_node(wide_point, wide_inv_direction, ray.length, node, t_entry);
+
+      // Leaves are tested right away, interior children saved while there is room
+      for (; mask; mask &= mask - 1) {
+        const int child = __builtin_ctz(static_cast<unsigned int>(mask));
+
+        if (node.counts[child] > 0) {
+          if (occludes_leaf(scene, ray, node.offsets[child], node.counts[child])) {
+            return true;
+          }
+        } else if (stack_size < STACK_SIZE) {
+          stack[stack_size++] = node.offsets[child];
+        }
+      }
+    }
+
+    return false;
+  }
+
+  // Finds the closest primitive in the BVH starting at root, in the layout of the scene
+  inline void intersects_bvh(const SceneData& scene, Ray& ray, int root) {
+    switch (scene.bvh_layout) {
+      case BVH::Layout::Wide4:
+        traverse_wide<4>(scene, scene.wide4_nodes, ray, root);
+        break;
+      case BVH::Layout::Wide8:
+        traverse_wide<8>(scene, scene.wide8_nodes, ray, root);
+        break;
+      case BVH::Layout::Quantized4:
+        traverse_wide<4>(scene, scene.quantized4_nodes, ray, root);
+        break;
+      case BVH::Layout::Binary:
+        traverse(scene, ray, root, [&scene](Ray& leaf_ray, int offset, int count) {
+          intersects_leaf(scene, leaf_ray, offset, count);
+        });
+        break;
+    }
+  }
+
+  // Traces the mesh BVH of an instance in its object space. The direction is not renormalized,
+  // so distances along the ray are the same in both spaces.
+  inline void intersects_instance(const SceneData& scene, Ray& ray, int instance_index) {
+    const BVHInstance& instance = scene.instances[instance_index];
+    const vec4 point(ray.point, 1.0f);
+
+    Ray object_ray = ray;
+    object_ray.point = vec3(dot(instance.world_to_object[0], point),
+                            dot(instance.world_to_object[1], point),
+                            dot(instance.world_to_object[2], point));
+    object_ray.direction = vec3(dot(vec3(instance.world_to_object[0]), ray.direction),
+                                dot(vec3(instance.world_to_object[1]), ray.direction),
+                                dot(vec3(instance.world_to_object[2]), ray.direction));
+
+    intersects_bvh(scene, object_ray, instance.root);
+
+    if (object_ray.length < ray.length) {
+      ray.length = object_ray.length;
+      ray.intersectable_index = object_ray.intersectable_index;
+      ray.instance_index = instance_index;
+    }
+  }
+
+  inline void intersects_instances(const SceneData& scene, Ray& ray) {
+    traverse(scene, ray, scene.tlas_root, [&scene](Ray& leaf_ray, int offset, int count) {
+      for (int i = offset; i < offset + count; i++) {
+        intersects_instance(scene, leaf_ray, scene.primitive_indices[i]);
+      }
+    });
+  }
+
+  inline bool intersects_object(const SceneData& scene, Ray& ray, float max_distance = INF) {
+    intersects_bvh(scene, ray, scene.bvh_root);
+    intersects_instances(scene, ray);
+
+    return ray.length < max_distance;
+  }
+
+  // Any hit in the BVH starting at root closer than ray.length
+  inline bool occludes_bvh(const SceneData& scene, Ray& ray, int root) {
+    switch (scene.bvh_layout) {
+      case BVH::Layout::Wide4:
+        return occludes_wide<4>(scene, scene.wide4_nodes, ray, root);
+      case BVH::Layout::Wide8:
+        return occludes_wide<8>(scene, scene.wide8_nodes, ray, root);
+      case BVH::Layout::Quantized4:
+        return occludes_wide<4>(scene, scene.quantized4_nodes, ray, root);
+      case BVH::Layout::Binary:
+        break;
+    }
+
+    return traverse_any(scene, ray, root, [&scene](Ray& leaf_ray, int offset, int count) {
+      return occludes_leaf(scene, leaf_ray, offset, count);
+    });
+  }
+
+  inline bool occludes_instance(const SceneData& scene, const Ray& ray, int instance_index) {
+    const BVHInstance& instance = scene.instances[instance_index];
+    const vec4 point(ray.point, 1.0f);
+
+    Ray object_ray = ray;
+    object_ray.point = vec3(dot(instance.world_to_object[0], point),
+                            dot(instance.world_to_object[1], point),
+                            dot(instance.world_to_object[2], point));
+    object_ray.direction = vec3(dot(vec3(instance.world_to_object[0]), ray.direction),
+                                dot(vec3(instance.world_to_object[1]), ray.direction),
+                                dot(vec3(instance.world_to_object[2]), ray.direction));
+
+    return occludes_bvh(scene, object_ray, instance.root);
+  }
+
+  inline bool occludes_instances(const SceneData& scene, Ray& ray) {
+    return traverse_any(scene, ray, scene.tlas_root,
+                        [&scene](Ray& leaf_ray, int offset, int count) {
+      for (int i = offset; i < offset + count; i++) {
+        if (occludes_instance(scene, leaf_ray, scene.primitive_indices[i])) {
+          return true;
+        }
+      }
+      return false;
+    });
+  }
+
+  // Occlusion query for shadow rays, true when anything lies closer than max_distance. Gives
+  // the same answer as intersects_object(scene, ray, max_distance) but returns at the first
+  // hit found, and does not say which primitive it was.
+  inline bool occluded(const SceneData& scene, Ray ray, float max_distance) {
+    ray.length = max_distance;
+    return occludes_bvh(scene, ray, scene.bvh_root) || occludes_instances(scene, ray);
+  }
+}
+
+#endif // CPU_INTERSECTION_H
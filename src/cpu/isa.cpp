@@ -0,0 +1,115 @@
+#include "isa.h"
+#include "cpu/kernels.h"
+#include "util/exception.h"
+
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+namespace CPU {
+#if defined(CPU_DISPATCH)
+  // Registers the OS saves on context switches, which an instruction set needs on top of the
+  // CPU supporting it
+  static unsigned long long get_enabled_state()
+  {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_OSXSAVE)) {
+      return 0;
+    }
+
+    unsigned int low, high;
+    __asm__ ("xgetbv" : "=a" (low), "=d" (high) : "c" (0));
+    return static_cast<unsigned long long>(high) << 32 | low;
+  }
+
+  static ISA detect_isa()
+  {
+    // XMM and YMM registers, then the AVX-512 opmask and upper ZMM registers
+    constexpr unsigned long long AVX_STATE = 0x6;
+    constexpr unsigned long long AVX512_STATE = 0xe0;
+
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+      return ISA::Baseline;
+    }
+
+    const bool sse42 = (ecx & bit_SSE4_2) && (ecx & bit_POPCNT);
+    const bool avx = ecx & bit_AVX;
+    if (!sse42) {
+      return ISA::Baseline;
+    }
+
+    const unsigned long long state = get_enabled_state();
+    if (!avx || (state & AVX_STATE) != AVX_STATE ||
+        !__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) || !(ebx & bit_AVX2)) {
+      return ISA::SSE42;
+    }
+
+    if (!(ebx & bit_AVX512F) || (state & AVX512_STATE) != AVX512_STATE) {
+      return ISA::AVX2;
+    }
+
+    return ISA::AVX512;
+  }
+#else
+  static ISA detect_isa()
+  {
+    return ISA::Baseline;
+  }
+#endif
+
+  ISA get_supported_isa()
+  {
+    static const ISA isa = detect_isa();
+    return isa;
+  }
+
+  const char* get_isa_name(ISA isa)
+  {
+    switch (isa) {
+      case ISA::Baseline:
+        return "baseline";
+      case ISA::SSE42:
+        return "sse4.2";
+      case ISA::AVX2:
+        return "avx2";
+      case ISA::AVX512:
+        return "avx512";
+    }
+
+    return "unknown";
+  }
+
+  ISA get_isa(std::string_view name)
+  {
+    for (ISA isa : { ISA::Baseline, ISA::SSE42, ISA::AVX2, ISA::AVX512 }) {
+      if (name == get_isa_name(isa)) {
+        return isa;
+      }
+    }
+
+    throw RenderException("Unknown instruction set level " + std::string(name));
+  }
+
+  const Kernels& get_kernels(ISA isa)
+  {
+#if defined(CPU_DISPATCH)
+    switch (isa) {
+      case ISA::SSE42:
+        return sse42::kernels;
+      case ISA::AVX2:
+        return avx2::kernels;
+      case ISA::AVX512:
+        return avx512::kernels;
+      case ISA::Baseline:
+        break;
+    }
+#else
+    (void) isa;
+#endif
+
+    return baseline::kernels;
+  }
+}
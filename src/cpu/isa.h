@@ -0,0 +1,23 @@
+#ifndef CPU_ISA_H
+#define CPU_ISA_H
+
+#include <string_view>
+
+namespace CPU {
+  // Instruction set levels the tile kernels are compiled for, oldest first. Baseline is what
+  // the compiler targets by default, SSE2 on x86-64 and the only level on other architectures.
+  enum class ISA {
+    Baseline,
+    SSE42,
+    AVX2,
+    AVX512,
+  };
+
+  // Highest level built into the binary that this CPU and OS can run, from cpuid and xgetbv
+  ISA get_supported_isa();
+  const char* get_isa_name(ISA isa);
+  // Level by the name get_isa_name gives it, throwing RenderException for any other name
+  ISA get_isa(std::string_view name);
+}
+
+#endif // CPU_ISA_H
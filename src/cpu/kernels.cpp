@@ -0,0 +1,592 @@
+// The tile kernels: shading and tracing of pixels on top of intersection.h and packet.h. This
+// file builds the baseline kernels and is compiled again by each kernels_<level>.cpp, with
+// CPU_ISA naming the namespace of that level, CPU_ISA_TARGET the pragma that targets it and
+// CPU_ISA_<set> the instruction sets it adds for simd.h.
+#ifndef CPU_ISA
+#define CPU_ISA baseline
+#endif
+
+#include "cpu/kernels.h"
+#include "cpu/scene_data.h"
+#include "util/morton.h"
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Only the code of the level targets it. Every header above is shared with the other levels, and
+// the inline functions and template instances it emits here, glm's and the standard library's,
+// are merged with the copies of other objects at link time. They stay built for the baseline, so
+// whichever copy the linker keeps runs on any CPU. The headers below put all of their code in the
+// namespace of the level.
+#ifdef CPU_ISA_TARGET
+#pragma GCC push_options
+CPU_ISA_TARGET
+#endif
+
+#include "cpu/intersection.h"
+#include "cpu/packet.h"
+
+namespace CPU::CPU_ISA {
+  using namespace std::chrono;
+
+  constexpr float PI = 3.14159265359f;
+  constexpr float INV_PI = 1.0f / PI;
+  constexpr int MAX_RECURSION_DEPTH = 4;
+
+  static vec3 fresnel_schlick(float cos_theta, const vec3& f0) {
+    return f0 + (1.0f - f0) * std::pow(1.0f - cos_theta, 5.0f);
+  }
+
+  static float distribution_ggx(float n_dot_h_2, float roughness) {
+    float a = roughness * roughness;
+    float a2 = a * a;
+
+    float denom = n_dot_h_2 * (a2 - 1.0f) + 1.0f;
+    denom = PI * denom * denom;
+
+    return a2 / denom;
+  }
+
+  static float geometry_smith(float n_dot_v, float n_dot_l, float nvl, float roughness) {
+    float r = roughness + 1.0f;
+    float k = r * r / 8.0f;
+    float m = 1.0f - k;
+
+    return nvl / ((n_dot_v * m + k) * (n_dot_l * m + k));
+  }
+
+  static vec3 calc_color(const vec3& source_pos, const vec3& source_color, float source_dist2,
+                         const vec3& eye_pos, const vec3& frag_pos, const vec3& frag_normal,
+                         const PackedMaterial& frag_material) {
+    vec3 light_dir = normalize(source_pos - frag_pos);
+    vec3 view_dir = normalize(eye_pos - frag_pos);
+    vec3 half_vec = normalize(light_dir + view_dir);
+
+    float n_dot_v = max(dot(frag_normal, view_dir), 0.0f);
+    float n_dot_l = max(dot(frag_normal, light_dir), 0.0f);
+    float n_dot_h = max(dot(frag_normal, half_vec), 0.0f);
+    float h_dot_v = max(dot(half_vec, view_dir), 0.0f);
+    float nvl = n_dot_v * n_dot_l;
+    float n_dot_h_2 = n_dot_h * n_dot_h;
+
+    vec3 albedo = frag_material.albedo;
+    float metallic = frag_material.mra.x;
+    float roughness = frag_material.mra.y;
+
+    // normal distribution function
+    float d = distribution_ggx(n_dot_h_2, roughness);
+    // fresnel equation
+    vec3 f = fresnel_schlick(h_dot_v, mix(vec3(0.04f), albedo, metallic));
+    // geometry function
+    float g = geometry_smith(n_dot_v, n_dot_l, nvl, roughness);
+
+    // specularity
+    vec3 kS = f;
+    // diffuse
+    vec3 kD = (1.0f - kS) * (1.0f - metallic);
+
+    vec3 brdf = kD * albedo * INV_PI + d * f * g / max(4.0f * nvl, 1e-3f);
+    vec3 radiance = source_color / max(source_dist2, 1.0f);
+
+    return brdf * radiance * n_dot_l;
+  }
+
+  static vec3 tone_mapping(const vec3& color) {
+    return color / (color + 1.0f);
+  }
+
+  static vec3 gamma_correct(const vec3& color) {
+    return pow(color, vec3(1.0f / 2.2f));
+  }
+
+  static vec3 get_normal(const SceneData& scene, const Ray& ray, const vec3& intersection_position)
+  {
+    // Intersected triangle, of a mesh instance when the ray has one. The object space normal
+    // goes back with the transpose of the inverse transform.
+    if (ray.intersectable_index >= scene.num_spheres + scene.num_aabbs) {
+      const vec3 n = get_triangle(scene, ray.intersectable_index).normal;
+      if (ray.instance_index < 0) {
+        return normalize(n);
+      }
+
+      const BVHInstance& instance = scene.instances[ray.instance_index];
+      return normalize(n.x * vec3(instance.world_to_object[0]) +
+                       n.y * vec3(instance.world_to_object[1]) +
+                       n.z * vec3(instance.world_to_object[2]));
+    }
+
+    const PackedIntersectable& intersectable = scene.intersectables[ray.intersectable_index];
+
+    // Intersected sphere
+    if (ray.intersectable_index < scene.num_spheres) {
+      // Normal is simply the vector from center to intersection point
+      return normalize(intersection_position - vec3(intersectable.data[0]));
+    // Intersected box
+    } else {
+      // c is the center of the aabb
+      vec3 c = vec3(intersectable.data[0] + intersectable.data[1]) / 2.0f;
+      // p is the vector from the center to intersection point
+      vec3 p = abs(intersection_position - c);
+      // h is the vector of half lengths
+      vec3 h = vec3(intersectable.data[1]) - c;
+      // At the intersection point, the normal will be the component of p
+      // that is roughly the same as the corresponding component of h
+      return normalize(floor(p / h + 1e-4f));
+    }
+  }
+
+  // Surface point hit by a ray, with what is needed to shade it
+  struct Hit {
+    vec3 position;
+    vec3 normal;
+    const PackedMaterial* material;
+  };
+
+  static Hit get_hit(const SceneData& scene, const Ray& ray)
+  {
+    const vec3 position = ray.point + ray.length * ray.direction;
+    // Instances share mesh triangles, so their material is per instance
+    const int material_index = ray.instance_index < 0
+                               ? scene.material_indices[ray.intersectable_index]
+                               : scene.instances[ray.instance_index].material;
+
+    return { position, get_normal(scene, ray, position), &scene.materials[material_index] };
+  }
+
+  static vec3 get_ambient_color(const Hit& hit)
+  {
+    return vec3(hit.material->albedo) * hit.material->mra.z * 0.03f;
+  }
+
+  // Shadow ray from a hit towards a point light, writing the distance to the light
+  static Ray create_light_ray(const SceneData& scene, const Hit& hit, int light,
+                              float& light_distance)
+  {
+    vec3 ray_to_light_dir = vec3(scene.lights[light].position) - hit.position;
+    light_distance = length(ray_to_light_dir);
+    return create_ray(hit.position, normalize(ray_to_light_dir));
+  }
+
+  static vec3 get_light_color(const SceneData& scene, const Raytracer::EyeCoords& eye,
+                              const Hit& hit, int light, float light_distance)
+  {
+    return calc_color(scene.lights[light].position, scene.lights[light].color,
+                      light_distance * light_distance, eye.eye_pos, hit.position, hit.normal,
+                      *hit.material);
+  }
+
+  static vec3 get_camera_direction(const Raytracer::EyeCoords& eye, int x, int y)
+  {
+    // Get coords and put into view and perspective
+    const vec2 alpha_beta = eye.coord_scale * (vec2(x, y) - eye.coord_dims + 0.5f);
+
+    // Initial ray starts from eye and shoots towards screen location
+    return normalize(alpha_beta.x * eye.eye_coord_frame[0] +
+                     alpha_beta.y * eye.eye_coord_frame[1] -
+                                    eye.eye_coord_frame[2]);
+  }
+
+  // One iteration of the loop in main() of raytrace.comp: traces the ray at ray_pos along
+  // ray_dir, accumulates the color of its hit and moves on to the reflection. Returns false when
+  // the ray left the scene, adding the rays cast to num_rays.
+  static bool trace_bounce(const SceneData& scene, const Raytracer::EyeCoords& eye,
+                           vec3& ray_pos, vec3& ray_dir, vec3& color, vec3& reflectance,
+                           unsigned long& num_rays)
+  {
+    Ray ray = create_ray(ray_pos, ray_dir);
+    num_rays++;
+
+    // Find intersection
+    if (!intersects_object(scene, ray)) {
+      return false;
+    }
+
+    const Hit hit = get_hit(scene, ray);
+    vec3 intersection_color = get_ambient_color(hit);
+
+    // Calculate light contribution
+    for (int i = 0; i < scene.num_point_lights; i++) {
+      float light_distance;
+      Ray light_ray = create_light_ray(scene, hit, i, light_distance);
+      num_rays++;
+
+      // If the light ray is not blocked by any object, calculate color
+      if (!occluded(scene, light_ray, light_distance)) {
+        intersection_color += get_light_color(scene, eye, hit, i, light_distance);
+      }
+    }
+
+    // Ray is now reflected off intersection point
+    ray_dir = reflect(ray_dir, hit.normal);
+    ray_pos = hit.position;
+
+    color += reflectance * intersection_color;
+    reflectance *= vec3(hit.material->reflectance);
+    return true;
+  }
+
+  // Follows a ray and its reflections from first_depth on, accumulating into color. Returns the
+  // number of rays cast.
+  static unsigned long trace_path(const SceneData& scene, const Raytracer::EyeCoords& eye,
+                                  vec3 ray_pos, vec3 ray_dir, int first_depth,
+                                  vec3& color, vec3& reflectance)
+  {
+    unsigned long num_rays = 0;
+
+    for (int recursion_depth = first_depth; recursion_depth < MAX_RECURSION_DEPTH;
+         recursion_depth++) {
+      if (!trace_bounce(scene, eye, ray_pos, ray_dir, color, reflectance, num_rays)) {
+        break;
+      }
+    }
+
+    return num_rays;
+  }
+
+  static void store_pixel(const vec3& color, unsigned char* pixel)
+  {
+    // Same rounding as storing to an rgba8 image
+    vec3 out_color = clamp(gamma_correct(tone_mapping(color)), 0.0f, 1.0f);
+    for (int i = 0; i < 3; i++) {
+      pixel[i] = static_cast<unsigned char>(std::lround(out_color[i] * 255.0f));
+    }
+    pixel[3] = 255;
+  }
+
+  // Traces one pixel exactly like main() in raytrace.comp, returning the number of rays cast
+  static unsigned long trace_pixel(const SceneData& scene, const Raytracer::EyeCoords& eye,
+                                   int x, int y, unsigned char* pixel)
+  {
+    vec3 color = vec3(0.0f);
+    vec3 reflectance = vec3(1.0f);
+    const unsigned long num_rays = trace_path(scene, eye, eye.eye_pos,
+                                              get_camera_direction(eye, x, y), 0,
+                                              color, reflectance);
+    store_pixel(color, pixel);
+    return num_rays;
+  }
+
+  // Path of a pixel waiting for its next bounce, when the reflections of a tile are reordered
+  struct PendingPath {
+    vec3 ray_pos;
+    vec3 ray_dir;
+    vec3 color;
+    vec3 reflectance;
+    int pixel;
+    uint32_t key;
+  };
+
+  // Bin of a ray for reordering: the octant of its direction above a 12 bit Morton code of its
+  // origin, quantized to 16 steps per axis within bounds. Matches get_ray_key in raytrace.comp.
+  static uint32_t get_ray_key(const vec3& point, const vec3& direction, const Bounds& bounds)
+  {
+    const vec3 cell = clamp((point - bounds.min) / max(bounds.get_extent(), vec3(1e-6f)) * 16.0f,
+                            0.0f, 15.0f);
+    const uint32_t octant = (direction.x < 0.0f ? 1u : 0u) |
+                            (direction.y < 0.0f ? 2u : 0u) |
+                            (direction.z < 0.0f ? 4u : 0u);
+
+    return octant << 12 | Morton::encode_30(static_cast<uint32_t>(cell.x),
+                                            static_cast<uint32_t>(cell.y),
+                                            static_cast<uint32_t>(cell.z));
+  }
+
+  // Runs of PACKET_SIZE consecutive paths whose rays all point into the same octant, which a
+  // SIMD group could trace together
+  static unsigned long count_coherent_groups(const std::vector<PendingPath>& paths)
+  {
+    unsigned long num_coherent = 0;
+
+    for (size_t i = 0; i < paths.size(); i += PACKET_SIZE) {
+      const size_t end = std::min(i + PACKET_SIZE, paths.size());
+      bool coherent = true;
+      for (size_t j = i + 1; j < end; j++) {
+        coherent &= (paths[j].key >> 12) == (paths[i].key >> 12);
+      }
+      num_coherent += coherent;
+    }
+
+    return num_coherent;
+  }
+
+  // Sorts the paths by the key of their next ray, recording the coherence before and after
+  static void sort_paths(std::vector<PendingPath>& paths, Raytracer::RaySortStats& stats)
+  {
+    const auto start = steady_clock::now();
+
+    Bounds bounds;
+    for (const PendingPath& path : paths) {
+      bounds.grow(path.ray_pos);
+    }
+    for (PendingPath& path : paths) {
+      path.key = get_ray_key(path.ray_pos, path.ray_dir, bounds);
+    }
+
+    stats.num_groups += (paths.size() + PACKET_SIZE - 1) / PACKET_SIZE;
+    stats.num_unsorted_coherent += count_coherent_groups(paths);
+
+    // Stable, so paths with the same key keep their pixel order
+    std::stable_sort(paths.begin(), paths.end(), [](const PendingPath& a, const PendingPath& b) {
+      return a.key < b.key;
+    });
+
+    stats.num_sorted_coherent += count_coherent_groups(paths);
+    stats.sort_seconds += duration_cast<duration<double>>(steady_clock::now() - start).count();
+  }
+
+  // Traces a block of pixels starting at x, y and clipped to x_end, y_end, with the same result
+  // as trace_pixel. The camera rays and the shadow rays from their hits are traced as packets,
+  // the reflections diverge and are traced one ray at a time, unless pending is given. Then the
+  // paths that hit are added to it instead, to be traced from depth 1 by trace_pending_paths.
+  static unsigned long trace_block(const SceneData& scene, const Raytracer::EyeCoords& eye,
+                                   int x, int y, int x_end, int y_end, int width,
+                                   unsigned char* pixels,
+                                   std::vector<PendingPath>* pending = nullptr)
+  {
+    Ray rays[PACKET_SIZE];
+    int active = 0;
+
+    for (int lane = 0; lane < PACKET_SIZE; lane++) {
+      const int pixel_x = x + lane % PACKET_BLOCK_WIDTH;
+      const int pixel_y = y + lane / PACKET_BLOCK_WIDTH;
+      if (pixel_x < x_end && pixel_y < y_end) {
+        rays[lane] = create_ray(eye.eye_pos, get_camera_direction(eye, pixel_x, pixel_y));
+        active |= 1 << lane;
+      }
+    }
+
+    unsigned long num_rays = static_cast<unsigned long>(__builtin_popcount(active));
+    intersects_object(scene, rays, active);
+
+    Hit hits[PACKET_SIZE];
+    vec3 intersection_colors[PACKET_SIZE];
+    int hit_mask = 0;
+
+    for (int mask = active; mask; mask &= mask - 1) {
+      const int lane = __builtin_ctz(static_cast<unsigned int>(mask));
+      if (rays[lane].length < INF) {
+        hits[lane] = get_hit(scene, rays[lane]);
+        intersection_colors[lane] = get_ambient_color(hits[lane]);
+        hit_mask |= 1 << lane;
+      }
+    }
+
+    // Shadow rays towards the same light stay coherent
+    for (int i = 0; i < scene.num_point_lights && hit_mask; i++) {
+      Ray light_rays[PACKET_SIZE];
+      float light_distances[PACKET_SIZE];
+
+      for (int mask = hit_mask; mask; mask &= mask - 1) {
+        const int lane = __builtin_ctz(static_cast<unsigned int>(mask));
+        light_rays[lane] = create_light_ray(scene, hits[lane], i, light_distances[lane]);
+      }
+
+      num_rays += static_cast<unsigned long>(__builtin_popcount(hit_mask));
+      const int occluded_mask = occluded(scene, light_rays, light_distances, hit_mask);
+
+      for (int mask = hit_mask & ~occluded_mask; mask; mask &= mask - 1) {
+        const int lane = __builtin_ctz(static_cast<unsigned int>(mask));
+        intersection_colors[lane] += get_light_color(scene, eye, hits[lane], i,
+                                                     light_distances[lane]);
+      }
+    }
+
+    for (int mask = active; mask; mask &= mask - 1) {
+      const int lane = __builtin_ctz(static_cast<unsigned int>(mask));
+      const int pixel_x = x + lane % PACKET_BLOCK_WIDTH;
+      const int pixel_y = y + lane / PACKET_BLOCK_WIDTH;
+      const int pixel = pixel_y * width + pixel_x;
+      vec3 color = vec3(0.0f);
+      vec3 reflectance = vec3(1.0f);
+
+      if (hit_mask & (1 << lane)) {
+        const Hit& hit = hits[lane];
+        color += reflectance * intersection_colors[lane];
+        reflectance *= vec3(hit.material->reflectance);
+        const vec3 ray_dir = reflect(rays[lane].direction, hit.normal);
+
+        if (pending) {
+          pending->push_back({ hit.position, ray_dir, color, reflectance, pixel, 0 });
+          continue;
+        }
+
+        num_rays += trace_path(scene, eye, hit.position, ray_dir, 1, color, reflectance);
+      }
+
+      store_pixel(color, &pixels[static_cast<size_t>(pixel * 4)]);
+    }
+
+    return num_rays;
+  }
+
+  // Traces the reflections of a tile one bounce at a time like the wavefront mode of
+  // raytrace.comp, sorting them by direction and origin before each bounce, and stores the
+  // pixels of the paths that end. The sorted rays are still traced one at a time, as packets of
+  // them diverge too much to pay off.
+  static unsigned long trace_pending_paths(const SceneData& scene, const Raytracer::EyeCoords& eye,
+                                           std::vector<PendingPath>& paths,
+                                           std::vector<PendingPath>& next_paths,
+                                           unsigned char* pixels, Raytracer::RaySortStats& stats)
+  {
+    unsigned long num_rays = 0;
+
+    for (int recursion_depth = 1; recursion_depth < MAX_RECURSION_DEPTH && !paths.empty();
+         recursion_depth++) {
+      sort_paths(paths, stats);
+
+      const auto start = steady_clock::now();
+      next_paths.clear();
+
+      for (PendingPath& path : paths) {
+        if (trace_bounce(scene, eye, path.ray_pos, path.ray_dir, path.color, path.reflectance,
+                         num_rays) &&
+            recursion_depth + 1 < MAX_RECURSION_DEPTH) {
+          next_paths.push_back(path);
+        } else {
+          store_pixel(path.color, &pixels[static_cast<size_t>(path.pixel * 4)]);
+        }
+      }
+
+      paths.swap(next_paths);
+      stats.secondary_seconds +=
+        duration_cast<duration<double>>(steady_clock::now() - start).count();
+    }
+
+    return num_rays;
+  }
+
+  static unsigned long render_tile(const SceneData& scene, const Raytracer::EyeCoords& eye,
+                                   const TileScheduler::Tile& tile, int width,
+                                   bool packet_tracing, bool ray_sorting, unsigned char* pixels,
+                                   Raytracer::RaySortStats& sort_stats)
+  {
+    // Reflections waiting for their next bounce, kept between tiles to reuse the memory
+    static thread_local std::vector<PendingPath> paths;
+    static thread_local std::vector<PendingPath> next_paths;
+
+    unsigned long num_rays = 0;
+    const int x_end = tile.x + tile.width;
+    const int y_end = tile.y + tile.height;
+
+    if (packet_tracing) {
+      for (int y = tile.y; y < y_end; y += PACKET_BLOCK_HEIGHT) {
+        for (int x = tile.x; x < x_end; x += PACKET_BLOCK_WIDTH) {
+          num_rays += trace_block(scene, eye, x, y, x_end, y_end, width, pixels,
+                                  ray_sorting ? &paths : nullptr);
+        }
+      }
+
+      if (ray_sorting) {
+        num_rays += trace_pending_paths(scene, eye, paths, next_paths, pixels, sort_stats);
+      }
+    } else {
+      for (int y = tile.y; y < y_end; y++) {
+        for (int x = tile.x; x < x_end; x++) {
+          unsigned char* pixel = &pixels[static_cast<size_t>((y * width + x) * 4)];
+          num_rays += trace_pixel(scene, eye, x, y, pixel);
+        }
+      }
+    }
+
+    return num_rays;
+  }
+
+  static Ray get_query_ray(const IntersectableManager::RayQuery& query)
+  {
+    return { query.origin, query.direction, query.t_max, -1, -1 };
+  }
+
+  // Packets only pay off when their rays visit mostly the same nodes, which at least takes
+  // directions into the same octant. Other groups are traced one ray at a time.
+  static bool is_coherent(const Ray (&rays)[PACKET_SIZE], int num_lanes)
+  {
+    const bvec3 negative = lessThan(rays[0].direction, vec3(0.0f));
+    for (int lane = 1; lane < num_lanes; lane++) {
+      if (lessThan(rays[lane].direction, vec3(0.0f)) != negative) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // The queries are taken PACKET_SIZE at a time in the order given, so that neighbouring
+  // queries with similar rays share the node fetches
+  static void intersect_queries(const SceneData& scene,
+                                const IntersectableManager::RayQuery* queries, size_t num_rays,
+                                IntersectableManager::RayHit* hits)
+  {
+    for (size_t first = 0; first < num_rays; first += PACKET_SIZE) {
+      const int num_lanes = static_cast<int>(std::min<size_t>(PACKET_SIZE, num_rays - first));
+      Ray rays[PACKET_SIZE];
+
+      for (int lane = 0; lane < num_lanes; lane++) {
+        rays[lane] = get_query_ray(queries[first + lane]);
+      }
+
+      if (is_coherent(rays, num_lanes)) {
+        intersects_object(scene, rays, static_cast<int>((1u << num_lanes) - 1));
+      } else {
+        for (int lane = 0; lane < num_lanes; lane++) {
+          intersects_object(scene, rays[lane]);
+        }
+      }
+
+      for (int lane = 0; lane < num_lanes; lane++) {
+        const Ray& ray = rays[lane];
+        IntersectableManager::RayHit& hit = hits[first + lane];
+
+        if (ray.intersectable_index < 0) {
+          hit = { INF, -1, -1, vec3(0.0f) };
+        } else {
+          const vec3 position = ray.point + ray.length * ray.direction;
+          hit = { ray.length, ray.intersectable_index, ray.instance_index,
+                  get_normal(scene, ray, position) };
+        }
+      }
+    }
+  }
+
+  static void occlude_queries(const SceneData& scene,
+                              const IntersectableManager::RayQuery* queries, size_t num_rays,
+                              bool* occluded_rays)
+  {
+    for (size_t first = 0; first < num_rays; first += PACKET_SIZE) {
+      const int num_lanes = static_cast<int>(std::min<size_t>(PACKET_SIZE, num_rays - first));
+      Ray rays[PACKET_SIZE];
+      float max_distances[PACKET_SIZE];
+
+      for (int lane = 0; lane < num_lanes; lane++) {
+        rays[lane] = get_query_ray(queries[first + lane]);
+        max_distances[lane] = queries[first + lane].t_max;
+      }
+
+      if (is_coherent(rays, num_lanes)) {
+        const int active = static_cast<int>((1u << num_lanes) - 1);
+        const int occluded_mask = occluded(scene, rays, max_distances, active);
+        for (int lane = 0; lane < num_lanes; lane++) {
+          occluded_rays[first + lane] = occluded_mask & (1 << lane);
+        }
+      } else {
+        for (int lane = 0; lane < num_lanes; lane++) {
+          occluded_rays[first + lane] = occluded(scene, rays[lane], max_distances[lane]);
+        }
+      }
+    }
+  }
+
+  const Kernels kernels = { render_tile, intersect_queries, occlude_queries };
+}
+
+#ifdef CPU_ISA_TARGET
+#pragma GCC pop_options
+#endif
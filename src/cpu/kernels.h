@@ -0,0 +1,51 @@
+#ifndef CPU_KERNELS_H
+#define CPU_KERNELS_H
+
+#include "cpu/isa.h"
+#include "cpu/raytracer.h"
+#include "cpu/scene_data.h"
+#include "cpu/tile_scheduler.h"
+
+namespace CPU {
+  // Renders a tile into the RGBA8 pixels of an image width pixels wide, returning the number of
+  // rays cast. kernels.cpp defines the kernels once for each instruction set level.
+  using TileKernel = unsigned long (const SceneData& scene, const Raytracer::EyeCoords& eye,
+                                    const TileScheduler::Tile& tile, int width,
+                                    bool packet_tracing, bool ray_sorting, unsigned char* pixels,
+                                    Raytracer::RaySortStats& sort_stats);
+
+  // Batched queries of IntersectableManager, over num_rays rays and results
+  using IntersectKernel = void (const SceneData& scene,
+                                const IntersectableManager::RayQuery* queries, size_t num_rays,
+                                IntersectableManager::RayHit* hits);
+  using OccludedKernel = void (const SceneData& scene,
+                               const IntersectableManager::RayQuery* queries, size_t num_rays,
+                               bool* occluded);
+
+  struct Kernels {
+    TileKernel* render_tile;
+    IntersectKernel* intersect;
+    OccludedKernel* occluded;
+  };
+
+  namespace baseline {
+    extern const Kernels kernels;
+  }
+
+  namespace sse42 {
+    extern const Kernels kernels;
+  }
+
+  namespace avx2 {
+    extern const Kernels kernels;
+  }
+
+  namespace avx512 {
+    extern const Kernels kernels;
+  }
+
+  // Kernels built for a level, which the CPU must support
+  const Kernels& get_kernels(ISA isa);
+}
+
+#endif // CPU_KERNELS_H
@@ -0,0 +1,10 @@
+// Built for the baseline like the rest of the program, kernels.cpp targets the level in its
+// kernels alone
+#ifdef CPU_DISPATCH
+#define CPU_ISA avx2
+#define CPU_ISA_TARGET _Pragma("GCC target(\"avx2,popcnt\")")
+#define CPU_ISA_SSE4_1
+#define CPU_ISA_AVX
+#define CPU_ISA_AVX2
+#include "kernels.cpp"
+#endif
@@ -0,0 +1,11 @@
+// Built for the baseline like the rest of the program, kernels.cpp targets the level in its
+// kernels alone
+#ifdef CPU_DISPATCH
+#define CPU_ISA avx512
+#define CPU_ISA_TARGET _Pragma("GCC target(\"avx512f,avx2,popcnt\")")
+#define CPU_ISA_SSE4_1
+#define CPU_ISA_AVX
+#define CPU_ISA_AVX2
+#define CPU_ISA_AVX512F
+#include "kernels.cpp"
+#endif
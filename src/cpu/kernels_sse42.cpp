@@ -0,0 +1,8 @@
+// Built for the baseline like the rest of the program, kernels.cpp targets the level in its
+// kernels alone
+#ifdef CPU_DISPATCH
+#define CPU_ISA sse42
+#define CPU_ISA_TARGET _Pragma("GCC target(\"sse4.2,popcnt\")")
+#define CPU_ISA_SSE4_1
+#include "kernels.cpp"
+#endif
@@ -0,0 +1,414 @@
+#ifndef CPU_PACKET_H
+#define CPU_PACKET_H
+
+#include "cpu/intersection.h"
+
+// Packets of coherent rays, such as the camera rays of a block of pixels, traced together
+// through the binary primitive BVH and instance BVH. A node is visited when any ray of the
+// packet enters it, so the nodes are fetched once for the whole packet and the triangles of a
+// leaf are tested against every ray at once. Mesh instances and other primitives fall back to
+// the single ray routines for each ray.
+namespace CPU::CPU_ISA {
+  constexpr int PACKET_SIZE = SIMD::NATIVE_WIDTH;
+  // Pixels covered by the camera rays of a packet, 4x2 with AVX and 4x4 with AVX-512
+  constexpr int PACKET_BLOCK_WIDTH = 4;
+  constexpr int PACKET_BLOCK_HEIGHT = PACKET_SIZE / PACKET_BLOCK_WIDTH;
+
+  // Rays stored by component, one lane each. Only the lanes in active are traced.
+  struct RayPacket {
+    float point[3][PACKET_SIZE];
+    float direction[3][PACKET_SIZE];
+    float inv_direction[3][PACKET_SIZE];
+    float length[PACKET_SIZE];
+    int intersectable_index[PACKET_SIZE];
+    int instance_index[PACKET_SIZE];
+    int active;
+    // Lowest active lane, tested on its own first since one ray entering a node is enough
+    int first;
+    // Ranges of the origins and inverse directions over the active lanes, bounding the packet
+    // for interval arithmetic culling. Unset when the directions differ in sign on some axis.
+    bool has_frustum;
+    vec3 point_min, point_max;
+    vec3 inv_direction_min, inv_direction_max;
+  };
+
+  inline Ray get_ray(const RayPacket& packet, int lane) {
+    return {
+      vec3(packet.point[0][lane], packet.point[1][lane], packet.point[2][lane]),
+      vec3(packet.direction[0][lane], packet.direction[1][lane], packet.direction[2][lane]),
+      packet.length[lane],
+      packet.intersectable_index[lane],
+      packet.instance_index[lane],
+    };
+  }
+
+  inline void set_hit(RayPacket& packet, int lane, const Ray& ray) {
+    packet.length[lane] = ray.length;
+    packet.intersectable_index[lane] = ray.intersectable_index;
+    packet.instance_index[lane] = ray.instance_index;
+  }
+
+  // Inactive lanes are filled with the first active ray, so they never produce NaNs
+  inline RayPacket create_packet(const Ray (&rays)[PACKET_SIZE], int active) {
+    RayPacket packet;
+    packet.active = active;
+    packet.first = __builtin_ctz(static_cast<unsigned int>(active));
+    packet.has_frustum = true;
+
+    const Ray& first_ray = rays[packet.first];
+    const vec3 first_inv_direction = 1.0f / first_ray.direction;
+    packet.point_min = packet.point_max = first_ray.point;
+    packet.inv_direction_min = packet.inv_direction_max = first_inv_direction;
+
+    for (int lane = 0; lane < PACKET_SIZE; lane++) {
+      const Ray& ray = (active & (1 << lane)) ? rays[lane] : first_ray;
+      const vec3 inv_direction = 1.0f / ray.direction;
+
+      for (int axis = 0; axis < 3; axis++) {
+        packet.point[axis][lane] = ray.point[axis];
+        packet.direction[axis][lane] = ray.direction[axis];
+        packet.inv_direction[axis][lane] = inv_direction[axis];
+        packet.has_frustum &= std::isfinite(inv_direction[axis]) &&
+                              (inv_direction[axis] > 0.0f) == (first_inv_direction[axis] > 0.0f);
+      }
+      set_hit(packet, lane, ray);
+
+      packet.point_min = min(packet.point_min, ray.point);
+      packet.point_max = max(packet.point_max, ray.point);
+      packet.inv_direction_min = min(packet.inv_direction_min, inv_direction);
+      packet.inv_direction_max = max(packet.inv_direction_max, inv_direction);
+    }
+
+    return packet;
+  }
+
+  // Interval arithmetic bounds on the slab distances of every ray in the packet. True when no
+  // ray can enter the node, in which case the lanes need not be tested.
+  inline bool misses_frustum(const RayPacket& packet, const BVHNode& node) {
+    float tmin = -INF;
+    float tmax = INF;
+
+    for (int axis = 0; axis < 3; axis++) {
+      const bool positive = packet.inv_direction_min[axis] > 0.0f;
+      const float near_plane = positive ? node.min[axis] : node.max[axis];
+      const float far_plane = positive ? node.max[axis] : node.min[axis];
+      const float inv_min = packet.inv_direction_min[axis];
+      const float inv_max = packet.inv_direction_max[axis];
+
+      const float near_min = near_plane - packet.point_max[axis];
+      const float near_max = near_plane - packet.point_min[axis];
+      tmin = std::max(tmin, std::min(std::min(near_min * inv_min, near_min * inv_max),
+                                     std::min(near_max * inv_min, near_max * inv_max)));
+
+      const float far_min = far_plane - packet.point_max[axis];
+      const float far_max = far_plane - packet.point_min[axis];
+      tmax = std::min(tmax, std::max(std::max(far_min * inv_min, far_min * inv_max),
+                                     std::max(far_max * inv_min, far_max * inv_max)));
+    }
+
+    return tmin > tmax || tmax < 0.0f;
+  }
+
+  // Slab test of every lane against a node, the same math as intersects_node. Returns a mask of
+  // the lanes entering it and writes their entry distances.
+  inline int intersects_node(const RayPacket& packet, const BVHNode& node, float* t_entry) {
+    using Floats = SIMD::Floats<PACKET_SIZE>;
+
+    Floats tvmin[3];
+    Floats tvmax[3];
+
+    for (int axis = 0; axis < 3; axis++) {
+      const Floats point = Floats::load(packet.point[axis]);
+      const Floats inv_direction = Floats::load(packet.inv_direction[axis]);
+      const Floats t1 = (Floats::broadcast(node.min[axis]) - point) * inv_direction;
+      const Floats t2 = (Floats::broadcast(node.max[axis]) - point) * inv_direction;
+      tvmin[axis] = min(t1, t2);
+      tvmax[axis] = max(t1, t2);
+    }
+
+    Floats tmin = max(tvmin[0], max(tvmin[1], tvmin[2]));
+    Floats tmax = min(tvmax[0], min(tvmax[1], tvmax[2]));
+
+    int skip = greater_mask(tmin, tmax) |
+               less_mask(tmax, Floats::broadcast(0.0f)) |
+               greater_equal_mask(tmin, Floats::load(packet.length));
+
+    tmin.store(t_entry);
+    return ~skip & packet.active;
+  }
+
+  // Distance at which the packet enters a node, or INF if every ray can skip it. Tries the
+  // first ray, then the frustum of the packet, before testing every lane.
+  inline float enters_node(const RayPacket& packet, const BVHNode& node) {
+    const int first = packet.first;
+    const vec3 point(packet.point[0][first], packet.point[1][first], packet.point[2][first]);
+    const vec3 inv_direction(packet.inv_direction[0][first], packet.inv_direction[1][first],
+                             packet.inv_direction[2][first]);
+    const Ray ray = { point, vec3(0.0f), packet.length[first], -1, -1 };
+
+    const float t = intersects_node(ray, inv_direction, node);
+    if (t < INF) {
+      return t;
+    }
+
+    if (packet.has_frustum && misses_frustum(packet, node)) {
+      return INF;
+    }
+
+    float t_entry[PACKET_SIZE];
+    float t_min = INF;
+
+    for (int mask = intersects_node(packet, node, t_entry); mask; mask &= mask - 1) {
+      t_min = std::min(t_min, t_entry[__builtin_ctz(static_cast<unsigned int>(mask))]);
+    }
+
+    return t_min;
+  }
+
+  // Triangle intersection of every lane, the same math as the single ray version
+  inline void intersects_triangle(const SceneData& scene, RayPacket& packet,
+                                  int intersectable_index) {
+    using Floats = SIMD::Floats<PACKET_SIZE>;
+
+    const TriangleGeometry triangle = get_triangle(scene, intersectable_index);
+    const Floats zero = Floats::broadcast(0.0f);
+
+    const Floats dx = Floats::load(packet.direction[0]);
+    const Floats dy = Floats::load(packet.direction[1]);
+    const Floats dz = Floats::load(packet.direction[2]);
+    const Floats sx = Floats::load(packet.point[0]) - Floats::broadcast(triangle.vertex.x);
+    const Floats sy = Floats::load(packet.point[1]) - Floats::broadcast(triangle.vertex.y);
+    const Floats sz = Floats::load(packet.point[2]) - Floats::broadcast(triangle.vertex.z);
+
+    const vec3& n = triangle.normal;
+    const Floats a = Floats::broadcast(-n.x) * dx + Floats::broadcast(-n.y) * dy +
+                     Floats::broadcast(-n.z) * dz;
+    const Floats f = Floats::broadcast(1.0f) / a;
+    const Floats t = f * (Floats::broadcast(n.x) * sx + Floats::broadcast(n.y) * sy +
+                          Floats::broadcast(n.z) * sz);
+
+    // m = cross(s, direction)
+    const Floats mx = sy * dz - dy * sz;
+    const Floats my = sz * dx - dz * sx;
+    const Floats mz = sx * dy - dx * sy;
+
+    const Floats u = f * (mx * Floats::broadcast(triangle.e2.x) +
+                          my * Floats::broadcast(triangle.e2.y) +
+                          mz * Floats::broadcast(triangle.e2.z));
+    const Floats v = f * (zero - (mx * Floats::broadcast(triangle.e1.x) +
+                                  my * Floats::broadcast(triangle.e1.y) +
+                                  mz * Floats::broadcast(triangle.e1.z)));
+
+    const int miss = less_mask(t, zero) |
+                     greater_equal_mask(t, Floats::load(packet.length)) |
+                     less_mask(u, zero) |
+                     less_mask(v, zero) |
+                     greater_mask(u + v, Floats::broadcast(1.0f));
+
+    int hit = ~miss & packet.active;
+    if (!hit) {
+      return;
+    }
+
+    float t_hit[PACKET_SIZE];
+    t.store(t_hit);
+
+    for (; hit; hit &= hit - 1) {
+      const int lane = __builtin_ctz(static_cast<unsigned int>(hit));
+      packet.length[lane] = t_hit[lane];
+      packet.intersectable_index[lane] = intersectable_index;
+    }
+  }
+
+  inline void intersects_primitive(const SceneData& scene, RayPacket& packet,
+                                   int intersectable_index) {
+    if (intersectable_index >= scene.num_spheres + scene.num_aabbs) {
+      intersects_triangle(scene, packet, intersectable_index);
+      return;
+    }
+
+    for (int mask = packet.active; mask; mask &= mask - 1) {
+      const int lane = __builtin_ctz(static_cast<unsigned int>(mask));
+      Ray ray = get_ray(packet, lane);
+      intersects_primitive(scene, ray, intersectable_index);
+      set_hit(packet, lane, ray);
+    }
+  }
+
+  // Ordered traversal of a binary BVH with the whole packet, the packet counterpart of traverse
+  template <typename F>
+  inline void traverse(const SceneData& scene, RayPacket& packet, int root, F&& intersects_leaf) {
+    constexpr int STACK_SIZE = BVH::STACK_SIZE;
+
+    if (root < 0) {
+      return;
+    }
+
+    const BVHNode* nodes = scene.nodes;
+    int stack[STACK_SIZE];
+    int stack_size = 0;
+    int node_index = enters_node(packet, nodes[root]) < INF ? root : -1;
+
+    while (node_index >= 0) {
+      const BVHNode& node = nodes[node_index];
+
+      if (node.count > 0) {
+        for (int i = node.offset; i < node.offset + node.count; i++) {
+          intersects_leaf(packet, scene.primitive_indices[i]);
+        }
+      } else {
+        int near_index = node_index + 1;
+        int far_index = node.offset;
+        float t_near = enters_node(packet, nodes[near_index]);
+        float t_far = enters_node(packet, nodes[far_index]);
+
+        if (t_far < t_near) {
+          std::swap(near_index, far_index);
+          std::swap(t_near, t_far);
+        }
+
+        if (t_near < INF) {
+          if (t_far < INF && stack_size < STACK_SIZE) {
+            stack[stack_size++] = far_index;
+          }
+          node_index = near_index;
+          continue;
+        }
+      }
+
+      node_index = -1;
+
+      while (stack_size > 0) {
+        int saved_index = stack[--stack_size];
+        if (enters_node(packet, nodes[saved_index]) < INF) {
+          node_index = saved_index;
+          break;
+        }
+      }
+    }
+  }
+
+  // Any-hit traversal with the whole packet, the packet counterpart of traverse_any. The leaf
+  // callback drops occluded lanes from packet.active, and the traversal stops once none remain.
+  template <typename F>
+  inline void traverse_any(const SceneData& scene, RayPacket& packet, int root,
+                           F&& occludes_leaf) {
+    constexpr int STACK_SIZE = BVH::STACK_SIZE;
+
+    if (root < 0) {
+      return;
+    }
+
+    const BVHNode* nodes = scene.nodes;
+    int stack[STACK_SIZE];
+    int stack_size = 0;
+    int node_index = root;
+
+    while (true) {
+      const BVHNode& node = nodes[node_index];
+
+      if (enters_node(packet, node) < INF) {
+        if (node.count > 0) {
+          for (int i = node.offset; i < node.offset + node.count && packet.active; i++) {
+            occludes_leaf(packet, scene.primitive_indices[i]);
+          }
+          if (!packet.active) {
+            return;
+          }
+        } else {
+          if (stack_size < STACK_SIZE) {
+            stack[stack_size++] = node.offset;
+          }
+          node_index = node_index + 1;
+          continue;
+        }
+      }
+
+      if (stack_size == 0) {
+        return;
+      }
+      node_index = stack[--stack_size];
+    }
+  }
+
+  // Finds the closest hit of each active ray, like intersects_object for each of them
+  inline void intersects_object(const SceneData& scene, Ray (&rays)[PACKET_SIZE], int active) {
+    RayPacket packet = create_packet(rays, active);
+
+    traverse(scene, packet, scene.binary_root, [&scene](RayPacket& leaf_packet, int index) {
+      intersects_primitive(scene, leaf_packet, index);
+    });
+
+    traverse(scene, packet, scene.tlas_root, [&scene](RayPacket& leaf_packet, int index) {
+      for (int mask = leaf_packet.active; mask; mask &= mask - 1) {
+        const int lane = __builtin_ctz(static_cast<unsigned int>(mask));
+        Ray ray = get_ray(leaf_packet, lane);
+        intersects_instance(scene, ray, index);
+        set_hit(leaf_packet, lane, ray);
+      }
+    });
+
+    for (int mask = active; mask; mask &= mask - 1) {
+      const int lane = __builtin_ctz(static_cast<unsigned int>(mask));
+      rays[lane].length = packet.length[lane];
+      rays[lane].intersectable_index = packet.intersectable_index[lane];
+      rays[lane].instance_index = packet.instance_index[lane];
+    }
+  }
+
+  // Occlusion query for each active ray, like occluded for each of them. Returns the mask of
+  // lanes with a hit closer than their max distance.
+  inline int occluded(const SceneData& scene, const Ray (&rays)[PACKET_SIZE],
+                      const float (&max_distances)[PACKET_SIZE], int active) {
+    Ray shadow_rays[PACKET_SIZE];
+
+    for (int mask = active; mask; mask &= mask - 1) {
+      const int lane = __builtin_ctz(static_cast<unsigned int>(mask));
+      shadow_rays[lane] = rays[lane];
+      shadow_rays[lane].length = max_distances[lane];
+    }
+
+    RayPacket packet = create_packet(shadow_rays, active);
+
+    // Occluded lanes leave the packet, so the remaining ones are tested against fewer nodes
+    const auto retire = [](RayPacket& leaf_packet, int occluded_lanes) {
+      leaf_packet.active &= ~occluded_lanes;
+      if (leaf_packet.active) {
+        leaf_packet.first = __builtin_ctz(static_cast<unsigned int>(leaf_packet.active));
+      }
+    };
+
+    traverse_any(scene, packet, scene.binary_root,
+                 [&scene, &max_distances, &retire](RayPacket& leaf_packet, int index) {
+      intersects_primitive(scene, leaf_packet, index);
+
+      // A hit shortens the length of a lane below its max distance
+      int occluded_lanes = 0;
+      for (int mask = leaf_packet.active; mask; mask &= mask - 1) {
+        const int lane = __builtin_ctz(static_cast<unsigned int>(mask));
+        if (leaf_packet.length[lane] < max_distances[lane]) {
+          occluded_lanes |= 1 << lane;
+        }
+      }
+      retire(leaf_packet, occluded_lanes);
+    });
+
+    if (packet.active) {
+      traverse_any(scene, packet, scene.tlas_root,
+                   [&scene, &retire](RayPacket& leaf_packet, int index) {
+        int occluded_lanes = 0;
+        for (int mask = leaf_packet.active; mask; mask &= mask - 1) {
+          const int lane = __builtin_ctz(static_cast<unsigned int>(mask));
+          if (occludes_instance(scene, get_ray(leaf_packet, lane), index)) {
+            occluded_lanes |= 1 << lane;
+          }
+        }
+        retire(leaf_packet, occluded_lanes);
+      });
+    }
+
+    return active & ~packet.active;
+  }
+}
+
+#endif // CPU_PACKET_H
@@ -0,0 +1,212 @@
+#include "raytracer.h"
+#include "cpu/kernels.h"
+#include "util/exception.h"
+#include "util/logging.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <numeric>
+#include <thread>
+
+namespace CPU {
+  using namespace std::chrono;
+
+  Raytracer::Raytracer(int width, int height, unsigned int num_threads)
+    : width(width),
+      height(height),
+      num_threads(num_threads ? num_threads : std::max(std::thread::hardware_concurrency(), 1u)),
+      pixels(static_cast<size_t>(width * height * 4)),
+      isa(get_supported_isa())
+  {
+    Logging::get_logger() << "CPU kernels: " << get_isa_name(isa) << std::endl;
+  }
+
+  void Raytracer::set_packet_tracing(bool enabled)
+  {
+    packet_tracing = enabled;
+  }
+
+  void Raytracer::set_ray_sorting(bool enabled)
+  {
+    ray_sorting = enabled;
+  }
+
+  void Raytracer::set_tile_size(int width, int height)
+  {
+    tile_width = std::max(width, 1);
+    tile_height = std::max(height, 1);
+  }
+
+  void Raytracer::set_isa(ISA isa)
+  {
+    if (isa > get_supported_isa()) {
+      throw RenderException(std::string("Cannot render with ") + get_isa_name(isa) +
+                            " kernels, this CPU supports up to " +
+                            get_isa_name(get_supported_isa()));
+    }
+
+    this->isa = isa;
+    Logging::get_logger() << "CPU kernels: " << get_isa_name(isa) << " (forced)" << std::endl;
+  }
+
+  ISA Raytracer::get_isa() const
+  {
+    return isa;
+  }
+
+  void Raytracer::RaySortStats::add(const RaySortStats& other)
+  {
+    sort_seconds += other.sort_seconds;
+    secondary_seconds += other.secondary_seconds;
+    num_groups += other.num_groups;
+    num_unsorted_coherent += other.num_unsorted_coherent;
+    num_sorted_coherent += other.num_sorted_coherent;
+  }
+
+  double Raytracer::RaySortStats::get_unsorted_coherence() const
+  {
+    return num_groups ? static_cast<double>(num_unsorted_coherent) / num_groups : 1.0;
+  }
+
+  double Raytracer::RaySortStats::get_sorted_coherence() const
+  {
+    return num_groups ? static_cast<double>(num_sorted_coherent) / num_groups : 1.0;
+  }
+
+  double Raytracer::Stats::get_rays_per_second() const
+  {
+    return num_rays / seconds;
+  }
+
+  double Raytracer::Stats::get_rays_per_second_per_thread() const
+  {
+    return get_rays_per_second() / num_threads;
+  }
+
+  double Raytracer::Stats::get_load_balance() const
+  {
+    double busy_seconds = 0.0;
+    double max_busy_seconds = 0.0;
+
+    for (const ThreadStats& thread : thread_stats) {
+      busy_seconds += thread.busy_seconds;
+      max_busy_seconds = std::max(max_busy_seconds, thread.busy_seconds);
+    }
+
+    return max_busy_seconds > 0.0 ? busy_seconds / (max_busy_seconds * thread_stats.size()) : 1.0;
+  }
+
+  Raytracer::EyeCoords Raytracer::get_eye_coords(const Camera& camera)
+  {
+    return {
+      camera.get_coord_scale(),
+      camera.get_coord_dims(),
+      camera.get_position(),
+      camera.get_coord_frame(),
+    };
+  }
+
+  Raytracer::Stats Raytracer::render(const IntersectableManager& intersectables,
+                                     const Light& light, const EyeCoords& eye_coords)
+  {
+    return render(get_scene_data(intersectables, light), eye_coords);
+  }
+
+  Raytracer::Stats Raytracer::render(const SceneData& scene, const EyeCoords& eye_coords)
+  {
+    TileScheduler scheduler(width, height, tile_width, tile_height, num_threads);
+    std::vector<unsigned long> num_rays(num_threads, 0);
+    std::vector<ThreadStats> thread_stats(num_threads, ThreadStats {});
+    std::vector<RaySortStats> sort_stats(num_threads, RaySortStats {});
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads);
+    TileKernel* render_tile = get_kernels(isa).render_tile;
+
+    const auto start = steady_clock::now();
+
+    for (unsigned int t = 0; t < num_threads; t++) {
+      threads.emplace_back([&, t]() {
+        unsigned long thread_rays = 0;
+        ThreadStats& tile_stats = thread_stats[t];
+        TileScheduler::Tile tile;
+        bool stolen;
+
+        while (scheduler.next_tile(t, tile, stolen)) {
+          const auto tile_start = steady_clock::now();
+
+          thread_rays += render_tile(scene, eye_coords, tile, width, packet_tracing, ray_sorting,
+                                     pixels.data(), sort_stats[t]);
+
+          tile_stats.busy_seconds +=
+            duration_cast<duration<double>>(steady_clock::now() - tile_start).count();
+          tile_stats.num_tiles++;
+          tile_stats.num_stolen += stolen;
+        }
+
+        num_rays[t] = thread_rays;
+      });
+    }
+
+    for (auto& thread : threads) {
+      thread.join();
+    }
+
+    Stats stats = {
+      std::accumulate(num_rays.begin(), num_rays.end(), 0ul),
+      duration_cast<duration<double>>(steady_clock::now() - start).count(),
+      num_threads,
+      std::move(thread_stats),
+      RaySortStats {},
+      isa,
+    };
+
+    for (const RaySortStats& thread_sort_stats : sort_stats) {
+      stats.ray_sort_stats.add(thread_sort_stats);
+    }
+
+    // Whatever a thread did not spend on tiles it spent scheduling or waiting for the others
+    for (ThreadStats& tile_stats : stats.thread_stats) {
+      tile_stats.idle_seconds = std::max(stats.seconds - tile_stats.busy_seconds, 0.0);
+    }
+
+    Logging::get_logger() << "CPU render: " << stats.num_rays << " rays in "
+                          << stats.seconds << " s, "
+                          << stats.get_rays_per_second_per_thread() << " rays/s/thread, "
+                          << stats.get_load_balance() * 100.0 << "% load balance, "
+                          << get_isa_name(isa) << " kernels" << std::endl;
+
+    for (unsigned int t = 0; t < num_threads; t++) {
+      const ThreadStats& tile_stats = stats.thread_stats[t];
+      Logging::get_logger() << "Thread " << t << ": " << tile_stats.num_tiles << " tiles ("
+                            << tile_stats.num_stolen << " stolen), busy "
+                            << tile_stats.busy_seconds * 1e3 << " ms, idle "
+                            << tile_stats.idle_seconds * 1e3 << " ms" << std::endl;
+    }
+
+    return stats;
+  }
+
+  const std::vector<unsigned char>& Raytracer::get_pixels() const
+  {
+    return pixels;
+  }
+
+  void Raytracer::write_ppm(const std::string& path) const
+  {
+    std::ofstream file(path, std::ios::binary);
+
+    if (!file.is_open()) {
+      throw RenderException("Cannot open file " + path);
+    }
+
+    file << "P6\n" << width << " " << height << "\n255\n";
+
+    // PPM stores the top row first
+    for (int y = height - 1; y >= 0; y--) {
+      for (int x = 0; x < width; x++) {
+        file.write(reinterpret_cast<const char*>(&pixels[static_cast<size_t>((y * width + x) * 4)]), 3);
+      }
+    }
+  }
+}
@@ -0,0 +1,108 @@
+#ifndef CPU_RAYTRACER_H
+#define CPU_RAYTRACER_H
+
+#include "model/intersectable/intersectable_manager.h"
+#include "model/light.h"
+#include "display/camera.h"
+#include "cpu/isa.h"
+#include "cpu/scene_data.h"
+#include "cpu/tile_scheduler.h"
+
+#include <string>
+#include <vector>
+
+namespace CPU {
+  // Multithreaded CPU implementation of raytrace.comp. Consumes the same packed buffers that
+  // are uploaded to the GPU, and writes to an RGBA8 buffer laid out like the GPU image
+  // (row 0 is the bottom of the screen).
+  class Raytracer
+  {
+  public:
+    // num_threads of 0 uses every available core
+    Raytracer(int width, int height, unsigned int num_threads = 0);
+
+    // Mirrors the EyeCoords uniform block
+    struct EyeCoords {
+      vec2 coord_scale;
+      vec2 coord_dims;
+      vec3 eye_pos;
+      mat3 eye_coord_frame;
+    };
+
+    // Time a thread spent rendering tiles, and the rest of the render it spent scheduling or
+    // waiting for the other threads
+    struct ThreadStats {
+      double busy_seconds;
+      double idle_seconds;
+      unsigned int num_tiles;
+      unsigned int num_stolen;
+    };
+
+    // Cost and effect of reordering reflections, summed over the threads. Coherence is counted
+    // over groups of PACKET_SIZE consecutive rays, and a group is coherent when its rays point
+    // into the same octant.
+    struct RaySortStats {
+      double sort_seconds;
+      double secondary_seconds;
+      unsigned long num_groups;
+      unsigned long num_unsorted_coherent;
+      unsigned long num_sorted_coherent;
+
+      void add(const RaySortStats& other);
+      // Fraction of coherent groups had the rays been traced in pixel order, and as sorted
+      double get_unsorted_coherence() const;
+      double get_sorted_coherence() const;
+    };
+
+    struct Stats {
+      unsigned long num_rays;
+      double seconds;
+      unsigned int num_threads;
+      std::vector<ThreadStats> thread_stats;
+      RaySortStats ray_sort_stats;
+      // Instruction set level of the kernels that rendered
+      ISA isa;
+
+      double get_rays_per_second() const;
+      double get_rays_per_second_per_thread() const;
+      // Mean over the longest busy time of the threads, 1 when the work was spread evenly
+      double get_load_balance() const;
+    };
+
+    static EyeCoords get_eye_coords(const Camera& camera);
+
+    // Traces camera rays and their shadow rays in packets of neighbouring pixels, on by
+    // default. Reflections are always traced one ray at a time.
+    void set_packet_tracing(bool enabled);
+    // With packet tracing, traces the reflections of each tile one bounce at a time, sorting
+    // them by direction and origin before each bounce. Off by default.
+    void set_ray_sorting(bool enabled);
+    // Tiles handed to the threads, ideally multiples of the packet block. Defaults to the
+    // workgroup size of raytrace.comp.
+    void set_tile_size(int width, int height);
+    // Kernels to render with, by default the best level the CPU supports. Throws
+    // RenderException for a level the CPU cannot run.
+    void set_isa(ISA isa);
+    ISA get_isa() const;
+
+    Stats render(const IntersectableManager& intersectables, const Light& light,
+                 const EyeCoords& eye_coords);
+    // Renders packed buffers viewed elsewhere, such as those of a mapped scene file
+    Stats render(const SceneData& scene, const EyeCoords& eye_coords);
+
+    const std::vector<unsigned char>& get_pixels() const;
+    void write_ppm(const std::string& path) const;
+
+  private:
+    int width, height;
+    unsigned int num_threads;
+    bool packet_tracing = true;
+    bool ray_sorting = false;
+    int tile_width = TileScheduler::DEFAULT_TILE_WIDTH;
+    int tile_height = TileScheduler::DEFAULT_TILE_HEIGHT;
+    std::vector<unsigned char> pixels;
+    ISA isa;
+  };
+}
+
+#endif // CPU_RAYTRACER_H
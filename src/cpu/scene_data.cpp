@@ -0,0 +1,73 @@
+#include "scene_data.h"
+#include "model/intersectable/intersectable_manager.h"
+#include "model/light.h"
+#include "model/scene_file.h"
+
+namespace CPU {
+  SceneData get_scene_data(const IntersectableManager& intersectables, const Light& light)
+  {
+    SceneData scene = get_scene_data(intersectables);
+    scene.lights = reinterpret_cast<const PackedLight*>(light.get_light_data().data());
+    scene.num_point_lights = light.get_num_point_lights();
+    return scene;
+  }
+
+  SceneData get_scene_data(const IntersectableManager& intersectables)
+  {
+    const std::vector<int>& num_objects = intersectables.get_num_objects();
+
+    return {
+      reinterpret_cast<const PackedIntersectable*>(intersectables.get_intersectable_data().data()),
+      intersectables.get_vertex_data().data(),
+      intersectables.get_triangle_data().data(),
+      reinterpret_cast<const PackedMaterial*>(intersectables.get_material_data().data()),
+      intersectables.get_material_index_data().data(),
+      num_objects[0], num_objects[1], num_objects[2],
+      nullptr,
+      0,
+      intersectables.get_node_data().data(),
+      intersectables.get_index_data().data(),
+      num_objects[3], num_objects[4],
+      intersectables.get_instance_data().data(),
+      static_cast<BVH::Layout>(num_objects[5]),
+      intersectables.get_wide4_node_data().data(),
+      intersectables.get_wide8_node_data().data(),
+      intersectables.get_quantized4_node_data().data(),
+      intersectables.get_binary_bvh_root(),
+      intersectables.get_primitive_blocks().empty() ? nullptr
+                                                    : intersectables.get_primitive_blocks().data(),
+      intersectables.get_block_offsets().data(),
+    };
+  }
+
+  SceneData get_scene_data(const SceneFile& file)
+  {
+    const auto get_data = [&file](SceneFile::SectionIndex index) {
+      return file.get_section(index).data;
+    };
+    const int* num_objects = static_cast<const int*>(get_data(SceneFile::NUM_OBJECTS));
+    const SceneFile::Section& blocks = file.get_section(SceneFile::PRIMITIVE_BLOCKS);
+
+    return {
+      static_cast<const PackedIntersectable*>(get_data(SceneFile::INTERSECTABLES)),
+      static_cast<const vec4*>(get_data(SceneFile::VERTICES)),
+      static_cast<const ivec3*>(get_data(SceneFile::TRIANGLES)),
+      static_cast<const PackedMaterial*>(get_data(SceneFile::MATERIALS)),
+      static_cast<const uint16_t*>(get_data(SceneFile::MATERIAL_INDICES)),
+      num_objects[0], num_objects[1], num_objects[2],
+      static_cast<const PackedLight*>(get_data(SceneFile::LIGHTS)),
+      static_cast<int>(file.get_section(SceneFile::LIGHTS).size / sizeof (PackedLight)),
+      static_cast<const BVHNode*>(get_data(SceneFile::NODES)),
+      static_cast<const int*>(get_data(SceneFile::INDICES)),
+      num_objects[3], num_objects[4],
+      static_cast<const BVHInstance*>(get_data(SceneFile::INSTANCES)),
+      static_cast<BVH::Layout>(num_objects[5]),
+      static_cast<const WideBVHNode<4>*>(get_data(SceneFile::WIDE4_NODES)),
+      static_cast<const WideBVHNode<8>*>(get_data(SceneFile::WIDE8_NODES)),
+      static_cast<const QuantizedBVHNode*>(get_data(SceneFile::QUANTIZED4_NODES)),
+      file.get_info().binary_root,
+      blocks.size > 0 ? static_cast<const PrimitiveBlock*>(blocks.data) : nullptr,
+      static_cast<const int*>(get_data(SceneFile::BLOCK_OFFSETS)),
+    };
+  }
+}
@@ -0,0 +1,76 @@
+#ifndef CPU_SCENE_DATA_H
+#define CPU_SCENE_DATA_H
+
+#include "model/bvh/bvh.h"
+#include "model/bvh/primitive_block.h"
+#include "model/bvh/wide_bvh.h"
+
+#include <cstdint>
+#include <glm/glm.hpp>
+
+using namespace glm;
+
+class IntersectableManager;
+class Light;
+class SceneFile;
+
+namespace CPU {
+  // Records of the packed buffers, matching the structs in raytrace.comp
+  struct PackedIntersectable {
+    vec4 data[3];
+  };
+
+  struct PackedMaterial {
+    vec4 albedo;
+    vec4 mra;
+    vec4 reflectance;
+  };
+
+  struct PackedLight {
+    vec4 position;
+    vec4 color;
+  };
+
+  // View over the packed buffers produced by IntersectableManager::pack() and Light::pack()
+  struct SceneData {
+    // Spheres then boxes
+    const PackedIntersectable* intersectables;
+    // Triangles follow the boxes, as three indices into vertices
+    const vec4* vertices;
+    const ivec3* triangles;
+    // Distinct materials, and the one of each primitive that is not in a mesh
+    const PackedMaterial* materials;
+    const uint16_t* material_indices;
+    int num_spheres;
+    // Triangles added to the scene, the triangles of meshes follow them
+    int num_triangles;
+    int num_aabbs;
+    const PackedLight* lights;
+    int num_point_lights;
+    const BVHNode* nodes;
+    const int* primitive_indices;
+    // Roots of the primitive BVH and of the instance BVH, or -1 when empty
+    int bvh_root;
+    int tlas_root;
+    const BVHInstance* instances;
+    // Layout of the primitive and mesh BVHs, the roots index the nodes of that layout
+    BVH::Layout bvh_layout;
+    const WideBVHNode<4>* wide4_nodes;
+    const WideBVHNode<8>* wide8_nodes;
+    const QuantizedBVHNode* quantized4_nodes;
+    // Root of the primitive BVH in nodes, whatever the layout, for ray packets
+    int binary_root;
+    // Leaf primitives in blocks, or null to intersect leaves one primitive at a time
+    const PrimitiveBlock* primitive_blocks;
+    const int* block_offsets;
+  };
+
+  // Views the packed buffers, which must outlive the view. Without a light, the scene is lit by
+  // nothing, for queries that only intersect.
+  SceneData get_scene_data(const IntersectableManager& intersectables, const Light& light);
+  SceneData get_scene_data(const IntersectableManager& intersectables);
+  // Views the sections of a mapped scene file, which must stay loaded
+  SceneData get_scene_data(const SceneFile& file);
+}
+
+#endif // CPU_SCENE_DATA_H
@@ -0,0 +1,386 @@
+#ifndef CPU_SIMD_H
+#define CPU_SIMD_H
+
+// The kernels are compiled once per instruction set level, each in a namespace of its own so
+// that the inline functions built for one level are never linked into another
+#ifndef CPU_ISA
+#error "CPU_ISA must name the instruction set level being compiled, see kernels.cpp"
+#endif
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Instruction sets the level uses: those the compiler targets, and those a dispatched level
+// targets with #pragma GCC target, which defines none of the compiler's macros
+#if defined(__SSE4_1__) || defined(CPU_ISA_SSE4_1)
+#define CPU_SIMD_SSE4_1
+#endif
+#if defined(__AVX__) || defined(CPU_ISA_AVX)
+#define CPU_SIMD_AVX
+#endif
+#if defined(__AVX2__) || defined(CPU_ISA_AVX2)
+#define CPU_SIMD_AVX2
+#endif
+#if defined(__AVX512F__) || defined(CPU_ISA_AVX512F)
+#define CPU_SIMD_AVX512F
+#endif
+
+#include <algorithm>
+#include <cstring>
+
+// Float vectors of WIDTH lanes for the wide BVH node tests, ray packets and primitive blocks.
+// 4 lanes use SSE, 8 lanes AVX or a pair of SSE vectors and 16 lanes AVX-512 when the compiler
+// targets them, anything else falls back to plain arrays. SSE4.1 and AVX2 widen bytes in one
+// instruction.
+namespace CPU::CPU_ISA::SIMD {
+  // Widest vector the compiler targets, never less than 8 lanes
+#if defined(CPU_SIMD_AVX512F)
+  constexpr int NATIVE_WIDTH = 16;
+#else
+  constexpr int NATIVE_WIDTH = 8;
+#endif
+
+  template <int WIDTH>
+  struct Floats {
+    float lanes[WIDTH];
+
+    static Floats load(const float* data) {
+      Floats result;
+      std::copy(data, data + WIDTH, result.lanes);
+      return result;
+    }
+
+    // Converts WIDTH unsigned bytes
+    static Floats load_bytes(const unsigned char* data) {
+      Floats result;
+      std::copy(data, data + WIDTH, result.lanes);
+      return result;
+    }
+
+    static Floats broadcast(float value) {
+      Floats result;
+      std::fill(result.lanes, result.lanes + WIDTH, value);
+      return result;
+    }
+
+    void store(float* data) const {
+      std::copy(lanes, lanes + WIDTH, data);
+    }
+
+    template <typename F>
+    static Floats apply(const Floats& a, const Floats& b, F&& f) {
+      Floats result;
+      for (int i = 0; i < WIDTH; i++) {
+        result.lanes[i] = f(a.lanes[i], b.lanes[i]);
+      }
+      return result;
+    }
+
+    template <typename F>
+    static int compare(const Floats& a, const Floats& b, F&& f) {
+      int mask = 0;
+      for (int i = 0; i < WIDTH; i++) {
+        mask |= f(a.lanes[i], b.lanes[i]) << i;
+      }
+      return mask;
+    }
+
+    friend Floats operator+(const Floats& a, const Floats& b) {
+      return apply(a, b, [](float x, float y) { return x + y; });
+    }
+
+    friend Floats operator-(const Floats& a, const Floats& b) {
+      return apply(a, b, [](float x, float y) { return x - y; });
+    }
+
+    friend Floats operator*(const Floats& a, const Floats& b) {
+      return apply(a, b, [](float x, float y) { return x * y; });
+    }
+
+    friend Floats operator/(const Floats& a, const Floats& b) {
+      return apply(a, b, [](float x, float y) { return x / y; });
+    }
+
+    friend Floats min(const Floats& a, const Floats& b) {
+      return apply(a, b, [](float x, float y) { return x < y ? x : y; });
+    }
+
+    friend Floats max(const Floats& a, const Floats& b) {
+      return apply(a, b, [](float x, float y) { return x > y ? x : y; });
+    }
+
+    // Bit i of the mask is set when the comparison holds in lane i
+    friend int greater_mask(const Floats& a, const Floats& b) {
+      return compare(a, b, [](float x, float y) { return x > y; });
+    }
+
+    friend int less_mask(const Floats& a, const Floats& b) {
+      return compare(a, b, [](float x, float y) { return x < y; });
+    }
+
+    friend int greater_equal_mask(const Floats& a, const Floats& b) {
+      return compare(a, b, [](float x, float y) { return x >= y; });
+    }
+  };
+
+  // The vector operations below are not friends of their specialization: GCC compiles friends
+  // defined in a class for the baseline even inside #pragma GCC target
+#if defined(__SSE2__)
+  template <>
+  struct Floats<4> {
+    __m128 lanes;
+
+    static Floats load(const float* data) {
+      return { _mm_loadu_ps(data) };
+    }
+
+    static Floats load_bytes(const unsigned char* data) {
+      int packed;
+      std::memcpy(&packed, data, sizeof (packed));
+      const __m128i bytes = _mm_cvtsi32_si128(packed);
+#if defined(CPU_SIMD_SSE4_1)
+      return { _mm_cvtepi32_ps(_mm_cvtepu8_epi32(bytes)) };
+#else
+      const __m128i zero = _mm_setzero_si128();
+      return { _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, zero), zero)) };
+#endif
+    }
+
+    static Floats broadcast(float value) {
+      return { _mm_set1_ps(value) };
+    }
+
+    void store(float* data) const {
+      _mm_storeu_ps(data, lanes);
+    }
+  };
+
+  inline Floats<4> operator+(const Floats<4>& a, const Floats<4>& b) {
+    return { _mm_add_ps(a.lanes, b.lanes) };
+  }
+
+  inline Floats<4> operator-(const Floats<4>& a, const Floats<4>& b) {
+    return { _mm_sub_ps(a.lanes, b.lanes) };
+  }
+
+  inline Floats<4> operator*(const Floats<4>& a, const Floats<4>& b) {
+    return { _mm_mul_ps(a.lanes, b.lanes) };
+  }
+
+  inline Floats<4> operator/(const Floats<4>& a, const Floats<4>& b) {
+    return { _mm_div_ps(a.lanes, b.lanes) };
+  }
+
+  inline Floats<4> min(const Floats<4>& a, const Floats<4>& b) {
+    return { _mm_min_ps(a.lanes, b.lanes) };
+  }
+
+  inline Floats<4> max(const Floats<4>& a, const Floats<4>& b) {
+    return { _mm_max_ps(a.lanes, b.lanes) };
+  }
+
+  inline int greater_mask(const Floats<4>& a, const Floats<4>& b) {
+    return _mm_movemask_ps(_mm_cmpgt_ps(a.lanes, b.lanes));
+  }
+
+  inline int less_mask(const Floats<4>& a, const Floats<4>& b) {
+    return _mm_movemask_ps(_mm_cmplt_ps(a.lanes, b.lanes));
+  }
+
+  inline int greater_equal_mask(const Floats<4>& a, const Floats<4>& b) {
+    return _mm_movemask_ps(_mm_cmpge_ps(a.lanes, b.lanes));
+  }
+#endif
+
+#if defined(__SSE2__) && !defined(CPU_SIMD_AVX)
+  // Pair of SSE vectors, for 8 lanes without AVX
+  template <>
+  struct Floats<8> {
+    Floats<4> low;
+    Floats<4> high;
+
+    static Floats load(const float* data) {
+      return { Floats<4>::load(data), Floats<4>::load(data + 4) };
+    }
+
+    static Floats load_bytes(const unsigned char* data) {
+      return { Floats<4>::load_bytes(data), Floats<4>::load_bytes(data + 4) };
+    }
+
+    static Floats broadcast(float value) {
+      return { Floats<4>::broadcast(value), Floats<4>::broadcast(value) };
+    }
+
+    void store(float* data) const {
+      low.store(data);
+      high.store(data + 4);
+    }
+  };
+
+  inline Floats<8> operator+(const Floats<8>& a, const Floats<8>& b) {
+    return { a.low + b.low, a.high + b.high };
+  }
+
+  inline Floats<8> operator-(const Floats<8>& a, const Floats<8>& b) {
+    return { a.low - b.low, a.high - b.high };
+  }
+
+  inline Floats<8> operator*(const Floats<8>& a, const Floats<8>& b) {
+    return { a.low * b.low, a.high * b.high };
+  }
+
+  inline Floats<8> operator/(const Floats<8>& a, const Floats<8>& b) {
+    return { a.low / b.low, a.high / b.high };
+  }
+
+  inline Floats<8> min(const Floats<8>& a, const Floats<8>& b) {
+    return { min(a.low, b.low), min(a.high, b.high) };
+  }
+
+  inline Floats<8> max(const Floats<8>& a, const Floats<8>& b) {
+    return { max(a.low, b.low), max(a.high, b.high) };
+  }
+
+  inline int greater_mask(const Floats<8>& a, const Floats<8>& b) {
+    return greater_mask(a.low, b.low) | greater_mask(a.high, b.high) << 4;
+  }
+
+  inline int less_mask(const Floats<8>& a, const Floats<8>& b) {
+    return less_mask(a.low, b.low) | less_mask(a.high, b.high) << 4;
+  }
+
+  inline int greater_equal_mask(const Floats<8>& a, const Floats<8>& b) {
+    return greater_equal_mask(a.low, b.low) | greater_equal_mask(a.high, b.high) << 4;
+  }
+#endif
+
+#if defined(CPU_SIMD_AVX)
+  template <>
+  struct Floats<8> {
+    __m256 lanes;
+
+    static Floats load(const float* data) {
+      return { _mm256_loadu_ps(data) };
+    }
+
+    static Floats load_bytes(const unsigned char* data) {
+#if defined(CPU_SIMD_AVX2)
+      const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(data));
+      return { _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes)) };
+#else
+      return { _mm256_setr_ps(data[0], data[1], data[2], data[3],
+                              data[4], data[5], data[6], data[7]) };
+#endif
+    }
+
+    static Floats broadcast(float value) {
+      return { _mm256_set1_ps(value) };
+    }
+
+    void store(float* data) const {
+      _mm256_storeu_ps(data, lanes);
+    }
+  };
+
+  inline Floats<8> operator+(const Floats<8>& a, const Floats<8>& b) {
+    return { _mm256_add_ps(a.lanes, b.lanes) };
+  }
+
+  inline Floats<8> operator-(const Floats<8>& a, const Floats<8>& b) {
+    return { _mm256_sub_ps(a.lanes, b.lanes) };
+  }
+
+  inline Floats<8> operator*(const Floats<8>& a, const Floats<8>& b) {
+    return { _mm256_mul_ps(a.lanes, b.lanes) };
+  }
+
+  inline Floats<8> operator/(const Floats<8>& a, const Floats<8>& b) {
+    return { _mm256_div_ps(a.lanes, b.lanes) };
+  }
+
+  inline Floats<8> min(const Floats<8>& a, const Floats<8>& b) {
+    return { _mm256_min_ps(a.lanes, b.lanes) };
+  }
+
+  inline Floats<8> max(const Floats<8>& a, const Floats<8>& b) {
+    return { _mm256_max_ps(a.lanes, b.lanes) };
+  }
+
+  inline int greater_mask(const Floats<8>& a, const Floats<8>& b) {
+    return _mm256_movemask_ps(_mm256_cmp_ps(a.lanes, b.lanes, _CMP_GT_OQ));
+  }
+
+  inline int less_mask(const Floats<8>& a, const Floats<8>& b) {
+    return _mm256_movemask_ps(_mm256_cmp_ps(a.lanes, b.lanes, _CMP_LT_OQ));
+  }
+
+  inline int greater_equal_mask(const Floats<8>& a, const Floats<8>& b) {
+    return _mm256_movemask_ps(_mm256_cmp_ps(a.lanes, b.lanes, _CMP_GE_OQ));
+  }
+#endif
+
+#if defined(CPU_SIMD_AVX512F)
+  template <>
+  struct Floats<16> {
+    __m512 lanes;
+
+    static Floats load(const float* data) {
+      return { _mm512_loadu_ps(data) };
+    }
+
+    static Floats load_bytes(const unsigned char* data) {
+      const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+      return { _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(bytes)) };
+    }
+
+    static Floats broadcast(float value) {
+      return { _mm512_set1_ps(value) };
+    }
+
+    void store(float* data) const {
+      _mm512_storeu_ps(data, lanes);
+    }
+  };
+
+  inline Floats<16> operator+(const Floats<16>& a, const Floats<16>& b) {
+    return { _mm512_add_ps(a.lanes, b.lanes) };
+  }
+
+  inline Floats<16> operator-(const Floats<16>& a, const Floats<16>& b) {
+    return { _mm512_sub_ps(a.lanes, b.lanes) };
+  }
+
+  inline Floats<16> operator*(const Floats<16>& a, const Floats<16>& b) {
+    return { _mm512_mul_ps(a.lanes, b.lanes) };
+  }
+
+  inline Floats<16> operator/(const Floats<16>& a, const Floats<16>& b) {
+    return { _mm512_div_ps(a.lanes, b.lanes) };
+  }
+
+  // The unmasked intrinsics pass GCC 12 an undefined source, which -O3 warns may be
+  // uninitialized. Selecting every lane from a is the same instruction without it.
+  inline Floats<16> min(const Floats<16>& a, const Floats<16>& b) {
+    return { _mm512_mask_min_ps(a.lanes, 0xffff, a.lanes, b.lanes) };
+  }
+
+  inline Floats<16> max(const Floats<16>& a, const Floats<16>& b) {
+    return { _mm512_mask_max_ps(a.lanes, 0xffff, a.lanes, b.lanes) };
+  }
+
+  inline int greater_mask(const Floats<16>& a, const Floats<16>& b) {
+    return _mm512_cmp_ps_mask(a.lanes, b.lanes, _CMP_GT_OQ);
+  }
+
+  inline int less_mask(const Floats<16>& a, const Floats<16>& b) {
+    return _mm512_cmp_ps_mask(a.lanes, b.lanes, _CMP_LT_OQ);
+  }
+
+  inline int greater_equal_mask(const Floats<16>& a, const Floats<16>& b) {
+    return _mm512_cmp_ps_mask(a.lanes, b.lanes, _CMP_GE_OQ);
+  }
+#endif
+}
+
+#endif // CPU_SIMD_H
@@ -0,0 +1,82 @@
+#include "tile_scheduler.h"
+#include "util/morton.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace CPU {
+  TileScheduler::TileScheduler(int width, int height, int tile_width, int tile_height,
+                               unsigned int num_threads)
+  {
+    const int num_tiles_x = (width + tile_width - 1) / tile_width;
+    const int num_tiles_y = (height + tile_height - 1) / tile_height;
+
+    std::vector<std::pair<uint32_t, Tile>> ordered_tiles;
+    ordered_tiles.reserve(static_cast<size_t>(num_tiles_x * num_tiles_y));
+
+    for (int tile_y = 0; tile_y < num_tiles_y; tile_y++) {
+      for (int tile_x = 0; tile_x < num_tiles_x; tile_x++) {
+        const int x = tile_x * tile_width;
+        const int y = tile_y * tile_height;
+        const Tile tile = {
+          x, y, std::min(tile_width, width - x), std::min(tile_height, height - y)
+        };
+        ordered_tiles.emplace_back(Morton::encode_2d(static_cast<uint32_t>(tile_x),
+                                                     static_cast<uint32_t>(tile_y)), tile);
+      }
+    }
+
+    std::sort(ordered_tiles.begin(), ordered_tiles.end(), [](const auto& a, const auto& b) {
+      return a.first < b.first;
+    });
+
+    num_tiles = ordered_tiles.size();
+
+    for (unsigned int t = 0; t < num_threads; t++) {
+      queues.emplace_back(std::make_unique<Queue>());
+
+      const size_t begin = num_tiles * t / num_threads;
+      const size_t end = num_tiles * (t + 1) / num_threads;
+      for (size_t i = begin; i < end; i++) {
+        queues.back()->tiles.emplace_back(ordered_tiles[i].second);
+      }
+    }
+  }
+
+  bool TileScheduler::next_tile(unsigned int thread, Tile& tile, bool& stolen)
+  {
+    {
+      Queue& own = *queues[thread];
+      std::lock_guard<std::mutex> lock(own.mutex);
+
+      if (!own.tiles.empty()) {
+        tile = own.tiles.front();
+        own.tiles.pop_front();
+        stolen = false;
+        return true;
+      }
+    }
+
+    // Tiles are never added back, so one pass over the other deques finding them all empty
+    // means the image is done
+    const size_t num_queues = queues.size();
+    for (size_t i = 1; i < num_queues; i++) {
+      Queue& victim = *queues[(thread + i) % num_queues];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+
+      if (!victim.tiles.empty()) {
+        tile = victim.tiles.back();
+        victim.tiles.pop_back();
+        stolen = true;
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  size_t TileScheduler::get_num_tiles() const
+  {
+    return num_tiles;
+  }
+}
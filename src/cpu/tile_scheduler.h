@@ -0,0 +1,47 @@
+#ifndef CPU_TILE_SCHEDULER_H
+#define CPU_TILE_SCHEDULER_H
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace CPU {
+  // Hands out the tiles of an image to a fixed set of threads. Tiles are issued in Morton order
+  // and dealt to the threads in contiguous runs, so each thread starts on a compact region. A
+  // thread takes tiles from the front of its own deque, and once that is empty steals from the
+  // back of the others, where the tiles furthest from their owner's current work are.
+  class TileScheduler
+  {
+  public:
+    // Matches local_size_x and local_size_y in raytrace.comp
+    static constexpr int DEFAULT_TILE_WIDTH = 32;
+    static constexpr int DEFAULT_TILE_HEIGHT = 24;
+
+    struct Tile {
+      int x, y;
+      int width, height;
+    };
+
+    // Tiles at the right and top edges are clipped to the image
+    TileScheduler(int width, int height, int tile_width, int tile_height,
+                  unsigned int num_threads);
+
+    // Takes the next tile for thread, setting stolen when it came from another thread's deque.
+    // Returns false once every tile has been taken.
+    bool next_tile(unsigned int thread, Tile& tile, bool& stolen);
+
+    size_t get_num_tiles() const;
+
+  private:
+    struct Queue {
+      std::mutex mutex;
+      std::deque<Tile> tiles;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    size_t num_tiles;
+  };
+}
+
+#endif // CPU_TILE_SCHEDULER_H
@@ -11,7 +11,19 @@ Camera::Camera(vec3 position, vec3 forward, vec3 up, int width, int height, floa
     forward(glm::normalize(forward)),
     fovy(fovy),
     width(width),
-    height(height)
+    height(height),
+    UBO(0)
+{
+}
+
+Camera::~Camera()
+{
+  if (UBO) {
+    glDeleteBuffers(1, &UBO);
+  }
+}
+
+void Camera::init_buffer()
 {
   vec2 coord_scale = get_coord_scale();
   vec2 coord_dims = get_coord_dims();
@@ -27,11 +39,6 @@ Camera::Camera(vec3 position, vec3 forward, vec3 up, int width, int height, floa
   glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }
 
-Camera::~Camera()
-{
-  glDeleteBuffers(1, &UBO);
-}
-
 mat3 Camera::get_coord_frame() const
 {
   vec3 w = -glm::normalize(forward);
@@ -82,6 +89,11 @@ void Camera::update_frames() {
   last_frame = current_frame;
   speed = 2.5f * time_delta;
 
+  // The buffer is created on first use so that headless renders never need a GL context
+  if (!UBO) {
+    init_buffer();
+  }
+
   vec3 camera_pos = get_position();
   mat3 coord_frame = get_coord_frame();
 
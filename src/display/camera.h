@@ -34,6 +34,8 @@ public:
   void circle();
 
 private:
+  void init_buffer();
+
   vec3 up;
   vec3 position;
   vec3 forward;
@@ -1,14 +1,18 @@
 #include "display.h"
 #include "util/data.h"
+#include "model/scene.h"
 #include "display/window.h"
 #include "util/profiling/profiling.h"
 
-Display::Display(std::shared_ptr<Camera> camera)
+Display::Display(std::shared_ptr<Camera> camera, const std::string& scene_path)
   : camera(camera),
     rect_shader("../../shaders/object/rect.vert", "../../shaders/object/rect.frag"),
     compute_shader("../../shaders/compute/raytrace.comp",
                    static_cast<unsigned int>(Window::get_width()),
-                   static_cast<unsigned int>(Window::get_height()), 1),
+                   static_cast<unsigned int>(Window::get_height()), 1,
+                   IntersectableManager::get_shader_defines()),
+    wavefront(Window::get_width(), Window::get_height()),
+    render_mode(RenderMode::Megakernel),
     image(Window::get_width(), Window::get_height())
 {
   image.add_image(GL_RGBA8, false, true);
@@ -18,39 +22,44 @@ Display::Display(std::shared_ptr<Camera> camera)
   rect.add_vertex_attribs({ 2, 2 });
   rect.finalize_setup();
 
-  intersectables.add_sphere({ vec3(0.0f, 0.8f, 1.0f), 0.8f },
-                            { vec3(0.2f, 1.0f, 0.2f), 0.8f, 0.5f, 0.6f });
-  intersectables.add_sphere({ vec3(3.0f, 1.0f, 0.0f), 1.0f },
-                            { vec3(1.0f, 0.2f, 0.2f), 1.0f, 0.1f, 0.6f });
-  intersectables.add_sphere({ vec3(-3.0f, 0.5f, -0.5f), 0.5f },
-                            { vec3(0.2f, 0.2f, 1.0f), 0.2f, 1.0f, 0.7f });
-  intersectables.add_sphere({ vec3(1.0f, 0.75f, -2.0f), 0.75f },
-                            { vec3(1.0f, 1.0f, 0.2f), 0.2f, 0.1f, 0.5f });
-  intersectables.add_sphere({ vec3(-2.0f, 0.6f, -3.0f), 0.6f },
-                            { vec3(1.0f), 1.0f, 0.1f, 0.0f });
+  // Page files stream their meshes, so only the proxy instances are built here
+  if (GeometryPages::is_page_file(scene_path)) {
+    Scene::load_pages(intersectables, light, scene_path);
+    intersectables.finalize();
+    light.finalize();
+    return;
+  }
 
-  intersectables.add_triangle({ vec3(8.0f, 0.0f, 8.0f), vec3(8.0f, 0.0f, -8.0f), vec3(-8.0f, 0.0f, -8.0f) },
-                             { vec3(0.2f), 0.2f, 0.2f, 0.0f });
-  intersectables.add_triangle({ vec3(8.0f, 0.0f, 8.0f), vec3(-8.0f, 0.0f, -8.0f), vec3(-8.0f, 0.0f, 8.0f) },
-                             { vec3(0.2f), 0.2f, 0.2f, 0.0f });
+  if (!scene_path.empty()) {
+    scene_file = std::make_unique<SceneFile>(scene_path);
+    scene_file->upload();
+    return;
+  }
 
-  intersectables.add_aabb(
-    { vec3(-1.0f, 1.0f, -1.0f), vec3(1.0f, 2.0f, 1.0f) },
-    { vec3(1.0f, 0.5f, 1.0f), 1.0f, 0.1f, 0.2f }
-  );
+  Scene::load_default(intersectables, light);
 
+  intersectables.set_cache_directory("bvh_cache");
   intersectables.finalize();
+  light.finalize();
+}
 
-  light.add_point_light({ vec3(5.0, 5.0, -2.0), vec3(50.0, 50.0, 8.0) });
-  light.add_point_light({ vec3(-5.0, 5.0, -2.0), vec3(8.0, 8.0, 50.0) });
-  light.add_point_light({ vec3(0.0, 5.0, 2.0), vec3(50.0) });
-  light.add_point_light({ vec3(-3.0, 10.0, 1.0), vec3(50.0) });
-  light.add_point_light({ vec3(4.0, 10.0, -4.0), vec3(50.0) });
+void Display::set_render_mode(RenderMode render_mode)
+{
+  this->render_mode = render_mode;
+  wavefront.set_ray_sorting(render_mode == RenderMode::SortedWavefront);
+}
 
-  light.finalize();
+Wavefront& Display::get_wavefront()
+{
+  return wavefront;
+}
+
+const GeometryStreamer* Display::get_geometry_streamer() const
+{
+  return intersectables.get_geometry_streamer();
 }
 
-void Display::draw() const
+void Display::draw()
 {
   PROFILE_SCOPE("Draw");
 
@@ -60,8 +69,21 @@ void Display::draw() const
   PROFILE_SECTION_END();
 
   PROFILE_SECTION_START("Compute raytracing");
-  compute_shader.use();
-  compute_shader.dispatch_compute();
+  // Dynamic scene buffers swap in a region with the latest edits, and fence it after
+  intersectables.begin_frame();
+  light.begin_frame();
+  switch (render_mode) {
+    case RenderMode::Megakernel:
+      compute_shader.use();
+      compute_shader.dispatch_compute();
+      break;
+    case RenderMode::Wavefront:
+    case RenderMode::SortedWavefront:
+      wavefront.dispatch();
+      break;
+  }
+  intersectables.end_frame();
+  light.end_frame();
   PROFILE_SECTION_END();
 
   PROFILE_SECTION_START("Draw to screen");
@@ -4,26 +4,47 @@
 #include "model/object.h"
 #include "model/intersectable/intersectable_manager.h"
 #include "model/light.h"
+#include "model/scene_file.h"
 #include "shader/shader.h"
 #include "shader/image.h"
 #include "display/camera.h"
+#include "display/wavefront.h"
 
 #include <memory>
+#include <string>
 
 class Display {
 public:
-  Display(std::shared_ptr<Camera> camera);
+  // Uploads the scene file at scene_path straight from its mapping, streams the meshes of a page
+  // file, or builds the default scene when the path is empty
+  Display(std::shared_ptr<Camera> camera, const std::string& scene_path);
 
-  void draw() const;
+  // Megakernel runs raytrace.comp once per pixel, Wavefront splits it into passes over queues,
+  // SortedWavefront also sorts the reflected rays before each bounce
+  enum class RenderMode {
+    Megakernel,
+    Wavefront,
+    SortedWavefront,
+  };
+
+  void set_render_mode(RenderMode render_mode);
+  void draw();
+
+  Wavefront& get_wavefront();
+  // Residency of the pages of a page file, null for other scenes
+  const GeometryStreamer* get_geometry_streamer() const;
 
 private:
   std::shared_ptr<Camera> camera;
   Object rect;
   Shader rect_shader;
   Shader compute_shader;
+  Wavefront wavefront;
+  RenderMode render_mode;
   Image image;
   IntersectableManager intersectables;
   Light light;
+  std::unique_ptr<SceneFile> scene_file;
 };
 
 #endif // DISPLAY_H
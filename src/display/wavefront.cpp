@@ -0,0 +1,220 @@
+#include "wavefront.h"
+#include "model/intersectable/intersectable_manager.h"
+#include "util/profiling/profiling.h"
+
+#include <glad/glad.h>
+#include <string>
+
+namespace {
+  constexpr const char* RAYTRACE_PATH = "../../shaders/compute/raytrace.comp";
+
+  // Defines of one stage of raytrace.comp, after those every compile of it takes
+  std::string get_defines(std::string_view stage)
+  {
+    return IntersectableManager::get_shader_defines() + std::string(stage);
+  }
+
+  // Bounces of each path, the same as MAX_RECURSION_DEPTH in raytrace.comp
+  constexpr int MAX_RECURSION_DEPTH = 4;
+
+  // Sizes of the queued structs in raytrace.comp, with std430 padding
+  constexpr long QUEUE_SIZE = 4 * sizeof (unsigned int);
+  constexpr long PATH_SIZE = 8 * sizeof (float);
+  constexpr long QUEUED_RAY_SIZE = 8 * sizeof (float);
+  constexpr long QUEUED_HIT_SIZE = 12 * sizeof (float);
+  constexpr long QUEUED_SHADOW_SIZE = 8 * sizeof (float);
+
+  // WavefrontSort in raytrace.comp: the origin bounds, then a count per bin of NUM_SORT_BINS
+  constexpr long NUM_SORT_BINS = 8 * 4096;
+  constexpr long SORT_BOUNDS_SIZE = 6 * sizeof (unsigned int);
+  constexpr long SORT_SIZE = SORT_BOUNDS_SIZE + NUM_SORT_BINS * sizeof (unsigned int);
+  constexpr long SORT_KEY_SIZE = 2 * sizeof (unsigned int);
+
+  // Shader writes to the queues are read by the next pass and by its indirect dispatch
+  constexpr GLbitfield QUEUE_BARRIER_BITS = GL_SHADER_STORAGE_BARRIER_BIT |
+                                            GL_COMMAND_BARRIER_BIT |
+                                            GL_BUFFER_UPDATE_BARRIER_BIT;
+}
+
+Wavefront::Wavefront(int width, int height)
+  : generate_shader(RAYTRACE_PATH, static_cast<unsigned int>(width),
+                    static_cast<unsigned int>(height), 1,
+                    get_defines("#define WAVEFRONT_GENERATE\n")),
+    extend_shader(RAYTRACE_PATH, 0, 0, 0, get_defines("#define WAVEFRONT_EXTEND\n")),
+    shade_shader(RAYTRACE_PATH, 0, 0, 0, get_defines("#define WAVEFRONT_SHADE\n")),
+    shadow_shader(RAYTRACE_PATH, 0, 0, 0, get_defines("#define WAVEFRONT_SHADOW\n")),
+    store_shader(RAYTRACE_PATH, static_cast<unsigned int>(width),
+                 static_cast<unsigned int>(height), 1, get_defines("#define WAVEFRONT_STORE\n")),
+    sort_bounds_shader(RAYTRACE_PATH, 0, 0, 0, get_defines("#define WAVEFRONT_SORT_BOUNDS\n")),
+    sort_keys_shader(RAYTRACE_PATH, 0, 0, 0, get_defines("#define WAVEFRONT_SORT_KEYS\n")),
+    // The scan is a single group, which dispatch_compute launches for a size of 32x24
+    sort_scan_shader(RAYTRACE_PATH, 32, 24, 1, get_defines("#define WAVEFRONT_SORT_SCAN\n")),
+    sort_scatter_shader(RAYTRACE_PATH, 0, 0, 0, get_defines("#define WAVEFRONT_SORT_SCATTER\n")),
+    ray_queue(0),
+    ray_sorting(false),
+    timing(false),
+    timings{}
+{
+  // Each queue holds at most one ray per pixel
+  const long num_pixels = static_cast<long>(width) * height;
+
+  glGenBuffers(1, &queues);
+  glGenBuffers(1, &paths);
+  glGenBuffers(2, rays);
+  glGenBuffers(1, &hits);
+  glGenBuffers(1, &shadows);
+  glGenBuffers(1, &sort);
+  glGenBuffers(1, &sort_keys);
+
+  constexpr GLenum buffer_type = GL_SHADER_STORAGE_BUFFER;
+
+  const auto create_storage = [](unsigned int buffer, unsigned int binding, long size) {
+    glBindBuffer(buffer_type, buffer);
+    glBufferStorage(buffer_type, size, nullptr, GL_DYNAMIC_STORAGE_BIT);
+    glBindBufferBase(buffer_type, binding, buffer);
+  };
+
+  create_storage(queues, 13, NUM_QUEUES * QUEUE_SIZE);
+  create_storage(paths, 14, num_pixels * PATH_SIZE);
+  create_storage(rays[0], 15, num_pixels * QUEUED_RAY_SIZE);
+  create_storage(hits, 16, num_pixels * QUEUED_HIT_SIZE);
+  create_storage(shadows, 17, num_pixels * QUEUED_SHADOW_SIZE);
+  create_storage(sort, 18, SORT_SIZE);
+  create_storage(sort_keys, 19, num_pixels * SORT_KEY_SIZE);
+  create_storage(rays[1], 20, num_pixels * QUEUED_RAY_SIZE);
+
+  glBindBuffer(buffer_type, 0);
+
+  glGenQueries(1, &sort_query);
+  glGenQueries(1, &extend_query);
+}
+
+Wavefront::~Wavefront()
+{
+  glDeleteBuffers(1, &queues);
+  glDeleteBuffers(1, &paths);
+  glDeleteBuffers(2, rays);
+  glDeleteBuffers(1, &hits);
+  glDeleteBuffers(1, &shadows);
+  glDeleteBuffers(1, &sort);
+  glDeleteBuffers(1, &sort_keys);
+  glDeleteQueries(1, &sort_query);
+  glDeleteQueries(1, &extend_query);
+}
+
+void Wavefront::dispatch()
+{
+  PROFILE_SCOPE("Wavefront");
+
+  glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, queues);
+
+  ray_queue = 0;
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 15, rays[0]);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 20, rays[1]);
+
+  clear_queue(RAY_QUEUE);
+  generate_shader.use();
+  generate_shader.dispatch_compute();
+  glMemoryBarrier(QUEUE_BARRIER_BITS);
+
+  for (int recursion_depth = 0; recursion_depth < MAX_RECURSION_DEPTH; recursion_depth++) {
+    // Camera rays are already coherent
+    if (ray_sorting && recursion_depth > 0) {
+      if (timing) {
+        glBeginQuery(GL_TIME_ELAPSED, sort_query);
+      }
+      sort_rays();
+      if (timing) {
+        glEndQuery(GL_TIME_ELAPSED);
+        GLuint64 nanoseconds;
+        glGetQueryObjectui64v(sort_query, GL_QUERY_RESULT, &nanoseconds);
+        timings.sort_seconds += nanoseconds * 1e-9;
+      }
+    }
+
+    clear_queue(HIT_QUEUE);
+    if (timing) {
+      glBeginQuery(GL_TIME_ELAPSED, extend_query);
+    }
+    dispatch_queue(extend_shader, RAY_QUEUE);
+    if (timing) {
+      glEndQuery(GL_TIME_ELAPSED);
+      GLuint64 nanoseconds;
+      glGetQueryObjectui64v(extend_query, GL_QUERY_RESULT, &nanoseconds);
+      timings.extend_seconds += nanoseconds * 1e-9;
+    }
+
+    // The rays were all extended, so the queue takes the reflections
+    clear_queue(RAY_QUEUE);
+    clear_queue(SHADOW_QUEUE);
+    dispatch_queue(shade_shader, HIT_QUEUE);
+
+    dispatch_queue(shadow_shader, SHADOW_QUEUE);
+  }
+
+  store_shader.use();
+  store_shader.dispatch_compute();
+
+  glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+
+  if (timing) {
+    timings.num_frames++;
+  }
+}
+
+void Wavefront::set_ray_sorting(bool enabled)
+{
+  ray_sorting = enabled;
+}
+
+void Wavefront::set_timing(bool enabled)
+{
+  timing = enabled;
+  timings = {};
+}
+
+Wavefront::Timings Wavefront::get_timings() const
+{
+  return timings;
+}
+
+// Empties a queue, leaving a dispatch of 0x1x1 groups
+void Wavefront::clear_queue(Queue queue) const
+{
+  constexpr unsigned int EMPTY_QUEUE[4] = { 0, 1, 1, 0 };
+  glClearNamedBufferSubData(queues, GL_RGBA32UI, queue * QUEUE_SIZE, QUEUE_SIZE,
+                            GL_RGBA_INTEGER, GL_UNSIGNED_INT, EMPTY_QUEUE);
+}
+
+// Runs a stage over the entries of a queue, with as many groups as the queue counted
+void Wavefront::dispatch_queue(const Shader& shader, Queue queue) const
+{
+  shader.use();
+  shader.dispatch_compute_indirect(queue * QUEUE_SIZE);
+  glMemoryBarrier(QUEUE_BARRIER_BITS);
+}
+
+// Counting sort of the ray queue into NUM_SORT_BINS bins: bounds of the origins, bin and rank of
+// each ray, a scan of the bin counts, then a scatter into the other ray buffer
+void Wavefront::sort_rays()
+{
+  constexpr unsigned int NO_MIN = 0xffffffff;
+  constexpr unsigned int ZERO = 0;
+  glClearNamedBufferSubData(sort, GL_R32UI, 0, SORT_BOUNDS_SIZE / 2,
+                            GL_RED_INTEGER, GL_UNSIGNED_INT, &NO_MIN);
+  glClearNamedBufferSubData(sort, GL_R32UI, SORT_BOUNDS_SIZE / 2, SORT_SIZE - SORT_BOUNDS_SIZE / 2,
+                            GL_RED_INTEGER, GL_UNSIGNED_INT, &ZERO);
+
+  dispatch_queue(sort_bounds_shader, RAY_QUEUE);
+  dispatch_queue(sort_keys_shader, RAY_QUEUE);
+
+  sort_scan_shader.use();
+  sort_scan_shader.dispatch_compute();
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+  dispatch_queue(sort_scatter_shader, RAY_QUEUE);
+
+  ray_queue = 1 - ray_queue;
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 15, rays[ray_queue]);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 20, rays[1 - ray_queue]);
+}
@@ -0,0 +1,73 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "shader/shader.h"
+
+// Renders raytrace.comp in separate passes instead of one kernel per pixel. Generate starts a
+// path per pixel, then for each bounce extend finds the closest hits, shade adds the ambient
+// color and queues reflections, and shadow traces the rays to the lights. Each pass runs only
+// over the rays left in its queue, sized on the GPU, so no lane waits on paths that ended.
+class Wavefront {
+public:
+  Wavefront(int width, int height);
+  ~Wavefront();
+
+  // Seconds spent on the GPU in the sort and extend passes, summed over the timed frames
+  struct Timings {
+    double sort_seconds;
+    double extend_seconds;
+    int num_frames;
+  };
+
+  void dispatch();
+
+  // Sorts the reflected rays by direction octant and origin before each bounce, so the rays of
+  // a subgroup are more likely to visit the same BVH nodes. Off by default.
+  void set_ray_sorting(bool enabled);
+
+  // Times the sort and extend passes with timer queries, which waits for the GPU every frame
+  void set_timing(bool enabled);
+  Timings get_timings() const;
+
+private:
+  // Queues in the order of WavefrontQueues in raytrace.comp
+  enum Queue {
+    RAY_QUEUE,
+    HIT_QUEUE,
+    SHADOW_QUEUE,
+    NUM_QUEUES,
+  };
+
+  void clear_queue(Queue queue) const;
+  void dispatch_queue(const Shader& shader, Queue queue) const;
+  void sort_rays();
+
+  Shader generate_shader;
+  Shader extend_shader;
+  Shader shade_shader;
+  Shader shadow_shader;
+  Shader store_shader;
+  Shader sort_bounds_shader;
+  Shader sort_keys_shader;
+  Shader sort_scan_shader;
+  Shader sort_scatter_shader;
+
+  unsigned int queues;
+  unsigned int paths;
+  unsigned int hits;
+  unsigned int shadows;
+  unsigned int sort;
+  unsigned int sort_keys;
+
+  // The sort scatters from the ray queue into the other buffer, which then becomes the queue
+  unsigned int rays[2];
+  int ray_queue;
+
+  bool ray_sorting;
+  bool timing;
+  unsigned int sort_query;
+  unsigned int extend_query;
+  Timings timings;
+};
+
+#endif // WAVEFRONT_H
@@ -3,10 +3,13 @@
 #include "util/data.h"
 #include "util/profiling/profiling.h"
 
+#include <iostream>
+#include <utility>
+
 int Window::width = 0;
 int Window::height = 0;
 
-Window::Window()
+Window::Window(const std::string& scene_path)
 {
   glfwInit();
   glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
@@ -41,7 +44,7 @@ Window::Window()
                                     width, height, 45.0f);
 
   try {
-    display = std::make_unique<Display>(camera);
+    display = std::make_unique<Display>(camera, scene_path);
   } catch (...) {
     glfwDestroyWindow(window);
     std::rethrow_exception(std::current_exception());
@@ -94,6 +97,76 @@ void Window::main_loop() {
   }
 }
 
+// Draws num_frames frames with each render mode, printing the mean time of a frame
+void Window::benchmark(int num_frames) {
+  const std::pair<const char*, Display::RenderMode> render_modes[] = {
+    { "megakernel", Display::RenderMode::Megakernel },
+    { "wavefront", Display::RenderMode::Wavefront },
+    { "wavefront sorted", Display::RenderMode::SortedWavefront },
+  };
+
+  double megakernel_seconds = 0.0;
+
+  try {
+    for (const auto& [name, render_mode] : render_modes) {
+      display->set_render_mode(render_mode);
+
+      // The first frame also waits for the driver to finish compiling the shaders
+      display->draw();
+      glFinish();
+
+      double t_start = glfwGetTime();
+      for (int i = 0; i < num_frames; i++) {
+        display->draw();
+      }
+      glFinish();
+      double seconds = (glfwGetTime() - t_start) / num_frames;
+
+      if (megakernel_seconds == 0.0) {
+        megakernel_seconds = seconds;
+      }
+
+      std::cout << name << ": " << seconds * 1e3 << " ms per frame, "
+                << megakernel_seconds / seconds << "x megakernel" << std::endl;
+
+      if (render_mode == Display::RenderMode::Megakernel) {
+        continue;
+      }
+
+      // Timed separately, since reading the timer queries waits for each pass
+      Wavefront& wavefront = display->get_wavefront();
+      wavefront.set_timing(true);
+      for (int i = 0; i < num_frames; i++) {
+        display->draw();
+      }
+      Wavefront::Timings timings = wavefront.get_timings();
+      wavefront.set_timing(false);
+
+      std::cout << "  extend " << timings.extend_seconds * 1e3 / timings.num_frames
+                << " ms, sort " << timings.sort_seconds * 1e3 / timings.num_frames
+                << " ms per frame" << std::endl;
+    }
+  } catch (...) {
+    glfwDestroyWindow(window);
+    std::rethrow_exception(std::current_exception());
+  }
+
+  // Over every frame above, the first ones of which miss all pages
+  if (const GeometryStreamer* streamer = display->get_geometry_streamer()) {
+    const GeometryStreamer::Stats& stats = streamer->get_stats();
+    std::cout << "streaming: " << stats.get_hit_rate() * 100.0 << "% of " << stats.num_requests
+              << " page requests resident, " << stats.num_loads << " pages loaded, "
+              << stats.num_evictions << " evicted, " << stats.bytes_streamed / 1e6 << " MB at "
+              << stats.get_bandwidth() / 1e6 << " MB/s" << std::endl;
+  }
+
+  display->set_render_mode(Display::RenderMode::Megakernel);
+}
+
+void Window::set_render_mode(Display::RenderMode render_mode) {
+  display->set_render_mode(render_mode);
+}
+
 int Window::get_width()
 {
   return width;
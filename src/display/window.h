@@ -5,6 +5,7 @@
 #include "display/camera.h"
 
 #include <memory>
+#include <string>
 
 #include <GLFW/glfw3.h>
 
@@ -12,10 +13,13 @@ using namespace glm;
 
 class Window {
 public:
-  Window();
+  // Shows the scene or page file at scene_path, or the default scene when it is empty
+  Window(const std::string& scene_path = "");
   ~Window();
 
   void main_loop();
+  void benchmark(int num_frames);
+  void set_render_mode(Display::RenderMode render_mode);
 
   static int get_width();
   static int get_height();
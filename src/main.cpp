@@ -1,10 +1,351 @@
 #include "display/window.h"
+#include "cpu/raytracer.h"
+#include "model/geometry_pages.h"
+#include "model/mesh_loader.h"
+#include "model/scene.h"
+#include "model/scene_file.h"
 
+#include <cmath>
 #include <iostream>
+#include <memory>
+#include <utility>
+#include <string>
+#include <string_view>
+#include <tuple>
 
-int main() {
+// Loads a scene by name, returning the camera position and direction to view it from
+static std::pair<vec3, vec3> load_scene(std::string_view scene,
+                                        IntersectableManager& intersectables, Light& light) {
+  if (scene == "forest") {
+    Scene::load_forest(intersectables, light, 10000);
+    return { vec3(-40.0f, 10.0f, -40.0f), vec3(1.0f, -0.3f, 1.0f) };
+  }
+
+  // Anything else with a mesh extension is a path, viewed from a corner of its bounds
+  if (scene.size() > 4 && (scene.substr(scene.size() - 4) == ".obj" ||
+                           scene.substr(scene.size() - 4) == ".ply")) {
+    const Bounds bounds = Scene::load_mesh(intersectables, light, std::string(scene));
+    const vec3 center = (bounds.min + bounds.max) * 0.5f;
+    const vec3 offset = vec3(1.0f, 0.6f, 1.0f) * length(bounds.get_extent());
+    return { center + offset, -offset };
+  }
+
+  Scene::load_default(intersectables, light);
+  return { vec3(6.0f, 4.0f, 0.0f), vec3(-6.0f, -4.0f, 0.0f) };
+}
+
+// Renders a scene on the CPU without creating a window or GL context
+static void render_headless(int argc, char** argv) {
+  const char* output_path = argc > 2 ? argv[2] : "render.ppm";
+  const int width = argc > 3 ? std::stoi(argv[3]) : 1920;
+  const int height = argc > 4 ? std::stoi(argv[4]) : 1080;
+  const unsigned int num_threads = argc > 5 ? static_cast<unsigned int>(std::stoi(argv[5])) : 0;
+  const std::string_view scene = argc > 6 ? argv[6] : "default";
+  const int tile_width = argc > 7 ? std::stoi(argv[7]) : CPU::TileScheduler::DEFAULT_TILE_WIDTH;
+  const int tile_height = argc > 8 ? std::stoi(argv[8]) : CPU::TileScheduler::DEFAULT_TILE_HEIGHT;
+  const CPU::ISA isa = argc > 9 ? CPU::get_isa(argv[9]) : CPU::get_supported_isa();
+
+  // Scene files are traced straight from their mapping, other scenes are packed first
+  IntersectableManager intersectables;
+  Light light;
+  std::unique_ptr<SceneFile> file;
+  vec3 camera_position, camera_direction;
+  CPU::SceneData scene_data = {};
+
+  if (SceneFile::is_scene_file(std::string(scene))) {
+    file = std::make_unique<SceneFile>(std::string(scene));
+    camera_position = file->get_info().camera_position;
+    camera_direction = file->get_info().camera_direction;
+    scene_data = CPU::get_scene_data(*file);
+  } else {
+    std::tie(camera_position, camera_direction) = load_scene(scene, intersectables, light);
+    intersectables.pack();
+    light.pack();
+    scene_data = CPU::get_scene_data(intersectables, light);
+  }
+
+  Camera camera(camera_position, camera_direction, vec3(0.0f, 1.0f, 0.0f),
+                width, height, 45.0f);
+
+  CPU::Raytracer raytracer(width, height, num_threads);
+  raytracer.set_tile_size(tile_width, tile_height);
+  raytracer.set_isa(isa);
+  CPU::Raytracer::Stats stats = raytracer.render(scene_data,
+                                                 CPU::Raytracer::get_eye_coords(camera));
+  raytracer.write_ppm(output_path);
+
+  std::cout << "Rendered " << width << "x" << height << " to " << output_path
+            << " in " << stats.seconds * 1e3 << " ms on " << stats.num_threads << " threads"
+            << " with " << CPU::get_isa_name(stats.isa) << " kernels" << std::endl;
+  std::cout << stats.num_rays << " rays, " << stats.get_rays_per_second() / 1e6
+            << " Mrays/s, " << stats.get_rays_per_second_per_thread() / 1e6
+            << " Mrays/s per thread" << std::endl;
+
+  // Busy time of each thread over its tiles, the rest it was idle
+  std::cout << tile_width << "x" << tile_height << " tiles, "
+            << stats.get_load_balance() * 100.0 << "% load balance" << std::endl;
+  for (size_t t = 0; t < stats.thread_stats.size(); t++) {
+    const CPU::Raytracer::ThreadStats& thread = stats.thread_stats[t];
+    std::cout << "  thread " << t << ": " << thread.num_tiles << " tiles, "
+              << thread.num_stolen << " stolen, busy " << thread.busy_seconds * 1e3
+              << " ms, idle " << thread.idle_seconds * 1e3 << " ms" << std::endl;
+  }
+}
+
+// Packs a scene as for the CPU and saves it with its camera, for --cpu and the viewer to load
+static void convert_scene(int argc, char** argv) {
+  const std::string output_path = argc > 2 ? argv[2] : "scene.rtscene";
+  const std::string_view scene = argc > 3 ? argv[3] : "default";
+
+  IntersectableManager intersectables;
+  Light light;
+  auto [camera_position, camera_direction] = load_scene(scene, intersectables, light);
+  intersectables.pack();
+  light.pack();
+
+  SceneFile::save(output_path, intersectables, light, camera_position, camera_direction);
+  std::cout << "Saved " << scene << " to " << output_path << std::endl;
+}
+
+// Cuts OBJ or PLY meshes into geometry pages for the viewer to stream, one mesh in memory at a
+// time
+static void write_pages(int argc, char** argv) {
+  const std::string output_path = argc > 2 ? argv[2] : "scene.rtpages";
+
+  GeometryPages::Writer writer(output_path);
+  for (int i = 3; i < argc; i++) {
+    writer.add_mesh(MeshLoader::load(argv[i]));
+  }
+  writer.close();
+
+  std::cout << "Paged " << (argc > 3 ? argc - 3 : 0) << " meshes to " << output_path << std::endl;
+}
+
+// Renders a scene on the CPU with each BVH layout, with spatial splits and with ray packets,
+// comparing tree quality, node memory and traversal speed
+static void benchmark_headless(int argc, char** argv) {
+  const std::string_view scene = argc > 2 ? argv[2] : "default";
+  const int width = argc > 3 ? std::stoi(argv[3]) : 1280;
+  const int height = argc > 4 ? std::stoi(argv[4]) : 720;
+  const unsigned int num_threads = argc > 5 ? static_cast<unsigned int>(std::stoi(argv[5])) : 0;
+  const CPU::ISA isa = argc > 6 ? CPU::get_isa(argv[6]) : CPU::get_supported_isa();
+
+  std::cout << CPU::get_isa_name(isa) << " kernels, "
+            << CPU::get_isa_name(CPU::get_supported_isa()) << " supported" << std::endl;
+
+  struct Configuration {
+    const char* name;
+    BVH::Builder builder;
+    BVH::Layout layout;
+    bool packet_tracing;
+    bool ray_sorting;
+  };
+
+  const Configuration configurations[] = {
+    { "binary", BVH::Builder::BinnedSAH, BVH::Layout::Binary, false, false },
+    { "BVH4", BVH::Builder::BinnedSAH, BVH::Layout::Wide4, false, false },
+    { "BVH8", BVH::Builder::BinnedSAH, BVH::Layout::Wide8, false, false },
+    { "quantized BVH4", BVH::Builder::BinnedSAH, BVH::Layout::Quantized4, false, false },
+    { "SBVH", BVH::Builder::SBVH, BVH::Layout::Binary, false, false },
+    { "binary packets", BVH::Builder::BinnedSAH, BVH::Layout::Binary, true, false },
+    { "sorted reflections", BVH::Builder::BinnedSAH, BVH::Layout::Binary, true, true },
+  };
+
+  double binary_seconds = 0.0;
+
+  for (const auto& [name, builder, layout, packet_tracing, ray_sorting] : configurations) {
+    IntersectableManager intersectables;
+    Light light;
+    auto [camera_position, camera_direction] = load_scene(scene, intersectables, light);
+    intersectables.set_bvh_builder(builder);
+    intersectables.set_bvh_layout(layout);
+    intersectables.pack();
+    light.pack();
+
+    Camera camera(camera_position, camera_direction, vec3(0.0f, 1.0f, 0.0f),
+                  width, height, 45.0f);
+
+    CPU::Raytracer raytracer(width, height, num_threads);
+    raytracer.set_packet_tracing(packet_tracing);
+    raytracer.set_ray_sorting(ray_sorting);
+    raytracer.set_isa(isa);
+    CPU::Raytracer::Stats stats = raytracer.render(intersectables, light,
+                                                   CPU::Raytracer::get_eye_coords(camera));
+
+    // Nodes of the primitive and mesh BVHs in this layout. The instance BVH is binary in every
+    // layout and stored after the other binary nodes, so it is left out.
+    const int tlas_root = intersectables.get_num_objects()[4];
+    size_t num_nodes = tlas_root < 0 ? intersectables.get_node_data().size()
+                                     : static_cast<size_t>(tlas_root);
+    size_t node_size = sizeof (BVHNode);
+
+    switch (layout) {
+      case BVH::Layout::Binary:
+        break;
+      case BVH::Layout::Wide4:
+        num_nodes = intersectables.get_wide4_node_data().size();
+        node_size = sizeof (WideBVHNode<4>);
+        break;
+      case BVH::Layout::Wide8:
+        num_nodes = intersectables.get_wide8_node_data().size();
+        node_size = sizeof (WideBVHNode<8>);
+        break;
+      case BVH::Layout::Quantized4:
+        num_nodes = intersectables.get_quantized4_node_data().size();
+        node_size = sizeof (QuantizedBVHNode);
+        break;
+    }
+
+    if (binary_seconds == 0.0) {
+      binary_seconds = stats.seconds;
+    }
+
+    const BVH::Stats& bvh_stats = intersectables.get_bvh().get_stats();
+
+    std::cout << name << ": SAH cost " << bvh_stats.sah_cost << " with "
+              << bvh_stats.num_references << " references, " << stats.seconds * 1e3 << " ms, "
+              << stats.get_rays_per_second() / 1e6 << " Mrays/s, "
+              << binary_seconds / stats.seconds << "x binary, "
+              << stats.get_load_balance() * 100.0 << "% load balance, "
+              << num_nodes << " nodes of " << node_size << " bytes ("
+              << num_nodes * node_size / 1024 << " KB)" << std::endl;
+
+    // Groups of reflections whose rays share an octant before and after sorting, and the share
+    // of the time tracing reflections spent sorting them
+    if (ray_sorting) {
+      const CPU::Raytracer::RaySortStats& sort_stats = stats.ray_sort_stats;
+      std::cout << "  " << sort_stats.num_groups << " groups of reflections, "
+                << sort_stats.get_unsorted_coherence() * 100.0 << "% coherent unsorted, "
+                << sort_stats.get_sorted_coherence() * 100.0 << "% sorted, sorting took "
+                << sort_stats.sort_seconds * 1e3 << " ms of "
+                << (sort_stats.sort_seconds + sort_stats.secondary_seconds) * 1e3 << " ms"
+                << std::endl;
+    }
+  }
+}
+
+// Sphere i of a side by side grid among the check's trees. Moved spheres leave the grid by
+// different amounts, so the areas that pick the children of wide nodes change.
+static Sphere get_check_sphere(int i, int side, bool moved) {
+  const vec2 cell = vec2(i % side, i / side) * 0.6f - static_cast<float>(side) * 0.3f;
+  const float f = static_cast<float>(i);
+  const vec3 offset = moved ? vec3(2.0f * std::sin(f), 1.5f + std::sin(f * 0.3f),
+                                   4.0f * std::cos(f * 1.7f))
+                            : vec3(0.0f);
+  return { vec3(cell.x, 0.2f, cell.y) + offset, 0.2f };
+}
+
+// Moves spheres between the trees of a forest and refits in each BVH layout, then renders on
+// the CPU and compares against the moved scene packed from scratch. Returns whether all match.
+static bool check_refit(int argc, char** argv) {
+  const int width = argc > 2 ? std::stoi(argv[2]) : 320;
+  const int height = argc > 3 ? std::stoi(argv[3]) : 180;
+
+  constexpr int NUM_TREES = 400;
+  constexpr int SIDE = 48;
+
+  const auto load = [](IntersectableManager& intersectables, Light& light, bool moved) {
+    Scene::load_forest(intersectables, light, NUM_TREES);
+    for (int i = 0; i < SIDE * SIDE; i++) {
+      intersectables.add_sphere(get_check_sphere(i, SIDE, moved),
+                                { vec3(0.8f, 0.3f, 0.2f), 0.5f, 0.5f, 0.5f });
+    }
+  };
+
+  const std::pair<const char*, BVH::Layout> layouts[] = {
+    { "binary", BVH::Layout::Binary },
+    { "BVH4", BVH::Layout::Wide4 },
+    { "BVH8", BVH::Layout::Wide8 },
+    { "quantized BVH4", BVH::Layout::Quantized4 },
+  };
+
+  const Camera camera(vec3(-20.0f, 8.0f, -20.0f), vec3(1.0f, -0.4f, 1.0f),
+                      vec3(0.0f, 1.0f, 0.0f), width, height, 45.0f);
+  bool all_match = true;
+
+  // Spheres move out of the grid and back, so wide trees get both more and fewer nodes when
+  // collapsed again
+  for (const auto& [name, layout] : layouts) {
+    for (bool moved : { true, false }) {
+      IntersectableManager refit;
+      Light refit_light;
+      load(refit, refit_light, !moved);
+      refit.set_bvh_layout(layout);
+      refit.pack();
+      refit_light.pack();
+      for (int i = 0; i < SIDE * SIDE; i++) {
+        refit.update_sphere(i, get_check_sphere(i, SIDE, moved));
+      }
+      refit.refit();
+
+      IntersectableManager packed;
+      Light packed_light;
+      load(packed, packed_light, moved);
+      packed.set_bvh_layout(layout);
+      packed.pack();
+      packed_light.pack();
+
+      CPU::Raytracer refit_raytracer(width, height);
+      refit_raytracer.render(refit, refit_light, CPU::Raytracer::get_eye_coords(camera));
+      CPU::Raytracer packed_raytracer(width, height);
+      packed_raytracer.render(packed, packed_light, CPU::Raytracer::get_eye_coords(camera));
+
+      const std::vector<unsigned char>& refit_pixels = refit_raytracer.get_pixels();
+      const std::vector<unsigned char>& packed_pixels = packed_raytracer.get_pixels();
+      size_t num_different = 0;
+      for (size_t i = 0; i < refit_pixels.size(); i++) {
+        num_different += refit_pixels[i] != packed_pixels[i];
+      }
+
+      std::cout << name << (moved ? ", moved out: " : ", moved back: ") << num_different
+                << " of " << refit_pixels.size() << " channels differ after refitting"
+                << std::endl;
+      all_match = all_match && num_different == 0;
+    }
+  }
+
+  return all_match;
+}
+
+int main(int argc, char** argv) {
   try {
-    Window window;
+    if (argc > 1 && std::string_view(argv[1]) == "--cpu") {
+      render_headless(argc, argv);
+      return 0;
+    }
+    if (argc > 1 && std::string_view(argv[1]) == "--convert") {
+      convert_scene(argc, argv);
+      return 0;
+    }
+    if (argc > 1 && std::string_view(argv[1]) == "--pages") {
+      write_pages(argc, argv);
+      return 0;
+    }
+    if (argc > 1 && std::string_view(argv[1]) == "--benchmark") {
+      benchmark_headless(argc, argv);
+      return 0;
+    }
+    if (argc > 1 && std::string_view(argv[1]) == "--check-refit") {
+      return check_refit(argc, argv) ? 0 : -1;
+    }
+
+    if (argc > 1 && std::string_view(argv[1]) == "--gpu-benchmark") {
+      Window window(argc > 3 ? argv[3] : "");
+      window.benchmark(argc > 2 ? std::stoi(argv[2]) : 100);
+      return 0;
+    }
+
+    // The viewer shows a scene or page file given last, or the default scene
+    const bool has_scene_path = argc > 1 && (SceneFile::is_scene_file(argv[argc - 1]) ||
+                                             GeometryPages::is_page_file(argv[argc - 1]));
+    const std::string scene_path = has_scene_path ? argv[argc - 1] : "";
+
+    Window window(scene_path);
+    if (argc > 1 && std::string_view(argv[1]) == "--wavefront") {
+      bool sorted = argc > 2 && std::string_view(argv[2]) == "sorted";
+      window.set_render_mode(sorted ? Display::RenderMode::SortedWavefront
+                                    : Display::RenderMode::Wavefront);
+    }
     window.main_loop();
   } catch (const std::runtime_error& e) {
     std::cerr << e.what() << std::endl;
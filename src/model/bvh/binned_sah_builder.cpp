@@ -0,0 +1,209 @@
+#include "binned_sah_builder.h"
+#include "model/bvh/bvh.h"
+
+#include <algorithm>
+#include <mutex>
+
+BinnedSAHBuilder::BinnedSAHBuilder(ThreadPool& pool)
+  : pool(pool), num_build_nodes(0)
+{
+}
+
+void BinnedSAHBuilder::build(const std::vector<BVHPrimitive>& primitives,
+                             std::vector<BVHNode>& nodes, std::vector<int>& indices)
+{
+  this->primitives = &primitives;
+  this->indices = &indices;
+
+  // A binary tree with n leaves has at most 2n - 1 nodes
+  build_nodes.resize(2 * primitives.size());
+  num_build_nodes = 1;
+
+  Bounds bounds;
+  Bounds centroid_bounds;
+  std::mutex mutex;
+
+  pool.parallel_for(0, primitives.size(), MIN_PARALLEL_BINNING_SIZE,
+                    [&](size_t chunk_begin, size_t chunk_end) {
+    Bounds chunk_bounds;
+    Bounds chunk_centroid_bounds;
+    for (size_t i = chunk_begin; i < chunk_end; i++) {
+      chunk_bounds.grow(primitives[i].bounds);
+      chunk_centroid_bounds.grow(primitives[i].center);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    bounds.grow(chunk_bounds);
+    centroid_bounds.grow(chunk_centroid_bounds);
+  });
+
+  {
+    ThreadPool::TaskGroup group(pool);
+    build_node(0, 0, static_cast<int>(primitives.size()), bounds, centroid_bounds, group);
+    group.wait();
+  }
+
+  build_nodes.resize(static_cast<size_t>(num_build_nodes.load()));
+  flatten(build_nodes, 0, nodes);
+  build_nodes.clear();
+  build_nodes.shrink_to_fit();
+}
+
+void BinnedSAHBuilder::build_node(int node_index, int begin, int end, const Bounds& bounds,
+                                  const Bounds& centroid_bounds, ThreadPool::TaskGroup& group)
+{
+  const std::vector<BVHPrimitive>& primitives = *this->primitives;
+  const int num_primitives = end - begin;
+
+  if (num_primitives == 1) {
+    make_leaf(node_index, begin, end, bounds);
+    return;
+  }
+
+  Bins bins;
+  bin_primitives(begin, end, centroid_bounds, bins);
+
+  // Sweep the bin boundaries of every axis, evaluating the SAH at each
+  float best_cost = std::numeric_limits<float>::infinity();
+  int best_axis = -1;
+  int best_split = 0;
+
+  for (int axis = 0; axis < 3; axis++) {
+    if (centroid_bounds.min[axis] == centroid_bounds.max[axis]) {
+      continue;
+    }
+
+    float right_costs[NUM_BINS];
+    Bounds right;
+    int right_count = 0;
+    for (int i = NUM_BINS - 1; i > 0; i--) {
+      right.grow(bins[axis][i].bounds);
+      right_count += bins[axis][i].count;
+      right_costs[i] = right.get_surface_area() * count_blocks(right_count);
+    }
+
+    Bounds left;
+    int left_count = 0;
+    for (int i = 1; i < NUM_BINS; i++) {
+      left.grow(bins[axis][i - 1].bounds);
+      left_count += bins[axis][i - 1].count;
+
+      if (left_count == 0 || left_count == num_primitives) {
+        continue;
+      }
+
+      float cost = left.get_surface_area() * count_blocks(left_count) + right_costs[i];
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_axis = axis;
+        best_split = i;
+      }
+    }
+  }
+
+  const float area = bounds.get_surface_area();
+  const float leaf_cost = BVH::INTERSECTION_COST * count_blocks(num_primitives);
+  const float split_cost = area > 0.0f
+    ? BVH::TRAVERSAL_COST + BVH::INTERSECTION_COST * best_cost / area
+    : BVH::TRAVERSAL_COST + leaf_cost;
+
+  if (num_primitives <= BVH::MAX_LEAF_SIZE && (best_axis == -1 || split_cost >= leaf_cost)) {
+    make_leaf(node_index, begin, end, bounds);
+    return;
+  }
+
+  const auto first = indices->begin() + begin;
+  const auto last = indices->begin() + end;
+  int mid;
+  Bounds child_bounds[2];
+  Bounds child_centroid_bounds[2];
+
+  if (best_axis == -1) {
+    // All centroids coincide, so any split is as good as another
+    mid = begin + num_primitives / 2;
+    for (int i = begin; i < end; i++) {
+      const BVHPrimitive& primitive = primitives[static_cast<size_t>((*indices)[static_cast<size_t>(i)])];
+      child_bounds[i >= mid].grow(primitive.bounds);
+      child_centroid_bounds[i >= mid].grow(primitive.center);
+    }
+  } else {
+    const float min = centroid_bounds.min[best_axis];
+    const float scale = NUM_BINS / (centroid_bounds.max[best_axis] - min);
+
+    mid = static_cast<int>(std::partition(first, last, [&](int index) {
+      const float center = primitives[static_cast<size_t>(index)].center[best_axis];
+      return std::min(static_cast<int>((center - min) * scale), NUM_BINS - 1) < best_split;
+    }) - indices->begin());
+
+    for (int i = 0; i < NUM_BINS; i++) {
+      child_bounds[i >= best_split].grow(bins[best_axis][i].bounds);
+      child_centroid_bounds[i >= best_split].grow(bins[best_axis][i].centroid_bounds);
+    }
+  }
+
+  const int left_index = num_build_nodes.fetch_add(2);
+  build_nodes[static_cast<size_t>(node_index)] = { bounds, { left_index, left_index + 1 }, 0, 0 };
+
+  // Large right subtrees become tasks while this thread continues down the left
+  if (end - mid >= MIN_TASK_SIZE) {
+    group.run([=, &group]() {
+      build_node(left_index + 1, mid, end, child_bounds[1], child_centroid_bounds[1], group);
+    });
+  } else {
+    build_node(left_index + 1, mid, end, child_bounds[1], child_centroid_bounds[1], group);
+  }
+  build_node(left_index, begin, mid, child_bounds[0], child_centroid_bounds[0], group);
+}
+
+void BinnedSAHBuilder::bin_primitives(int begin, int end, const Bounds& centroid_bounds,
+                                      Bins& bins)
+{
+  const std::vector<BVHPrimitive>& primitives = *this->primitives;
+  const std::vector<int>& indices = *this->indices;
+
+  vec3 scale;
+  for (int axis = 0; axis < 3; axis++) {
+    float extent = centroid_bounds.max[axis] - centroid_bounds.min[axis];
+    scale[axis] = extent > 0.0f ? NUM_BINS / extent : 0.0f;
+  }
+
+  const auto bin_range = [&](size_t range_begin, size_t range_end, Bins& range_bins) {
+    for (size_t i = range_begin; i < range_end; i++) {
+      const BVHPrimitive& primitive = primitives[static_cast<size_t>(indices[i])];
+      for (int axis = 0; axis < 3; axis++) {
+        int bin = std::min(static_cast<int>((primitive.center[axis] - centroid_bounds.min[axis]) *
+                                            scale[axis]), NUM_BINS - 1);
+        Bin& target = range_bins[axis][bin];
+        target.bounds.grow(primitive.bounds);
+        target.centroid_bounds.grow(primitive.center);
+        target.count++;
+      }
+    }
+  };
+
+  if (end - begin < MIN_PARALLEL_BINNING_SIZE) {
+    bin_range(static_cast<size_t>(begin), static_cast<size_t>(end), bins);
+    return;
+  }
+
+  std::mutex mutex;
+  pool.parallel_for(static_cast<size_t>(begin), static_cast<size_t>(end),
+                    MIN_PARALLEL_BINNING_SIZE / 4, [&](size_t chunk_begin, size_t chunk_end) {
+    Bins chunk_bins;
+    bin_range(chunk_begin, chunk_end, chunk_bins);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (int axis = 0; axis < 3; axis++) {
+      for (int i = 0; i < NUM_BINS; i++) {
+        bins[axis][i].bounds.grow(chunk_bins[axis][i].bounds);
+        bins[axis][i].centroid_bounds.grow(chunk_bins[axis][i].centroid_bounds);
+        bins[axis][i].count += chunk_bins[axis][i].count;
+      }
+    }
+  });
+}
+
+void BinnedSAHBuilder::make_leaf(int node_index, int begin, int end, const Bounds& bounds)
+{
+  build_nodes[static_cast<size_t>(node_index)] = { bounds, { -1, -1 }, begin, end - begin };
+}
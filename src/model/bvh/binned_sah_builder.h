@@ -0,0 +1,46 @@
+#ifndef BINNED_SAH_BUILDER_H
+#define BINNED_SAH_BUILDER_H
+
+#include "model/bvh/bvh_builder.h"
+#include "util/thread_pool.h"
+
+#include <atomic>
+
+// Top down builder evaluating the SAH at fixed centroid bins on every axis. Subtrees are built
+// as separate tasks on a thread pool, and the binning of large nodes is split across threads.
+class BinnedSAHBuilder : public BVHBuilder
+{
+public:
+  static constexpr int NUM_BINS = 32;
+  // Subtrees smaller than this are built on the current thread
+  static constexpr int MIN_TASK_SIZE = 4096;
+  // Nodes larger than this are binned in parallel
+  static constexpr int MIN_PARALLEL_BINNING_SIZE = 1 << 16;
+
+  BinnedSAHBuilder(ThreadPool& pool = ThreadPool::get_global());
+
+  void build(const std::vector<BVHPrimitive>& primitives,
+             std::vector<BVHNode>& nodes, std::vector<int>& indices) override;
+
+private:
+  struct Bin {
+    Bounds bounds;
+    Bounds centroid_bounds;
+    int count = 0;
+  };
+
+  using Bins = Bin[3][NUM_BINS];
+
+  void build_node(int node_index, int begin, int end, const Bounds& bounds,
+                  const Bounds& centroid_bounds, ThreadPool::TaskGroup& group);
+  void bin_primitives(int begin, int end, const Bounds& centroid_bounds, Bins& bins);
+  void make_leaf(int node_index, int begin, int end, const Bounds& bounds);
+
+  ThreadPool& pool;
+  const std::vector<BVHPrimitive>* primitives = nullptr;
+  std::vector<int>* indices = nullptr;
+  std::vector<BVHBuildNode> build_nodes;
+  std::atomic<int> num_build_nodes;
+};
+
+#endif // BINNED_SAH_BUILDER_H
@@ -0,0 +1,52 @@
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include <glm/glm.hpp>
+#include <limits>
+
+using namespace glm;
+
+struct Bounds
+{
+  vec3 min = vec3(std::numeric_limits<float>::infinity());
+  vec3 max = vec3(-std::numeric_limits<float>::infinity());
+
+  void grow(const vec3& point) {
+    min = glm::min(min, point);
+    max = glm::max(max, point);
+  }
+
+  void grow(const Bounds& bounds) {
+    min = glm::min(min, bounds.min);
+    max = glm::max(max, bounds.max);
+  }
+
+  bool is_empty() const {
+    return min.x > max.x || min.y > max.y || min.z > max.z;
+  }
+
+  vec3 get_extent() const {
+    return max - min;
+  }
+
+  float get_surface_area() const {
+    if (is_empty()) {
+      return 0.0f;
+    }
+
+    vec3 extent = get_extent();
+    return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+  }
+
+  int get_largest_axis() const {
+    vec3 extent = get_extent();
+
+    if (extent.x > extent.y && extent.x > extent.z) {
+      return 0;
+    }
+
+    return extent.y > extent.z ? 1 : 2;
+  }
+};
+
+#endif // BOUNDS_H
@@ -0,0 +1,235 @@
+#include "bvh.h"
+#include "model/bvh/sah_builder.h"
+#include "model/bvh/binned_sah_builder.h"
+#include "model/bvh/lbvh_builder.h"
+#include "model/bvh/sbvh_builder.h"
+#include "model/bvh/primitive_store.h"
+#include "util/logging.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <numeric>
+
+using namespace std::chrono;
+
+void BVH::build(const PrimitiveStore& store, Builder builder)
+{
+  // Spatial splits clip the triangles themselves rather than their bounds
+  build(store.get_primitives(), builder, &store);
+}
+
+void BVH::build(const std::vector<BVHPrimitive>& primitives, Builder builder)
+{
+  build(primitives, builder, nullptr);
+}
+
+void BVH::build(const std::vector<BVHPrimitive>& primitives, Builder builder,
+                const PrimitiveStore* store)
+{
+  const auto start = steady_clock::now();
+
+  nodes.clear();
+  indices.resize(primitives.size());
+  std::iota(indices.begin(), indices.end(), 0);
+
+  dirty_primitives.clear();
+
+  if (primitives.empty()) {
+    stats = {};
+    primitive_bounds.clear();
+    compute_topology();
+    return;
+  }
+
+  std::unique_ptr<BVHBuilder> bvh_builder;
+  switch (builder) {
+    case Builder::SAH:
+      bvh_builder = std::make_unique<SAHBuilder>();
+      break;
+    case Builder::BinnedSAH:
+      bvh_builder = std::make_unique<BinnedSAHBuilder>();
+      break;
+    case Builder::LBVH:
+      bvh_builder = std::make_unique<LBVHBuilder>(LBVHBuilder::CodeSize::Bits30);
+      break;
+    case Builder::LBVH63:
+      bvh_builder = std::make_unique<LBVHBuilder>(LBVHBuilder::CodeSize::Bits63);
+      break;
+    case Builder::SBVH:
+      bvh_builder = std::make_unique<SBVHBuilder>(store, max_duplication);
+      break;
+  }
+
+  bvh_builder->set_leaf_block_size(leaf_block_size);
+  bvh_builder->build(primitives, nodes, indices);
+
+  primitive_bounds.resize(primitives.size());
+  for (size_t i = 0; i < primitives.size(); i++) {
+    primitive_bounds[i] = primitives[i].bounds;
+  }
+  compute_topology();
+
+  const double build_seconds = duration_cast<duration<double>>(steady_clock::now() - start).count();
+  stats = compute_stats();
+  stats.build_seconds = build_seconds;
+
+  Logging::get_logger() << "BVH build: " << primitives.size() << " primitives in "
+                        << stats.build_seconds * 1e3 << " ms, SAH cost " << stats.sah_cost
+                        << ", " << stats.num_nodes << " nodes, " << stats.num_leaves
+                        << " leaves, depth " << stats.max_depth << ", "
+                        << stats.num_references << " references" << std::endl;
+}
+
+void BVH::set_max_duplication(float max_duplication)
+{
+  this->max_duplication = max_duplication;
+}
+
+void BVH::set_leaf_block_size(int size)
+{
+  leaf_block_size = size;
+}
+
+void BVH::update_primitive(int index, const Bounds& bounds)
+{
+  primitive_bounds[static_cast<size_t>(index)] = bounds;
+  dirty_primitives.emplace_back(index);
+}
+
+std::vector<int> BVH::refit()
+{
+  std::vector<int> dirty_nodes;
+
+  const auto set_bounds = [this, &dirty_nodes](int node_index, const Bounds& bounds) {
+    BVHNode& node = nodes[static_cast<size_t>(node_index)];
+    if (node.min == bounds.min && node.max == bounds.max) {
+      return false;
+    }
+    node.min = bounds.min;
+    node.max = bounds.max;
+    dirty_nodes.emplace_back(node_index);
+    return true;
+  };
+
+  // Leaves refit to whole primitive bounds, so references clipped by spatial splits grow back
+  for (int primitive_index : dirty_primitives) {
+    const size_t primitive = static_cast<size_t>(primitive_index);
+
+    for (int leaf_index = leaf_offsets[primitive]; leaf_index < leaf_offsets[primitive + 1];
+         leaf_index++) {
+      int node_index = primitive_leaves[static_cast<size_t>(leaf_index)];
+      const BVHNode& leaf = nodes[static_cast<size_t>(node_index)];
+
+      Bounds bounds;
+      for (int i = leaf.offset; i < leaf.offset + leaf.count; i++) {
+        bounds.grow(primitive_bounds[static_cast<size_t>(indices[static_cast<size_t>(i)])]);
+      }
+
+      // Ancestors of an unchanged node are unchanged too
+      while (set_bounds(node_index, bounds)) {
+        node_index = parents[static_cast<size_t>(node_index)];
+        if (node_index < 0) {
+          break;
+        }
+
+        const BVHNode& node = nodes[static_cast<size_t>(node_index)];
+        const BVHNode& left = nodes[static_cast<size_t>(node_index + 1)];
+        const BVHNode& right = nodes[static_cast<size_t>(node.offset)];
+        bounds = { glm::min(left.min, right.min), glm::max(left.max, right.max) };
+      }
+    }
+  }
+
+  dirty_primitives.clear();
+
+  std::sort(dirty_nodes.begin(), dirty_nodes.end());
+  dirty_nodes.erase(std::unique(dirty_nodes.begin(), dirty_nodes.end()), dirty_nodes.end());
+
+  return dirty_nodes;
+}
+
+const std::vector<BVHNode>& BVH::get_nodes() const
+{
+  return nodes;
+}
+
+const std::vector<int>& BVH::get_indices() const
+{
+  return indices;
+}
+
+const BVH::Stats& BVH::get_stats() const
+{
+  return stats;
+}
+
+void BVH::compute_topology()
+{
+  parents.assign(nodes.size(), -1);
+  leaf_offsets.assign(primitive_bounds.size() + 1, 0);
+  primitive_leaves.assign(indices.size(), -1);
+
+  // Count the leaves of each primitive, then fill them in behind the running offsets
+  for (int index : indices) {
+    leaf_offsets[static_cast<size_t>(index) + 1]++;
+  }
+  std::partial_sum(leaf_offsets.begin(), leaf_offsets.end(), leaf_offsets.begin());
+  std::vector<int> next_leaf(leaf_offsets.begin(), leaf_offsets.end() - 1);
+
+  for (int node_index = 0; node_index < static_cast<int>(nodes.size()); node_index++) {
+    const BVHNode& node = nodes[static_cast<size_t>(node_index)];
+
+    if (node.count > 0) {
+      for (int i = node.offset; i < node.offset + node.count; i++) {
+        const size_t index = static_cast<size_t>(indices[static_cast<size_t>(i)]);
+        primitive_leaves[static_cast<size_t>(next_leaf[index]++)] = node_index;
+      }
+    } else {
+      parents[static_cast<size_t>(node_index + 1)] = node_index;
+      parents[static_cast<size_t>(node.offset)] = node_index;
+    }
+  }
+}
+
+BVH::Stats BVH::compute_stats() const
+{
+  Stats node_stats = {};
+  node_stats.num_nodes = static_cast<int>(nodes.size());
+
+  if (nodes.empty()) {
+    return node_stats;
+  }
+
+  const auto get_area = [](const BVHNode& node) {
+    return Bounds { node.min, node.max }.get_surface_area();
+  };
+  const float root_area = get_area(nodes[0]);
+
+  // Pairs of node index and depth
+  std::vector<std::pair<int, int>> stack = { { 0, 1 } };
+  float cost = 0.0f;
+
+  while (!stack.empty()) {
+    auto [node_index, depth] = stack.back();
+    stack.pop_back();
+
+    const BVHNode& node = nodes[static_cast<size_t>(node_index)];
+    const float area = get_area(node);
+    node_stats.max_depth = std::max(node_stats.max_depth, depth);
+
+    if (node.count > 0) {
+      cost += area * ((node.count + leaf_block_size - 1) / leaf_block_size) * INTERSECTION_COST;
+      node_stats.num_leaves++;
+      node_stats.num_references += node.count;
+    } else {
+      cost += area * TRAVERSAL_COST;
+      stack.emplace_back(node_index + 1, depth + 1);
+      stack.emplace_back(node.offset, depth + 1);
+    }
+  }
+
+  node_stats.sah_cost = root_area > 0.0f ? cost / root_area : 0.0f;
+
+  return node_stats;
+}
@@ -0,0 +1,137 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "model/bvh/bounds.h"
+#include "model/bvh/bvh_builder.h"
+
+#include <vector>
+
+class PrimitiveStore;
+
+// Matches struct Node in raytrace.comp. Nodes are stored depth first, so the first child of an
+// interior node immediately follows it.
+struct BVHNode
+{
+  vec3 min;
+  // Interior: index of the second child. Leaf: first entry in the primitive index list
+  int offset;
+  vec3 max;
+  // Number of primitives in a leaf, 0 for interior nodes
+  int count;
+};
+
+static_assert(sizeof (BVHNode) == 2 * sizeof (vec4), "BVHNode must match the std430 layout");
+
+// Matches struct Instance in raytrace.comp. A leaf of the instance BVH lists instances, and rays
+// are moved into object space before traversing the mesh BVH starting at root.
+struct BVHInstance
+{
+  // Rows of the affine world to object space transform
+  vec4 world_to_object[3];
+  int root;
+  int material;
+  // Page of a streamed mesh whose rays request it, see GeometryStreamer, and -1 otherwise
+  int page;
+  int padding;
+};
+
+static_assert(sizeof (BVHInstance) == 4 * sizeof (vec4),
+              "BVHInstance must match the std430 layout");
+
+class BVH
+{
+public:
+  static constexpr int MAX_LEAF_SIZE = 8;
+  static constexpr float TRAVERSAL_COST = 1.0f;
+  static constexpr float INTERSECTION_COST = 1.0f;
+
+  enum class Builder {
+    // Full sweep SAH, best quality
+    SAH,
+    // Parallel binned SAH, near sweep quality at a fraction of the build time
+    BinnedSAH,
+    // Morton order linear BVH on 30 bit codes, fastest to build, for per frame rebuilds
+    LBVH,
+    // Linear BVH on 63 bit codes, for scenes with dense clusters of primitives
+    LBVH63,
+    // SAH with spatial splits that reference large primitives from several leaves, best
+    // quality for scenes with big overlapping triangles
+    SBVH,
+  };
+
+  // Nodes the binary traversals of raytrace.comp and the CPU save on their stacks, one per
+  // level below the root, and the wide traversals of raytrace.comp. Deeper BVHs drop nodes and
+  // miss what is behind them, which IntersectableManager and GeometryPages warn about.
+  static constexpr int STACK_SIZE = 64;
+
+  // Extra references spatial splits may add by default, as a fraction of the primitives
+  static constexpr float DEFAULT_MAX_DUPLICATION = 0.3f;
+
+  // Node layout traversed by the raytracers, wide layouts are collapsed from the binary tree.
+  // The values match the BVH_ constants in raytrace.comp.
+  enum class Layout {
+    Binary,
+    // 4 children per node, on the CPU and GPU
+    Wide4,
+    // 8 children per node, CPU only
+    Wide8,
+    // 4 children per node with 8 bit bounds, half the size of Wide4, on the CPU and GPU
+    Quantized4,
+  };
+
+  struct Stats {
+    double build_seconds;
+    // Expected cost of a random ray, relative to the root, using the costs above
+    float sah_cost;
+    int num_nodes;
+    int num_leaves;
+    int max_depth;
+    // Primitive references in leaves, more than the primitives when spatial splits duplicate
+    int num_references;
+  };
+
+  // Builds over the stored primitives, whose positions in the store are the indices in leaves
+  void build(const PrimitiveStore& store, Builder builder = Builder::BinnedSAH);
+  // Builds over precomputed bounds, for primitives that are not in a store such as instances
+  void build(const std::vector<BVHPrimitive>& primitives, Builder builder = Builder::BinnedSAH);
+
+  // Budget for references duplicated by the SBVH builder, as a fraction of the primitives
+  void set_max_duplication(float max_duplication);
+  // Primitives intersected together in a leaf, e.g. PrimitiveBlock::SIZE for the CPU. The SAH
+  // builders and cost count started blocks, so leaves fill up to the block size.
+  void set_leaf_block_size(int size);
+
+  // Records new bounds for a primitive, applied to the nodes on the next refit
+  void update_primitive(int index, const Bounds& bounds);
+  // Refits the nodes above updated primitives bottom up, keeping the topology. Returns the
+  // sorted indices of nodes whose bounds changed.
+  std::vector<int> refit();
+
+  const std::vector<BVHNode>& get_nodes() const;
+  const std::vector<int>& get_indices() const;
+  const Stats& get_stats() const;
+
+  // SAH cost and shape of the current nodes
+  Stats compute_stats() const;
+
+private:
+  void build(const std::vector<BVHPrimitive>& primitives, Builder builder,
+             const PrimitiveStore* store);
+  void compute_topology();
+
+  std::vector<BVHNode> nodes;
+  std::vector<int> indices;
+  Stats stats = {};
+  float max_duplication = DEFAULT_MAX_DUPLICATION;
+  int leaf_block_size = 1;
+
+  // Kept for refitting
+  std::vector<Bounds> primitive_bounds;
+  std::vector<int> parents;
+  // Leaves listing each primitive i are primitive_leaves[leaf_offsets[i]..leaf_offsets[i + 1]]
+  std::vector<int> leaf_offsets;
+  std::vector<int> primitive_leaves;
+  std::vector<int> dirty_primitives;
+};
+
+#endif // BVH_H
@@ -0,0 +1,49 @@
+#include "bvh_builder.h"
+#include "model/bvh/bvh.h"
+
+#include <utility>
+
+void BVHBuilder::set_leaf_block_size(int size)
+{
+  leaf_block_size = size;
+}
+
+int BVHBuilder::count_blocks(int num_primitives) const
+{
+  return (num_primitives + leaf_block_size - 1) / leaf_block_size;
+}
+
+void BVHBuilder::flatten(const std::vector<BVHBuildNode>& build_nodes, int root,
+                         std::vector<BVHNode>& nodes)
+{
+  nodes.clear();
+  nodes.reserve(build_nodes.size());
+
+  // Pairs of build node and the flattened parent whose second child offset it fills in
+  std::vector<std::pair<int, int>> stack = { { root, -1 } };
+
+  while (!stack.empty()) {
+    auto [build_index, parent_index] = stack.back();
+    stack.pop_back();
+
+    const BVHBuildNode& build_node = build_nodes[static_cast<size_t>(build_index)];
+    const int node_index = static_cast<int>(nodes.size());
+
+    if (parent_index >= 0) {
+      nodes[static_cast<size_t>(parent_index)].offset = node_index;
+    }
+
+    if (build_node.children[0] < 0) {
+      nodes.emplace_back(BVHNode {
+        build_node.bounds.min, build_node.begin, build_node.bounds.max, build_node.count
+      });
+      continue;
+    }
+
+    nodes.emplace_back(BVHNode { build_node.bounds.min, 0, build_node.bounds.max, 0 });
+
+    // The first child is popped next so that it directly follows its parent
+    stack.emplace_back(build_node.children[1], node_index);
+    stack.emplace_back(build_node.children[0], -1);
+  }
+}
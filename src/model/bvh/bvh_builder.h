@@ -0,0 +1,51 @@
+#ifndef BVH_BUILDER_H
+#define BVH_BUILDER_H
+
+#include "model/bvh/bounds.h"
+
+#include <vector>
+
+struct BVHNode;
+
+// Bounds and centroid of a primitive, queried once before building
+struct BVHPrimitive
+{
+  Bounds bounds;
+  vec3 center;
+};
+
+// Pointer-style node used by builders that cannot emit depth-first order directly
+struct BVHBuildNode
+{
+  Bounds bounds;
+  // Child node indices, or -1 for leaves
+  int children[2];
+  // Leaf range into the index list
+  int begin;
+  int count;
+};
+
+class BVHBuilder
+{
+public:
+  virtual ~BVHBuilder() = default;
+
+  // Fills nodes depth first and indices with the primitive order referenced by leaves
+  virtual void build(const std::vector<BVHPrimitive>& primitives,
+                     std::vector<BVHNode>& nodes, std::vector<int>& indices) = 0;
+
+  // Primitives a leaf intersects at once, the SAH charges every started block in full
+  void set_leaf_block_size(int size);
+
+protected:
+  // Intersection cost of num_primitives in a leaf, in blocks
+  int count_blocks(int num_primitives) const;
+
+  // Converts a tree of build nodes into the depth-first node layout
+  static void flatten(const std::vector<BVHBuildNode>& build_nodes, int root,
+                      std::vector<BVHNode>& nodes);
+
+  int leaf_block_size = 1;
+};
+
+#endif // BVH_BUILDER_H
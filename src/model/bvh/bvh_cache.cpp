@@ -0,0 +1,63 @@
+#include "bvh_cache.h"
+#include "util/exception.h"
+#include "util/logging.h"
+
+#include <filesystem>
+#include <iomanip>
+#include <sstream>
+
+uint64_t BVHCache::hash(const void* data, size_t size, uint64_t hash)
+{
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+std::string BVHCache::get_path(const std::string& directory, uint64_t hash)
+{
+  std::ostringstream name;
+  name << std::hex << std::setw(16) << std::setfill('0') << hash << ".bvh";
+  return (std::filesystem::path(directory) / name.str()).string();
+}
+
+bool BVHCache::load(const std::string& path, uint64_t hash, size_t num_sections)
+{
+  // A missing file is the usual miss, the others are worth a note
+  std::error_code error;
+  if (!std::filesystem::is_regular_file(path, error)) {
+    return false;
+  }
+
+  try {
+    file = std::make_unique<SectionedFile>(path, FORMAT, hash, num_sections);
+  } catch (const LoaderException& e) {
+    Logging::get_logger() << "Rebuilding BVH, " << e.what() << std::endl;
+    file.reset();
+    return false;
+  }
+
+  return true;
+}
+
+const BVHCache::Section& BVHCache::get_section(size_t index) const
+{
+  return file->get_section(index);
+}
+
+void BVHCache::save(const std::string& path, uint64_t hash, const std::vector<Section>& sections)
+{
+  const std::filesystem::path file_path(path);
+
+  std::error_code error;
+  if (file_path.has_parent_path()) {
+    std::filesystem::create_directories(file_path.parent_path(), error);
+  }
+
+  try {
+    SectionedFile::save(path, FORMAT, hash, sections);
+  } catch (const LoaderException& e) {
+    Logging::get_logger() << e.what() << std::endl;
+  }
+}
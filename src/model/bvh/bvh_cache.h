@@ -0,0 +1,45 @@
+#ifndef BVH_CACHE_H
+#define BVH_CACHE_H
+
+#include "util/sectioned_file.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Built BVH buffers saved to a file named after a hash of the scene, so unchanged scenes skip the
+// build on later launches. A loaded file stays memory mapped until the cache is destroyed, and
+// its sections are uploaded straight from the mapping.
+class BVHCache
+{
+public:
+  // Bumped whenever the layout of a cached buffer changes, so old files are rebuilt
+  static constexpr uint32_t VERSION = 6;
+
+  using Section = SectionedFile::Section;
+
+  // 64 bit FNV-1a, chained through hash so several buffers make one key
+  static uint64_t hash(const void* data, size_t size, uint64_t hash = 0xcbf29ce484222325ull);
+
+  static std::string get_path(const std::string& directory, uint64_t hash);
+
+  // Maps the file, returning false when it is missing, truncated, or was written for another
+  // version, hash or number of sections
+  bool load(const std::string& path, uint64_t hash, size_t num_sections);
+  const Section& get_section(size_t index) const;
+
+  // Writes to a temporary file first, so an interrupted save never leaves a partial cache.
+  // Failures are logged and otherwise ignored, the next launch just builds again.
+  static void save(const std::string& path, uint64_t hash, const std::vector<Section>& sections);
+
+private:
+  // The hash is the key of the file
+  static constexpr SectionedFile::Format FORMAT = {
+    "BVH cache", { 'R', 'T', 'B', 'V', 'H', 'C', 'A', 'C' }, VERSION,
+  };
+
+  std::unique_ptr<SectionedFile> file;
+};
+
+#endif // BVH_CACHE_H
@@ -0,0 +1,209 @@
+#include "lbvh_builder.h"
+#include "model/bvh/bvh.h"
+#include "util/morton.h"
+#include "util/radix_sort.h"
+
+#include <atomic>
+#include <mutex>
+
+namespace {
+  template <typename Key>
+  Key encode(const vec3& quantized);
+
+  template <>
+  uint32_t encode<uint32_t>(const vec3& quantized) {
+    return Morton::encode_30(static_cast<uint32_t>(quantized.x), static_cast<uint32_t>(quantized.y),
+                             static_cast<uint32_t>(quantized.z));
+  }
+
+  template <>
+  uint64_t encode<uint64_t>(const vec3& quantized) {
+    return Morton::encode_63(static_cast<uint64_t>(quantized.x), static_cast<uint64_t>(quantized.y),
+                             static_cast<uint64_t>(quantized.z));
+  }
+
+  template <typename Key>
+  constexpr int get_axis_bits() {
+    return sizeof (Key) == 4 ? 10 : 21;
+  }
+
+  inline int count_leading_zeros(uint32_t x) {
+    return x ? __builtin_clz(x) : 32;
+  }
+
+  inline int count_leading_zeros(uint64_t x) {
+    return x ? __builtin_clzll(x) : 64;
+  }
+
+  // Length of the common prefix of the codes at i and j, with equal codes distinguished by
+  // their index, or -1 when j is out of range
+  template <typename Key>
+  inline int get_common_prefix(const std::vector<Key>& codes, int i, int j) {
+    if (j < 0 || j >= static_cast<int>(codes.size())) {
+      return -1;
+    }
+
+    const Key a = codes[static_cast<size_t>(i)];
+    const Key b = codes[static_cast<size_t>(j)];
+
+    if (a == b) {
+      return static_cast<int>(sizeof (Key) * 8) +
+             count_leading_zeros(static_cast<uint32_t>(i ^ j));
+    }
+
+    return count_leading_zeros(static_cast<Key>(a ^ b));
+  }
+}
+
+LBVHBuilder::LBVHBuilder(CodeSize code_size, ThreadPool& pool)
+  : code_size(code_size), pool(pool)
+{
+}
+
+void LBVHBuilder::build(const std::vector<BVHPrimitive>& primitives,
+                        std::vector<BVHNode>& nodes, std::vector<int>& indices)
+{
+  switch (code_size) {
+    case CodeSize::Bits30:
+      build_with_codes<uint32_t>(primitives, nodes, indices);
+      break;
+    case CodeSize::Bits63:
+      build_with_codes<uint64_t>(primitives, nodes, indices);
+      break;
+  }
+}
+
+template <typename Key>
+void LBVHBuilder::build_with_codes(const std::vector<BVHPrimitive>& primitives,
+                                   std::vector<BVHNode>& nodes, std::vector<int>& indices)
+{
+  constexpr size_t GRAIN_SIZE = 1 << 14;
+  const int num_primitives = static_cast<int>(primitives.size());
+
+  Bounds centroid_bounds;
+  std::mutex mutex;
+  pool.parallel_for(0, primitives.size(), GRAIN_SIZE, [&](size_t begin, size_t end) {
+    Bounds chunk_bounds;
+    for (size_t i = begin; i < end; i++) {
+      chunk_bounds.grow(primitives[i].center);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    centroid_bounds.grow(chunk_bounds);
+  });
+
+  // Quantize centroids to the grid spanned by their bounds
+  const float grid_size = static_cast<float>((1 << get_axis_bits<Key>()) - 1);
+  const vec3 extent = centroid_bounds.get_extent();
+  vec3 scale;
+  for (int axis = 0; axis < 3; axis++) {
+    scale[axis] = extent[axis] > 0.0f ? grid_size / extent[axis] : 0.0f;
+  }
+
+  std::vector<Key> codes(primitives.size());
+  pool.parallel_for(0, primitives.size(), GRAIN_SIZE, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      vec3 quantized = clamp((primitives[i].center - centroid_bounds.min) * scale, 0.0f, grid_size);
+      codes[i] = encode<Key>(quantized);
+    }
+  });
+
+  radix_sort(codes, indices, pool);
+
+  // Internal nodes are [0, n - 1), leaves are [n - 1, 2n - 1), leaf i holding primitive i
+  const int num_internal = num_primitives - 1;
+  std::vector<BVHBuildNode> build_nodes(static_cast<size_t>(num_internal + num_primitives));
+  std::vector<int> parents(build_nodes.size(), -1);
+
+  pool.parallel_for(0, static_cast<size_t>(num_primitives), GRAIN_SIZE,
+                    [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      BVHBuildNode& leaf = build_nodes[static_cast<size_t>(num_internal) + i];
+      leaf.bounds = primitives[static_cast<size_t>(indices[i])].bounds;
+      leaf.children[0] = -1;
+      leaf.children[1] = -1;
+      leaf.begin = static_cast<int>(i);
+      leaf.count = 1;
+    }
+  });
+
+  pool.parallel_for(0, static_cast<size_t>(std::max(num_internal, 0)), GRAIN_SIZE,
+                    [&](size_t begin, size_t end) {
+    for (int i = static_cast<int>(begin); i < static_cast<int>(end); i++) {
+      // Direction of the range covered by this node
+      const int direction = get_common_prefix(codes, i, i + 1) >
+                            get_common_prefix(codes, i, i - 1) ? 1 : -1;
+
+      // Find the other end of the range by exponential then binary search
+      const int min_prefix = get_common_prefix(codes, i, i - direction);
+      int max_length = 2;
+      while (get_common_prefix(codes, i, i + max_length * direction) > min_prefix) {
+        max_length *= 2;
+      }
+
+      int length = 0;
+      for (int step = max_length / 2; step >= 1; step /= 2) {
+        if (get_common_prefix(codes, i, i + (length + step) * direction) > min_prefix) {
+          length += step;
+        }
+      }
+      const int j = i + length * direction;
+
+      // Find where the highest differing bit changes, by binary search
+      const int node_prefix = get_common_prefix(codes, i, j);
+      int split = 0;
+      int step = length;
+      do {
+        step = (step + 1) / 2;
+        if (get_common_prefix(codes, i, i + (split + step) * direction) > node_prefix) {
+          split += step;
+        }
+      } while (step > 1);
+      const int gamma = i + split * direction + std::min(direction, 0);
+
+      const int first = std::min(i, j);
+      const int last = std::max(i, j);
+      const int left = first == gamma ? num_internal + gamma : gamma;
+      const int right = last == gamma + 1 ? num_internal + gamma + 1 : gamma + 1;
+
+      BVHBuildNode& node = build_nodes[static_cast<size_t>(i)];
+      node.children[0] = left;
+      node.children[1] = right;
+      node.begin = first;
+      node.count = last - first + 1;
+      parents[static_cast<size_t>(left)] = i;
+      parents[static_cast<size_t>(right)] = i;
+    }
+  });
+
+  // Propagate bounds up from the leaves. The second child to arrive at a node computes it.
+  std::vector<std::atomic<int>> arrivals(static_cast<size_t>(std::max(num_internal, 0)));
+  pool.parallel_for(0, static_cast<size_t>(num_primitives), GRAIN_SIZE,
+                    [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      int node_index = parents[static_cast<size_t>(num_internal) + i];
+
+      while (node_index >= 0 && arrivals[static_cast<size_t>(node_index)].fetch_add(1) == 1) {
+        BVHBuildNode& node = build_nodes[static_cast<size_t>(node_index)];
+        node.bounds = build_nodes[static_cast<size_t>(node.children[0])].bounds;
+        node.bounds.grow(build_nodes[static_cast<size_t>(node.children[1])].bounds);
+        node_index = parents[static_cast<size_t>(node_index)];
+      }
+    }
+  });
+
+  // Primitives of a subtree are contiguous in Morton order, so small subtrees become leaves
+  pool.parallel_for(0, static_cast<size_t>(std::max(num_internal, 0)), GRAIN_SIZE,
+                    [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      BVHBuildNode& node = build_nodes[i];
+      if (node.count <= LEAF_SIZE) {
+        node.children[0] = -1;
+        node.children[1] = -1;
+      }
+    }
+  });
+
+  // With a single primitive the root is leaf 0
+  flatten(build_nodes, 0, nodes);
+}
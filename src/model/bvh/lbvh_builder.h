@@ -0,0 +1,37 @@
+#ifndef LBVH_BUILDER_H
+#define LBVH_BUILDER_H
+
+#include "model/bvh/bvh_builder.h"
+#include "util/thread_pool.h"
+
+// Linear BVH builder. Sorts primitives along a Morton curve of their centroids and emits the
+// hierarchy from the sorted codes in parallel (Karras 2012). Builds far faster than the SAH
+// builders at the cost of tree quality, so suits scenes rebuilt every frame.
+class LBVHBuilder : public BVHBuilder
+{
+public:
+  enum class CodeSize {
+    // 10 bits per axis
+    Bits30,
+    // 21 bits per axis, for scenes with dense clusters of primitives
+    Bits63,
+  };
+
+  // Subtrees with at most this many primitives are collapsed into a leaf
+  static constexpr int LEAF_SIZE = 4;
+
+  LBVHBuilder(CodeSize code_size = CodeSize::Bits30, ThreadPool& pool = ThreadPool::get_global());
+
+  void build(const std::vector<BVHPrimitive>& primitives,
+             std::vector<BVHNode>& nodes, std::vector<int>& indices) override;
+
+private:
+  template <typename Key>
+  void build_with_codes(const std::vector<BVHPrimitive>& primitives,
+                        std::vector<BVHNode>& nodes, std::vector<int>& indices);
+
+  CodeSize code_size;
+  ThreadPool& pool;
+};
+
+#endif // LBVH_BUILDER_H
@@ -0,0 +1,94 @@
+#include "primitive_block.h"
+
+#include <algorithm>
+
+void PrimitiveBlocks::pack(const std::vector<BVHNode>& nodes, size_t num_nodes,
+                           const std::vector<int>& indices,
+                           const std::vector<vec4>& intersectable_data,
+                           const std::vector<vec4>& vertex_data,
+                           const std::vector<ivec3>& triangle_data,
+                           int num_spheres, int num_aabbs,
+                           std::vector<PrimitiveBlock>& blocks, std::vector<int>& block_offsets)
+{
+  blocks.clear();
+  block_offsets.assign(indices.size() + 1, 0);
+
+  // Leaves cover consecutive ranges of the index list, so blocks appended in order of offset
+  // give every leaf start and end a block offset
+  std::vector<const BVHNode*> leaves;
+  for (size_t i = 0; i < num_nodes; i++) {
+    if (nodes[i].count > 0) {
+      leaves.emplace_back(&nodes[i]);
+    }
+  }
+  std::sort(leaves.begin(), leaves.end(), [](const BVHNode* a, const BVHNode* b) {
+    return a->offset < b->offset;
+  });
+
+  const auto get_type = [&](int index) {
+    if (index < num_spheres) {
+      return PrimitiveBlock::Type::Spheres;
+    }
+    // Scene and mesh triangles follow the spheres and boxes
+    if (index >= num_spheres + num_aabbs) {
+      return PrimitiveBlock::Type::Triangles;
+    }
+    return PrimitiveBlock::Type::Other;
+  };
+
+  const PrimitiveBlock::Type types[] = {
+    PrimitiveBlock::Type::Triangles, PrimitiveBlock::Type::Spheres, PrimitiveBlock::Type::Other
+  };
+
+  for (const BVHNode* leaf : leaves) {
+    block_offsets[static_cast<size_t>(leaf->offset)] = static_cast<int>(blocks.size());
+
+    // One run of blocks per type, keeping the leaf order within each
+    for (PrimitiveBlock::Type type : types) {
+      PrimitiveBlock* block = nullptr;
+
+      for (int i = leaf->offset; i < leaf->offset + leaf->count; i++) {
+        const int index = indices[static_cast<size_t>(i)];
+        if (get_type(index) != type) {
+          continue;
+        }
+
+        if (!block || block->count == PrimitiveBlock::SIZE) {
+          block = &blocks.emplace_back();
+          std::fill(&block->data[0][0], &block->data[0][0] + 12 * PrimitiveBlock::SIZE, 0.0f);
+          std::fill(block->indices, block->indices + PrimitiveBlock::SIZE, 0);
+          block->type = type;
+          block->count = 0;
+        }
+
+        const int lane = block->count++;
+        block->indices[lane] = index;
+
+        if (type == PrimitiveBlock::Type::Triangles) {
+          // Edges and normal are computed once here rather than on every test
+          const ivec3& triangle = triangle_data[static_cast<size_t>(index - num_spheres -
+                                                                    num_aabbs)];
+          const vec3 v0(vertex_data[static_cast<size_t>(triangle.x)]);
+          const vec3 e1 = vec3(vertex_data[static_cast<size_t>(triangle.y)]) - v0;
+          const vec3 e2 = vec3(vertex_data[static_cast<size_t>(triangle.z)]) - v0;
+          const vec3 n = glm::cross(e1, e2);
+          for (int axis = 0; axis < 3; axis++) {
+            block->data[axis][lane] = v0[axis];
+            block->data[3 + axis][lane] = e1[axis];
+            block->data[6 + axis][lane] = e2[axis];
+            block->data[9 + axis][lane] = n[axis];
+          }
+        } else if (type == PrimitiveBlock::Type::Spheres) {
+          // Spheres are three vec4s, laid out as in IntersectableManager::pack_intersectable
+          const vec4* data = &intersectable_data[static_cast<size_t>(index) * 3];
+          for (int row = 0; row < 4; row++) {
+            block->data[row][lane] = data[0][row];
+          }
+        }
+      }
+    }
+
+    block_offsets[static_cast<size_t>(leaf->offset + leaf->count)] =
+      static_cast<int>(blocks.size());
+  }
+}
@@ -0,0 +1,45 @@
+#ifndef PRIMITIVE_BLOCK_H
+#define PRIMITIVE_BLOCK_H
+
+#include "model/bvh/bvh.h"
+
+#include <vector>
+
+// Up to SIZE primitives of one type from a BVH leaf, stored by component so that the CPU tests a
+// ray against all of them at once. Unused lanes are zero.
+struct alignas(32) PrimitiveBlock
+{
+  static constexpr int SIZE = 8;
+
+  enum class Type : int {
+    // Rows 0-2 are the vertex, 3-5 the first edge, 6-8 the second edge and 9-11 the normal
+    Triangles,
+    // Rows 0-2 are the center and 3 the squared radius
+    Spheres,
+    // Primitives without a block kernel, intersected one at a time
+    Other,
+  };
+
+  float data[12][SIZE];
+  // Intersectable index of each lane
+  int indices[SIZE];
+  Type type;
+  int count;
+};
+
+class PrimitiveBlocks
+{
+public:
+  PrimitiveBlocks() = delete;
+
+  // Packs the leaves of the first num_nodes binary nodes into blocks, from the primitives
+  // packed by IntersectableManager. The leaf listing entries offset to offset + count of indices
+  // has blocks block_offsets[offset] to block_offsets[offset + count].
+  static void pack(const std::vector<BVHNode>& nodes, size_t num_nodes,
+                   const std::vector<int>& indices, const std::vector<vec4>& intersectable_data,
+                   const std::vector<vec4>& vertex_data, const std::vector<ivec3>& triangle_data,
+                   int num_spheres, int num_aabbs,
+                   std::vector<PrimitiveBlock>& blocks, std::vector<int>& block_offsets);
+};
+
+#endif // PRIMITIVE_BLOCK_H
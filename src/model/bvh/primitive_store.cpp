@@ -0,0 +1,131 @@
+#include "primitive_store.h"
+
+void PrimitiveStore::clear()
+{
+  resize(0);
+  triangles.clear();
+  vertices.clear();
+}
+
+void PrimitiveStore::reserve(size_t size)
+{
+  types.reserve(size);
+  for (int axis = 0; axis < 3; axis++) {
+    bounds_min[axis].reserve(size);
+    bounds_max[axis].reserve(size);
+    centers[axis].reserve(size);
+  }
+  triangle_indices.reserve(size);
+}
+
+void PrimitiveStore::add(const Sphere& sphere)
+{
+  const size_t index = size();
+  resize(index + 1);
+  set(index, Type::Sphere, get_bounds(sphere), sphere.center, -1);
+}
+
+void PrimitiveStore::add(const AABB& aabb)
+{
+  const size_t index = size();
+  resize(index + 1);
+  set(index, Type::AABB, get_bounds(aabb), vec3(aabb.center), -1);
+}
+
+void PrimitiveStore::add_triangle(const vec3& v1, const vec3& v2, const vec3& v3)
+{
+  const int first_vertex = static_cast<int>(vertices.size());
+  vertices.insert(vertices.end(), { v1, v2, v3 });
+  triangles.emplace_back(first_vertex, first_vertex + 1, first_vertex + 2);
+
+  const size_t index = size();
+  resize(index + 1);
+  set(index, Type::Triangle, get_bounds(v1, v2, v3), (v1 + v2 + v3) / 3.0f,
+      static_cast<int>(triangles.size()) - 1);
+}
+
+size_t PrimitiveStore::size() const
+{
+  return types.size();
+}
+
+PrimitiveStore::Type PrimitiveStore::get_type(size_t index) const
+{
+  return types[index];
+}
+
+Bounds PrimitiveStore::get_bounds(size_t index) const
+{
+  Bounds bounds;
+  for (int axis = 0; axis < 3; axis++) {
+    bounds.min[axis] = bounds_min[axis][index];
+    bounds.max[axis] = bounds_max[axis][index];
+  }
+  return bounds;
+}
+
+vec3 PrimitiveStore::get_center(size_t index) const
+{
+  return vec3(centers[0][index], centers[1][index], centers[2][index]);
+}
+
+void PrimitiveStore::get_triangle(size_t index, vec3 triangle_vertices[3]) const
+{
+  const ivec3& triangle = triangles[static_cast<size_t>(triangle_indices[index])];
+  for (int i = 0; i < 3; i++) {
+    triangle_vertices[i] = vertices[static_cast<size_t>(triangle[i])];
+  }
+}
+
+std::vector<BVHPrimitive> PrimitiveStore::get_primitives() const
+{
+  std::vector<BVHPrimitive> primitives(size());
+
+  ThreadPool::get_global().parallel_for(0, size(), GRAIN_SIZE, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      primitives[i].bounds = get_bounds(i);
+      primitives[i].center = get_center(i);
+    }
+  });
+
+  return primitives;
+}
+
+Bounds PrimitiveStore::get_bounds(const Sphere& sphere)
+{
+  return { sphere.center - sphere.radius, sphere.center + sphere.radius };
+}
+
+Bounds PrimitiveStore::get_bounds(const AABB& aabb)
+{
+  const vec3 half_lengths = vec3(aabb.lengths) / 2.0f;
+  return { vec3(aabb.center) - half_lengths, vec3(aabb.center) + half_lengths };
+}
+
+Bounds PrimitiveStore::get_bounds(const vec3& v1, const vec3& v2, const vec3& v3)
+{
+  return { min(v1, min(v2, v3)), max(v1, max(v2, v3)) };
+}
+
+void PrimitiveStore::resize(size_t size)
+{
+  types.resize(size);
+  for (int axis = 0; axis < 3; axis++) {
+    bounds_min[axis].resize(size);
+    bounds_max[axis].resize(size);
+    centers[axis].resize(size);
+  }
+  triangle_indices.resize(size);
+}
+
+void PrimitiveStore::set(size_t index, Type type, const Bounds& bounds, const vec3& center,
+                         int triangle)
+{
+  types[index] = type;
+  for (int axis = 0; axis < 3; axis++) {
+    bounds_min[axis][index] = bounds.min[axis];
+    bounds_max[axis][index] = bounds.max[axis];
+    centers[axis][index] = center[axis];
+  }
+  triangle_indices[index] = triangle;
+}
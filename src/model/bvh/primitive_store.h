@@ -0,0 +1,88 @@
+#ifndef PRIMITIVE_STORE_H
+#define PRIMITIVE_STORE_H
+
+#include "model/bvh/bvh_builder.h"
+#include "model/intersectable/aabb.h"
+#include "model/intersectable/sphere.h"
+#include "util/thread_pool.h"
+
+#include <vector>
+
+// Primitives as BVH builds see them: a type tag each, with bounds and centroids computed once on
+// insertion and stored by component. Filled straight from the scene types without virtual calls.
+// Triangles keep their vertices, indexed like the mesh they come from, for spatial splits.
+class PrimitiveStore
+{
+public:
+  using Type = Intersectable::Type;
+
+  void clear();
+  void reserve(size_t size);
+
+  void add(const Sphere& sphere);
+  void add(const AABB& aabb);
+  void add_triangle(const vec3& v1, const vec3& v2, const vec3& v3);
+  // Triangles as the first three indices into vertices of each element, e.g. of an ivec3 or an
+  // ivec4. Their bounds are computed in parallel.
+  template <typename T>
+  void add_triangles(const std::vector<vec3>& vertices, const std::vector<T>& triangles);
+
+  size_t size() const;
+  Type get_type(size_t index) const;
+  Bounds get_bounds(size_t index) const;
+  vec3 get_center(size_t index) const;
+  void get_triangle(size_t index, vec3 triangle_vertices[3]) const;
+  // Bounds and centroids of all primitives, interleaved as the builders read them
+  std::vector<BVHPrimitive> get_primitives() const;
+
+  static Bounds get_bounds(const Sphere& sphere);
+  static Bounds get_bounds(const AABB& aabb);
+  static Bounds get_bounds(const vec3& v1, const vec3& v2, const vec3& v3);
+
+private:
+  // Primitives per task when filling in parallel
+  static constexpr size_t GRAIN_SIZE = 1 << 14;
+
+  void resize(size_t size);
+  void set(size_t index, Type type, const Bounds& bounds, const vec3& center, int triangle);
+
+  std::vector<Type> types;
+  // By axis
+  std::vector<float> bounds_min[3];
+  std::vector<float> bounds_max[3];
+  std::vector<float> centers[3];
+  // Index into triangles of each triangle, -1 for other primitives
+  std::vector<int> triangle_indices;
+  std::vector<ivec3> triangles;
+  std::vector<vec3> vertices;
+};
+
+template <typename T>
+void PrimitiveStore::add_triangles(const std::vector<vec3>& triangle_vertices,
+                                   const std::vector<T>& new_triangles)
+{
+  const size_t first = size();
+  const size_t first_triangle = triangles.size();
+  const ivec3 vertex_offset(static_cast<int>(vertices.size()));
+
+  vertices.insert(vertices.end(), triangle_vertices.begin(), triangle_vertices.end());
+  triangles.resize(first_triangle + new_triangles.size());
+  resize(first + new_triangles.size());
+
+  ThreadPool::get_global().parallel_for(0, new_triangles.size(), GRAIN_SIZE,
+                                        [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      const ivec3 triangle = ivec3(new_triangles[i].x, new_triangles[i].y, new_triangles[i].z) +
+                             vertex_offset;
+      const vec3& v1 = vertices[static_cast<size_t>(triangle.x)];
+      const vec3& v2 = vertices[static_cast<size_t>(triangle.y)];
+      const vec3& v3 = vertices[static_cast<size_t>(triangle.z)];
+
+      triangles[first_triangle + i] = triangle;
+      set(first + i, Type::Triangle, get_bounds(v1, v2, v3), (v1 + v2 + v3) / 3.0f,
+          static_cast<int>(first_triangle + i));
+    }
+  });
+}
+
+#endif // PRIMITIVE_STORE_H
@@ -0,0 +1,110 @@
+#include "sah_builder.h"
+#include "model/bvh/bvh.h"
+
+#include <algorithm>
+
+void SAHBuilder::build(const std::vector<BVHPrimitive>& primitives,
+                       std::vector<BVHNode>& nodes, std::vector<int>& indices)
+{
+  this->primitives = &primitives;
+  this->nodes = &nodes;
+  this->indices = &indices;
+  right_areas.resize(primitives.size());
+
+  nodes.reserve(2 * primitives.size());
+  build_node(0, static_cast<int>(primitives.size()));
+}
+
+int SAHBuilder::build_node(int begin, int end)
+{
+  const std::vector<BVHPrimitive>& primitives = *this->primitives;
+  const auto first = indices->begin() + begin;
+  const auto last = indices->begin() + end;
+  const int num_primitives = end - begin;
+
+  Bounds bounds;
+  for (auto it = first; it != last; it++) {
+    bounds.grow(primitives[static_cast<size_t>(*it)].bounds);
+  }
+
+  if (num_primitives == 1) {
+    return create_leaf(bounds, begin, end);
+  }
+
+  // Sweep every axis with primitives sorted by centroid, evaluating the SAH at each split
+  float best_cost = std::numeric_limits<float>::infinity();
+  int best_axis = -1;
+  int best_split = 0;
+
+  for (int axis = 0; axis < 3; axis++) {
+    std::sort(first, last, [&primitives, axis](int a, int b) {
+      return primitives[static_cast<size_t>(a)].center[axis] <
+             primitives[static_cast<size_t>(b)].center[axis];
+    });
+
+    if (primitives[static_cast<size_t>(*first)].center[axis] ==
+        primitives[static_cast<size_t>(*(last - 1))].center[axis]) {
+      continue;
+    }
+
+    Bounds right;
+    for (int i = num_primitives - 1; i > 0; i--) {
+      right.grow(primitives[static_cast<size_t>(first[i])].bounds);
+      right_areas[static_cast<size_t>(i)] = right.get_surface_area();
+    }
+
+    Bounds left;
+    for (int i = 1; i < num_primitives; i++) {
+      left.grow(primitives[static_cast<size_t>(first[i - 1])].bounds);
+      float cost = left.get_surface_area() * count_blocks(i) +
+                   right_areas[static_cast<size_t>(i)] * count_blocks(num_primitives - i);
+
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_axis = axis;
+        best_split = i;
+      }
+    }
+  }
+
+  const float area = bounds.get_surface_area();
+  const float leaf_cost = BVH::INTERSECTION_COST * count_blocks(num_primitives);
+  const float split_cost = area > 0.0f
+    ? BVH::TRAVERSAL_COST + BVH::INTERSECTION_COST * best_cost / area
+    : BVH::TRAVERSAL_COST + leaf_cost;
+
+  if (num_primitives <= BVH::MAX_LEAF_SIZE && (best_axis == -1 || split_cost >= leaf_cost)) {
+    return create_leaf(bounds, begin, end);
+  }
+
+  int mid;
+  if (best_axis == -1) {
+    // All centroids coincide, so any split is as good as another
+    mid = begin + num_primitives / 2;
+  } else {
+    // The range is left sorted on the last axis
+    if (best_axis != 2) {
+      std::sort(first, last, [&primitives, best_axis](int a, int b) {
+        return primitives[static_cast<size_t>(a)].center[best_axis] <
+               primitives[static_cast<size_t>(b)].center[best_axis];
+      });
+    }
+    mid = begin + best_split;
+  }
+
+  const int node_index = static_cast<int>(nodes->size());
+  nodes->emplace_back(BVHNode { bounds.min, 0, bounds.max, 0 });
+
+  build_node(begin, mid);
+  const int right_index = build_node(mid, end);
+  (*nodes)[static_cast<size_t>(node_index)].offset = right_index;
+
+  return node_index;
+}
+
+int SAHBuilder::create_leaf(const Bounds& bounds, int begin, int end)
+{
+  const int node_index = static_cast<int>(nodes->size());
+  nodes->emplace_back(BVHNode { bounds.min, begin, bounds.max, end - begin });
+  return node_index;
+}
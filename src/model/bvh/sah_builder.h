@@ -0,0 +1,24 @@
+#ifndef SAH_BUILDER_H
+#define SAH_BUILDER_H
+
+#include "model/bvh/bvh_builder.h"
+
+// Single-threaded top down builder evaluating the SAH at every centroid split on every axis.
+// Gives the best object split trees, at O(n log^2 n) build time.
+class SAHBuilder : public BVHBuilder
+{
+public:
+  void build(const std::vector<BVHPrimitive>& primitives,
+             std::vector<BVHNode>& nodes, std::vector<int>& indices) override;
+
+private:
+  int build_node(int begin, int end);
+  int create_leaf(const Bounds& bounds, int begin, int end);
+
+  const std::vector<BVHPrimitive>* primitives = nullptr;
+  std::vector<BVHNode>* nodes = nullptr;
+  std::vector<int>* indices = nullptr;
+  std::vector<float> right_areas;
+};
+
+#endif // SAH_BUILDER_H
@@ -0,0 +1,373 @@
+#include "sbvh_builder.h"
+#include "model/bvh/bvh.h"
+#include "model/bvh/primitive_store.h"
+
+#include <algorithm>
+
+static vec3 get_center(const Bounds& bounds)
+{
+  return (bounds.min + bounds.max) * 0.5f;
+}
+
+static int get_bin(float value, float min, float scale, int num_bins)
+{
+  return std::clamp(static_cast<int>((value - min) * scale), 0, num_bins - 1);
+}
+
+SBVHBuilder::SBVHBuilder(const PrimitiveStore* store, float max_duplication)
+  : store(store), max_duplication(std::max(max_duplication, 0.0f))
+{
+}
+
+void SBVHBuilder::build(const std::vector<BVHPrimitive>& primitives,
+                        std::vector<BVHNode>& nodes, std::vector<int>& indices)
+{
+  this->primitives = &primitives;
+  this->nodes = &nodes;
+  this->indices = &indices;
+
+  std::vector<Reference> references(primitives.size());
+  Bounds bounds;
+  for (size_t i = 0; i < primitives.size(); i++) {
+    references[i] = { primitives[i].bounds, static_cast<int>(i) };
+    bounds.grow(primitives[i].bounds);
+  }
+
+  root_area = bounds.get_surface_area();
+  num_references = primitives.size();
+  max_references = num_references +
+    static_cast<size_t>(static_cast<float>(num_references) * max_duplication);
+
+  // Leaves fill the index list as they are created, duplicates included
+  indices.clear();
+  indices.reserve(max_references);
+  nodes.reserve(2 * max_references);
+
+  build_node(references, bounds, 0);
+}
+
+int SBVHBuilder::build_node(std::vector<Reference>& references, const Bounds& bounds, int depth)
+{
+  const int num_primitives = static_cast<int>(references.size());
+
+  if (num_primitives == 1) {
+    return create_leaf(references, bounds);
+  }
+
+  Bounds centroid_bounds;
+  for (const auto& reference : references) {
+    centroid_bounds.grow(get_center(reference.bounds));
+  }
+
+  Split split = find_object_split(references, centroid_bounds);
+  bool is_spatial = false;
+
+  // Only nodes whose object split children overlap can gain from a spatial split
+  if (depth < MAX_SPATIAL_DEPTH && num_references < max_references) {
+    const Bounds overlap { glm::max(split.left.min, split.right.min),
+                           glm::min(split.left.max, split.right.max) };
+
+    if (split.axis == -1 || overlap.get_surface_area() > MIN_OVERLAP * root_area) {
+      Split spatial_split = find_spatial_split(references, bounds);
+      if (spatial_split.cost < split.cost) {
+        split = spatial_split;
+        is_spatial = true;
+      }
+    }
+  }
+
+  const float area = bounds.get_surface_area();
+  const float leaf_cost = BVH::INTERSECTION_COST * count_blocks(num_primitives);
+  const float split_cost = area > 0.0f
+    ? BVH::TRAVERSAL_COST + BVH::INTERSECTION_COST * split.cost / area
+    : BVH::TRAVERSAL_COST + leaf_cost;
+
+  if (num_primitives <= BVH::MAX_LEAF_SIZE && (split.axis == -1 || split_cost >= leaf_cost)) {
+    return create_leaf(references, bounds);
+  }
+
+  std::vector<Reference> left;
+  std::vector<Reference> right;
+
+  if (is_spatial) {
+    partition_spatial(references, split, left, right);
+  } else {
+    partition_object(references, centroid_bounds, split, left, right);
+  }
+
+  // Without a usable split, or when every straddling reference moved to one side, any split is
+  // as good as another. No reference was duplicated in that case.
+  if (left.empty() || right.empty()) {
+    left.assign(references.begin(), references.begin() + num_primitives / 2);
+    right.assign(references.begin() + num_primitives / 2, references.end());
+  }
+
+  references.clear();
+  references.shrink_to_fit();
+
+  Bounds left_bounds;
+  for (const auto& reference : left) {
+    left_bounds.grow(reference.bounds);
+  }
+  Bounds right_bounds;
+  for (const auto& reference : right) {
+    right_bounds.grow(reference.bounds);
+  }
+
+  const int node_index = static_cast<int>(nodes->size());
+  nodes->emplace_back(BVHNode { bounds.min, 0, bounds.max, 0 });
+
+  build_node(left, left_bounds, depth + 1);
+  const int right_index = build_node(right, right_bounds, depth + 1);
+  (*nodes)[static_cast<size_t>(node_index)].offset = right_index;
+
+  return node_index;
+}
+
+int SBVHBuilder::create_leaf(const std::vector<Reference>& references, const Bounds& bounds)
+{
+  const int node_index = static_cast<int>(nodes->size());
+  const int begin = static_cast<int>(indices->size());
+
+  for (const auto& reference : references) {
+    indices->emplace_back(reference.index);
+  }
+
+  nodes->emplace_back(BVHNode {
+    bounds.min, begin, bounds.max, static_cast<int>(references.size())
+  });
+  return node_index;
+}
+
+SBVHBuilder::Split SBVHBuilder::find_object_split(const std::vector<Reference>& references,
+                                                  const Bounds& centroid_bounds) const
+{
+  const int num_primitives = static_cast<int>(references.size());
+  Split best;
+
+  for (int axis = 0; axis < 3; axis++) {
+    const float extent = centroid_bounds.max[axis] - centroid_bounds.min[axis];
+    if (extent <= 0.0f) {
+      continue;
+    }
+
+    const float scale = NUM_BINS / extent;
+    Bounds bins[NUM_BINS];
+    int counts[NUM_BINS] = {};
+
+    for (const auto& reference : references) {
+      const int bin = get_bin(get_center(reference.bounds)[axis], centroid_bounds.min[axis],
+                              scale, NUM_BINS);
+      bins[bin].grow(reference.bounds);
+      counts[bin]++;
+    }
+
+    Bounds right_bounds[NUM_BINS];
+    Bounds right;
+    for (int i = NUM_BINS - 1; i > 0; i--) {
+      right.grow(bins[i]);
+      right_bounds[i] = right;
+    }
+
+    Bounds left;
+    int left_count = 0;
+    for (int i = 1; i < NUM_BINS; i++) {
+      left.grow(bins[i - 1]);
+      left_count += counts[i - 1];
+      const int right_count = num_primitives - left_count;
+      if (left_count == 0 || right_count == 0) {
+        continue;
+      }
+
+      const float cost = left.get_surface_area() * count_blocks(left_count) +
+                         right_bounds[i].get_surface_area() * count_blocks(right_count);
+      if (cost < best.cost) {
+        best = { cost, axis, i, 0.0f, left, right_bounds[i] };
+      }
+    }
+  }
+
+  return best;
+}
+
+SBVHBuilder::Split SBVHBuilder::find_spatial_split(const std::vector<Reference>& references,
+                                                   const Bounds& bounds) const
+{
+  Split best;
+
+  for (int axis = 0; axis < 3; axis++) {
+    const float min = bounds.min[axis];
+    const float extent = bounds.max[axis] - min;
+    if (extent <= 0.0f) {
+      continue;
+    }
+
+    // The outer planes are open so rounding never clips the ends of the node
+    constexpr float INF = std::numeric_limits<float>::infinity();
+    const float width = extent / NUM_BINS;
+    const auto get_plane = [min, width](int i) {
+      return i == 0 ? -INF : i == NUM_BINS ? INF : min + width * static_cast<float>(i);
+    };
+
+    // Clipped bounds in each bin, and the number of references starting and ending in it
+    Bounds bins[NUM_BINS];
+    int entries[NUM_BINS] = {};
+    int exits[NUM_BINS] = {};
+
+    for (const auto& reference : references) {
+      const int first = get_bin(reference.bounds.min[axis], min, 1.0f / width, NUM_BINS);
+      const int last = std::max(get_bin(reference.bounds.max[axis], min, 1.0f / width, NUM_BINS),
+                                first);
+
+      for (int i = first; i <= last; i++) {
+        bins[i].grow(clip(reference, axis, get_plane(i), get_plane(i + 1)));
+      }
+      entries[first]++;
+      exits[last]++;
+    }
+
+    Bounds right_bounds[NUM_BINS];
+    int right_counts[NUM_BINS] = {};
+    Bounds right;
+    int right_count = 0;
+    for (int i = NUM_BINS - 1; i > 0; i--) {
+      right.grow(bins[i]);
+      right_count += exits[i];
+      right_bounds[i] = right;
+      right_counts[i] = right_count;
+    }
+
+    Bounds left;
+    int left_count = 0;
+    for (int i = 1; i < NUM_BINS; i++) {
+      left.grow(bins[i - 1]);
+      left_count += entries[i - 1];
+      if (left_count == 0 || right_counts[i] == 0) {
+        continue;
+      }
+
+      const float cost = left.get_surface_area() * count_blocks(left_count) +
+                         right_bounds[i].get_surface_area() * count_blocks(right_counts[i]);
+      if (cost < best.cost) {
+        best = { cost, axis, i, get_plane(i), left, right_bounds[i] };
+      }
+    }
+  }
+
+  return best;
+}
+
+void SBVHBuilder::partition_object(const std::vector<Reference>& references,
+                                   const Bounds& centroid_bounds, const Split& split,
+                                   std::vector<Reference>& left,
+                                   std::vector<Reference>& right) const
+{
+  if (split.axis == -1) {
+    return;
+  }
+
+  const int axis = split.axis;
+  const float scale = NUM_BINS / (centroid_bounds.max[axis] - centroid_bounds.min[axis]);
+
+  for (const auto& reference : references) {
+    const int bin = get_bin(get_center(reference.bounds)[axis], centroid_bounds.min[axis],
+                            scale, NUM_BINS);
+    (bin < split.bin ? left : right).emplace_back(reference);
+  }
+}
+
+void SBVHBuilder::partition_spatial(const std::vector<Reference>& references,
+                                    const Split& split, std::vector<Reference>& left,
+                                    std::vector<Reference>& right)
+{
+  constexpr float INF = std::numeric_limits<float>::infinity();
+  const int axis = split.axis;
+  const float position = split.position;
+
+  std::vector<const Reference*> straddling;
+
+  for (const auto& reference : references) {
+    if (reference.bounds.max[axis] <= position) {
+      left.emplace_back(reference);
+    } else if (reference.bounds.min[axis] >= position) {
+      right.emplace_back(reference);
+    } else {
+      straddling.emplace_back(&reference);
+    }
+  }
+
+  // Children bounds and counts as if every straddling reference were split
+  Bounds left_bounds = split.left;
+  Bounds right_bounds = split.right;
+  int left_count = static_cast<int>(left.size() + straddling.size());
+  int right_count = static_cast<int>(right.size() + straddling.size());
+
+  for (const Reference* reference : straddling) {
+    // Moving a reference wholly into one child can be cheaper than splitting it, and is the
+    // only option once the duplication budget is spent
+    Bounds left_grown = left_bounds;
+    left_grown.grow(reference->bounds);
+    Bounds right_grown = right_bounds;
+    right_grown.grow(reference->bounds);
+
+    const float split_cost = left_bounds.get_surface_area() * count_blocks(left_count) +
+                             right_bounds.get_surface_area() * count_blocks(right_count);
+    const float left_cost = left_grown.get_surface_area() * count_blocks(left_count) +
+                            right_bounds.get_surface_area() * count_blocks(right_count - 1);
+    const float right_cost = left_bounds.get_surface_area() * count_blocks(left_count - 1) +
+                             right_grown.get_surface_area() * count_blocks(right_count);
+    const bool can_split = num_references < max_references;
+
+    if (left_cost <= right_cost && (left_cost < split_cost || !can_split)) {
+      left.emplace_back(*reference);
+      left_bounds = left_grown;
+      right_count--;
+    } else if (right_cost < split_cost || !can_split) {
+      right.emplace_back(*reference);
+      right_bounds = right_grown;
+      left_count--;
+    } else {
+      left.push_back({ clip(*reference, axis, -INF, position), reference->index });
+      right.push_back({ clip(*reference, axis, position, INF), reference->index });
+      num_references++;
+    }
+  }
+}
+
+Bounds SBVHBuilder::clip(const Reference& reference, int axis, float min, float max) const
+{
+  Bounds slab = reference.bounds;
+  slab.min[axis] = std::max(slab.min[axis], min);
+  slab.max[axis] = std::min(slab.max[axis], max);
+
+  const size_t index = static_cast<size_t>(reference.index);
+  if (!store || store->get_type(index) != PrimitiveStore::Type::Triangle) {
+    return slab;
+  }
+
+  // Vertices inside the slab and the points where edges cross its planes
+  vec3 vertices[3];
+  store->get_triangle(index, vertices);
+  Bounds clipped;
+
+  for (int i = 0; i < 3; i++) {
+    const vec3& v1 = vertices[i];
+    const vec3& v2 = vertices[(i + 1) % 3];
+
+    if (v1[axis] >= min && v1[axis] <= max) {
+      clipped.grow(v1);
+    }
+
+    for (float plane : { min, max }) {
+      if ((v1[axis] < plane && v2[axis] > plane) || (v1[axis] > plane && v2[axis] < plane)) {
+        vec3 point = v1 + (v2 - v1) * ((plane - v1[axis]) / (v2[axis] - v1[axis]));
+        point[axis] = plane;
+        clipped.grow(point);
+      }
+    }
+  }
+
+  // Earlier clips already narrowed the reference, and rounding must not empty it
+  Bounds result { glm::max(clipped.min, slab.min), glm::min(clipped.max, slab.max) };
+  return result.is_empty() ? slab : result;
+}
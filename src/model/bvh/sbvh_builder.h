@@ -0,0 +1,71 @@
+#ifndef SBVH_BUILDER_H
+#define SBVH_BUILDER_H
+
+#include "model/bvh/bvh_builder.h"
+
+#include <limits>
+
+class PrimitiveStore;
+
+// Single-threaded top down builder that considers spatial splits next to binned object splits.
+// A spatial split cuts the node at a plane and clips the primitives straddling it, referencing
+// them from both children, which keeps large primitives from inflating every node above them.
+// Leaves may list a primitive more than once across the tree.
+class SBVHBuilder : public BVHBuilder
+{
+public:
+  static constexpr int NUM_BINS = 32;
+  // Spatial splits are only tried where the object split children overlap by at least this
+  // fraction of the root surface area
+  static constexpr float MIN_OVERLAP = 1e-5f;
+  // Spatial splits deeper than this are not tried, bounding the recursion on degenerate input
+  static constexpr int MAX_SPATIAL_DEPTH = 48;
+
+  // Triangles in the store are clipped exactly, any other primitive or a missing store clips
+  // primitive bounds. max_duplication is the number of extra references allowed, as a fraction
+  // of the primitives.
+  SBVHBuilder(const PrimitiveStore* store, float max_duplication);
+
+  void build(const std::vector<BVHPrimitive>& primitives,
+             std::vector<BVHNode>& nodes, std::vector<int>& indices) override;
+
+private:
+  struct Reference {
+    Bounds bounds;
+    int index;
+  };
+
+  struct Split {
+    float cost = std::numeric_limits<float>::infinity();
+    int axis = -1;
+    // Object split: first bin of the right child. Spatial split: plane position
+    int bin = 0;
+    float position = 0.0f;
+    Bounds left;
+    Bounds right;
+  };
+
+  int build_node(std::vector<Reference>& references, const Bounds& bounds, int depth);
+  int create_leaf(const std::vector<Reference>& references, const Bounds& bounds);
+  Split find_object_split(const std::vector<Reference>& references,
+                          const Bounds& centroid_bounds) const;
+  Split find_spatial_split(const std::vector<Reference>& references, const Bounds& bounds) const;
+  void partition_object(const std::vector<Reference>& references, const Bounds& centroid_bounds,
+                        const Split& split, std::vector<Reference>& left,
+                        std::vector<Reference>& right) const;
+  void partition_spatial(const std::vector<Reference>& references, const Split& split,
+                         std::vector<Reference>& left, std::vector<Reference>& right);
+  // Bounds of the part of a reference between two planes on an axis
+  Bounds clip(const Reference& reference, int axis, float min, float max) const;
+
+  const PrimitiveStore* store;
+  const float max_duplication;
+  const std::vector<BVHPrimitive>* primitives = nullptr;
+  std::vector<BVHNode>* nodes = nullptr;
+  std::vector<int>* indices = nullptr;
+  float root_area = 0.0f;
+  size_t num_references = 0;
+  size_t max_references = 0;
+};
+
+#endif // SBVH_BUILDER_H
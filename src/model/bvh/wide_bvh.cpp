@@ -0,0 +1,276 @@
+#include "wide_bvh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace {
+  // Depth of the wide BVH starting at root, following the slots is_interior accepts
+  template <int WIDTH, typename Node, typename IsInterior>
+  int get_depth(const std::vector<Node>& nodes, int root, IsInterior&& is_interior)
+  {
+    if (root < 0) {
+      return 0;
+    }
+
+    // Pairs of node index and depth
+    std::vector<std::pair<int, int>> stack = { { root, 1 } };
+    int max_depth = 0;
+
+    while (!stack.empty()) {
+      auto [node_index, depth] = stack.back();
+      stack.pop_back();
+      max_depth = std::max(max_depth, depth);
+
+      const Node& node = nodes[static_cast<size_t>(node_index)];
+      for (int i = 0; i < WIDTH; i++) {
+        if (is_interior(node, i)) {
+          stack.emplace_back(node.offsets[i], depth + 1);
+        }
+      }
+    }
+
+    return max_depth;
+  }
+}
+
+template <int WIDTH>
+int WideBVH::collapse(const std::vector<BVHNode>& nodes, int root,
+                      std::vector<WideBVHNode<WIDTH>>& wide_nodes, std::vector<int>& sources)
+{
+  if (root < 0) {
+    return -1;
+  }
+
+  const int wide_root = static_cast<int>(wide_nodes.size());
+  wide_nodes.emplace_back();
+  sources.resize(wide_nodes.size() * WIDTH, -1);
+
+  // Pairs of binary node and the wide node that takes its children
+  std::vector<std::pair<int, int>> stack = { { root, wide_root } };
+
+  while (!stack.empty()) {
+    auto [node_index, wide_index] = stack.back();
+    stack.pop_back();
+
+    const BVHNode& node = nodes[static_cast<size_t>(node_index)];
+    int children[WIDTH];
+    int num_children = 0;
+
+    if (node.count > 0) {
+      // Only a leaf root gets here, it becomes the single child of the root
+      children[num_children++] = node_index;
+    } else {
+      children[num_children++] = node_index + 1;
+      children[num_children++] = node.offset;
+
+      // Pull up the grandchildren of the largest interior child until the node is full
+      while (num_children < WIDTH) {
+        int largest = -1;
+        float largest_area = -1.0f;
+
+        for (int i = 0; i < num_children; i++) {
+          const BVHNode& child = nodes[static_cast<size_t>(children[i])];
+          if (child.count > 0) {
+            continue;
+          }
+
+          const float area = Bounds { child.min, child.max }.get_surface_area();
+          if (area > largest_area) {
+            largest = i;
+            largest_area = area;
+          }
+        }
+
+        if (largest < 0) {
+          break;
+        }
+
+        const int opened = children[largest];
+        children[largest] = opened + 1;
+        children[num_children++] = nodes[static_cast<size_t>(opened)].offset;
+      }
+    }
+
+    WideBVHNode<WIDTH> wide_node;
+    int* node_sources = &sources[static_cast<size_t>(wide_index) * WIDTH];
+
+    for (int i = 0; i < WIDTH; i++) {
+      if (i >= num_children) {
+        node_sources[i] = -1;
+        wide_node.offsets[i] = 0;
+        wide_node.counts[i] = 0;
+        continue;
+      }
+
+      const BVHNode& child = nodes[static_cast<size_t>(children[i])];
+      node_sources[i] = children[i];
+      wide_node.counts[i] = child.count;
+
+      if (child.count > 0) {
+        wide_node.offsets[i] = child.offset;
+      } else {
+        wide_node.offsets[i] = static_cast<int>(wide_nodes.size());
+        wide_nodes.emplace_back();
+        stack.emplace_back(children[i], wide_node.offsets[i]);
+      }
+    }
+
+    // Pushing children may have grown sources, so it is indexed again
+    sources.resize(wide_nodes.size() * WIDTH, -1);
+    set_bounds(nodes, &sources[static_cast<size_t>(wide_index) * WIDTH], wide_node);
+    wide_nodes[static_cast<size_t>(wide_index)] = wide_node;
+  }
+
+  return wide_root;
+}
+
+template <int WIDTH>
+void WideBVH::refit(const std::vector<BVHNode>& nodes, const std::vector<int>& sources,
+                    int index, WideBVHNode<WIDTH>& wide_node)
+{
+  set_bounds(nodes, &sources[static_cast<size_t>(index) * WIDTH], wide_node);
+}
+
+void WideBVH::refit(const std::vector<BVHNode>& nodes, const std::vector<int>& sources,
+                    int index, QuantizedBVHNode& quantized_node)
+{
+  // The exact bounds are gone, so they are taken from the binary nodes and quantized again
+  WideBVHNode<4> wide_node;
+  for (int i = 0; i < 4; i++) {
+    wide_node.offsets[i] = quantized_node.offsets[i];
+    wide_node.counts[i] = quantized_node.counts[i];
+  }
+  set_bounds(nodes, &sources[static_cast<size_t>(index) * 4], wide_node);
+  quantized_node = quantize(wide_node);
+}
+
+template <int WIDTH>
+void WideBVH::set_bounds(const std::vector<BVHNode>& nodes, const int* sources,
+                         WideBVHNode<WIDTH>& wide_node)
+{
+  for (int i = 0; i < WIDTH; i++) {
+    if (sources[i] < 0) {
+      // An empty slot is a point at infinity, which fails the slab test for every ray
+      constexpr float INF = std::numeric_limits<float>::infinity();
+      wide_node.min_x[i] = wide_node.min_y[i] = wide_node.min_z[i] = INF;
+      wide_node.max_x[i] = wide_node.max_y[i] = wide_node.max_z[i] = INF;
+      continue;
+    }
+
+    const BVHNode& child = nodes[static_cast<size_t>(sources[i])];
+    wide_node.min_x[i] = child.min.x;
+    wide_node.min_y[i] = child.min.y;
+    wide_node.min_z[i] = child.min.z;
+    wide_node.max_x[i] = child.max.x;
+    wide_node.max_y[i] = child.max.y;
+    wide_node.max_z[i] = child.max.z;
+  }
+}
+
+void WideBVH::quantize(const std::vector<WideBVHNode<4>>& wide_nodes,
+                       std::vector<QuantizedBVHNode>& quantized_nodes)
+{
+  quantized_nodes.clear();
+  quantized_nodes.reserve(wide_nodes.size());
+
+  for (const auto& wide_node : wide_nodes) {
+    quantized_nodes.emplace_back(quantize(wide_node));
+  }
+}
+
+QuantizedBVHNode WideBVH::quantize(const WideBVHNode<4>& wide_node)
+{
+  const float* child_min[3] = { wide_node.min_x, wide_node.min_y, wide_node.min_z };
+  const float* child_max[3] = { wide_node.max_x, wide_node.max_y, wide_node.max_z };
+
+  QuantizedBVHNode node = {};
+  unsigned char* quantized_min[3] = { node.min_x, node.min_y, node.min_z };
+  unsigned char* quantized_max[3] = { node.max_x, node.max_y, node.max_z };
+
+  // Empty slots are the points at infinity left by collapse
+  for (int i = 0; i < 4; i++) {
+    if (!std::isinf(wide_node.min_x[i])) {
+      node.child_mask |= 1u << i;
+    }
+  }
+
+  for (int axis = 0; axis < 3; axis++) {
+    float lower = std::numeric_limits<float>::infinity();
+    float upper = -std::numeric_limits<float>::infinity();
+    for (int i = 0; i < 4; i++) {
+      if (node.child_mask & (1u << i)) {
+        lower = std::min(lower, child_min[axis][i]);
+        upper = std::max(upper, child_max[axis][i]);
+      }
+    }
+
+    // Smallest power of two step whose 255 steps cover the node, in the normal float range
+    int exponent;
+    std::frexp((upper - lower) / 255.0f, &exponent);
+    while (exponent < 127 && lower + 255.0f * std::ldexp(1.0f, exponent) < upper) {
+      exponent++;
+    }
+    exponent = std::clamp(exponent, -126, 127);
+
+    const float step = std::ldexp(1.0f, exponent);
+    node.origin[axis] = lower;
+    node.exponents |= static_cast<unsigned int>(exponent + 127) << (8 * axis);
+
+    for (int i = 0; i < 4; i++) {
+      if (!(node.child_mask & (1u << i))) {
+        continue;
+      }
+
+      // Round outwards, then correct for rounding in the addition to the origin
+      float q_min = std::clamp(std::floor((child_min[axis][i] - lower) / step), 0.0f, 255.0f);
+      float q_max = std::clamp(std::ceil((child_max[axis][i] - lower) / step), 0.0f, 255.0f);
+      while (q_min > 0.0f && lower + q_min * step > child_min[axis][i]) {
+        q_min--;
+      }
+      while (q_max < 255.0f && lower + q_max * step < child_max[axis][i]) {
+        q_max++;
+      }
+
+      quantized_min[axis][i] = static_cast<unsigned char>(q_min);
+      quantized_max[axis][i] = static_cast<unsigned char>(q_max);
+    }
+  }
+
+  for (int i = 0; i < 4; i++) {
+    node.counts[i] = static_cast<unsigned char>(wide_node.counts[i]);
+    node.offsets[i] = wide_node.offsets[i];
+  }
+
+  return node;
+}
+
+template <int WIDTH>
+int WideBVH::get_max_depth(const std::vector<WideBVHNode<WIDTH>>& wide_nodes, int root)
+{
+  // Empty slots are the points at infinity left by collapse
+  return get_depth<WIDTH>(wide_nodes, root, [](const WideBVHNode<WIDTH>& node, int slot) {
+    return node.counts[slot] == 0 && !std::isinf(node.min_x[slot]);
+  });
+}
+
+int WideBVH::get_max_depth(const std::vector<QuantizedBVHNode>& quantized_nodes, int root)
+{
+  return get_depth<4>(quantized_nodes, root, [](const QuantizedBVHNode& node, int slot) {
+    return node.counts[slot] == 0 && (node.child_mask & (1u << slot));
+  });
+}
+
+template int WideBVH::collapse<4>(const std::vector<BVHNode>& nodes, int root,
+                                  std::vector<WideBVHNode<4>>& wide_nodes,
+                                  std::vector<int>& sources);
+template int WideBVH::collapse<8>(const std::vector<BVHNode>& nodes, int root,
+                                  std::vector<WideBVHNode<8>>& wide_nodes,
+                                  std::vector<int>& sources);
+template void WideBVH::refit<4>(const std::vector<BVHNode>& nodes, const std::vector<int>& sources,
+                                int index, WideBVHNode<4>& wide_node);
+template void WideBVH::refit<8>(const std::vector<BVHNode>& nodes, const std::vector<int>& sources,
+                                int index, WideBVHNode<8>& wide_node);
+template int WideBVH::get_max_depth<4>(const std::vector<WideBVHNode<4>>& wide_nodes, int root);
@@ -0,0 +1,99 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include "model/bvh/bvh.h"
+
+#include <vector>
+
+// Node with up to WIDTH children whose bounds are stored per axis, so that one ray is tested
+// against every child in a single SIMD slab test. Matches struct WideNode in raytrace.comp for
+// a WIDTH of 4.
+template <int WIDTH>
+struct WideBVHNode
+{
+  float min_x[WIDTH];
+  float min_y[WIDTH];
+  float min_z[WIDTH];
+  float max_x[WIDTH];
+  float max_y[WIDTH];
+  float max_z[WIDTH];
+  // Interior child: index of its wide node. Leaf child: first entry in the primitive index list
+  int offsets[WIDTH];
+  // Number of primitives in a leaf child, 0 for interior children
+  int counts[WIDTH];
+};
+
+static_assert(sizeof (WideBVHNode<4>) == 8 * sizeof (vec4),
+              "WideBVHNode<4> must match the std430 layout");
+
+// 4 wide node whose child bounds are bytes counting steps above the origin, one power of two
+// step per axis. The dequantized bounds origin + q * step always contain the exact bounds, and
+// are computed exactly since the product is a power of two times a byte. Matches struct
+// QuantizedNode in raytrace.comp.
+struct QuantizedBVHNode
+{
+  vec3 origin;
+  // Biased exponents of the x, y and z steps in the low three bytes, as in a float
+  unsigned int exponents;
+  unsigned char min_x[4];
+  unsigned char min_y[4];
+  unsigned char min_z[4];
+  unsigned char max_x[4];
+  unsigned char max_y[4];
+  unsigned char max_z[4];
+  // Number of primitives in a leaf child, 0 for interior children
+  unsigned char counts[4];
+  // Bit i is set when slot i holds a child
+  unsigned int child_mask;
+  // Interior child: index of its quantized node. Leaf child: first entry in the primitive
+  // index list
+  int offsets[4];
+
+  float get_step(int axis) const {
+    return glm::intBitsToFloat(static_cast<int>((exponents >> (8 * axis)) & 0xff) << 23);
+  }
+};
+
+static_assert(sizeof (QuantizedBVHNode) == 4 * sizeof (vec4),
+              "QuantizedBVHNode must match the std430 layout");
+static_assert(BVH::MAX_LEAF_SIZE <= 0xff, "Leaf counts must fit in QuantizedBVHNode::counts");
+
+class WideBVH
+{
+public:
+  WideBVH() = delete;
+
+  // Collapses the binary BVH starting at root into wide nodes appended to wide_nodes, and
+  // returns the index of the new root, or -1 for an empty BVH. Leaves keep their ranges in
+  // the binary BVH's primitive index list. sources gets the binary node of each slot, -1 for
+  // empty ones, WIDTH per wide node.
+  template <int WIDTH>
+  static int collapse(const std::vector<BVHNode>& nodes, int root,
+                      std::vector<WideBVHNode<WIDTH>>& wide_nodes, std::vector<int>& sources);
+
+  // Takes the child bounds of the wide node at index from the refit binary nodes its slots
+  // came from. Which children a node collapses depends on their areas, so collapsing a refit
+  // BVH again would give another tree and move the roots.
+  template <int WIDTH>
+  static void refit(const std::vector<BVHNode>& nodes, const std::vector<int>& sources,
+                    int index, WideBVHNode<WIDTH>& wide_node);
+  static void refit(const std::vector<BVHNode>& nodes, const std::vector<int>& sources,
+                    int index, QuantizedBVHNode& quantized_node);
+
+  // Quantizes the bounds of each wide node, so quantized_nodes has the same indices and roots
+  static void quantize(const std::vector<WideBVHNode<4>>& wide_nodes,
+                       std::vector<QuantizedBVHNode>& quantized_nodes);
+
+  // Wide nodes on the longest path from root to a leaf child, 0 for an empty BVH
+  template <int WIDTH>
+  static int get_max_depth(const std::vector<WideBVHNode<WIDTH>>& wide_nodes, int root);
+  static int get_max_depth(const std::vector<QuantizedBVHNode>& quantized_nodes, int root);
+
+private:
+  static QuantizedBVHNode quantize(const WideBVHNode<4>& wide_node);
+  template <int WIDTH>
+  static void set_bounds(const std::vector<BVHNode>& nodes, const int* sources,
+                         WideBVHNode<WIDTH>& wide_node);
+};
+
+#endif // WIDE_BVH_H
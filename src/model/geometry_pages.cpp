@@ -0,0 +1,263 @@
+#include "geometry_pages.h"
+#include "model/bvh/primitive_store.h"
+#include "util/exception.h"
+#include "util/logging.h"
+#include "util/morton.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <numeric>
+#include <utility>
+
+namespace {
+  template <typename T>
+  void copy_records(const char* source, size_t count, std::vector<T>& records)
+  {
+    records.resize(count);
+    if (count > 0) {
+      std::memcpy(records.data(), source, count * sizeof (T));
+    }
+  }
+
+  template <typename T>
+  void write_records(SectionedFile::Writer& output, const std::vector<T>& records)
+  {
+    output.write(records.data(), records.size() * sizeof (T));
+  }
+}
+
+GeometryPages::Writer::Writer(const std::string& path, int page_triangles)
+  : path(path), output(path, FORMAT, 0, NUM_SECTIONS), page_triangles(std::max(page_triangles, 1))
+{
+}
+
+int GeometryPages::Writer::add_mesh(const TriangleMesh& mesh)
+{
+  const size_t num_triangles = mesh.get_num_triangles();
+
+  std::vector<vec3> centers(num_triangles);
+  Bounds center_bounds;
+  for (size_t i = 0; i < num_triangles; i++) {
+    const int* indices = &mesh.indices[3 * i];
+    centers[i] = (mesh.positions[static_cast<size_t>(indices[0])] +
+                  mesh.positions[static_cast<size_t>(indices[1])] +
+                  mesh.positions[static_cast<size_t>(indices[2])]) / 3.0f;
+    center_bounds.grow(centers[i]);
+  }
+
+  // Consecutive triangles along a Morton curve are close, so pages cover compact regions and
+  // rays reach few of them
+  constexpr float max_cell = static_cast<float>((1 << 21) - 1);
+  const vec3 extent = center_bounds.get_extent();
+  const vec3 scale = max_cell / glm::max(extent, vec3(1e-12f));
+
+  std::vector<uint64_t> codes(num_triangles);
+  for (size_t i = 0; i < num_triangles; i++) {
+    const vec3 cell = glm::min(glm::max((centers[i] - center_bounds.min) * scale, vec3(0.0f)),
+                               vec3(max_cell));
+    codes[i] = Morton::encode_63(static_cast<uint64_t>(cell.x), static_cast<uint64_t>(cell.y),
+                                 static_cast<uint64_t>(cell.z));
+  }
+
+  std::vector<size_t> order(num_triangles);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&codes](size_t a, size_t b) {
+    return codes[a] < codes[b];
+  });
+  centers = {};
+  codes = {};
+
+  const Mesh paged_mesh = {
+    static_cast<uint32_t>(pages.size()),
+    static_cast<uint32_t>((num_triangles + static_cast<size_t>(page_triangles) - 1) /
+                          static_cast<size_t>(page_triangles)),
+  };
+
+  // Page vertex of each mesh position, -1 outside the current page
+  std::vector<int> page_vertices(mesh.positions.size(), -1);
+  std::vector<vec3> vertices;
+  PageData data;
+  int max_depth = 0;
+
+  for (size_t first = 0; first < num_triangles; first += static_cast<size_t>(page_triangles)) {
+    const size_t last = std::min(first + static_cast<size_t>(page_triangles), num_triangles);
+
+    vertices.clear();
+    data.triangles.clear();
+    for (size_t i = first; i < last; i++) {
+      ivec3 triangle;
+      for (int corner = 0; corner < 3; corner++) {
+        const size_t position = static_cast<size_t>(mesh.indices[3 * order[i] + corner]);
+        if (page_vertices[position] < 0) {
+          page_vertices[position] = static_cast<int>(vertices.size());
+          vertices.emplace_back(mesh.positions[position]);
+        }
+        triangle[corner] = page_vertices[position];
+      }
+      data.triangles.emplace_back(triangle);
+    }
+
+    for (size_t i = first; i < last; i++) {
+      for (int corner = 0; corner < 3; corner++) {
+        page_vertices[static_cast<size_t>(mesh.indices[3 * order[i] + corner])] = -1;
+      }
+    }
+
+    // Built as IntersectableManager::finalize builds mesh BVHs for the GPU
+    PrimitiveStore store;
+    store.add_triangles(vertices, data.triangles);
+    BVH bvh;
+    bvh.build(store, BVH::Builder::BinnedSAH);
+    max_depth = std::max(max_depth, bvh.get_stats().max_depth);
+
+    data.nodes = bvh.get_nodes();
+    data.indices = bvh.get_indices();
+    data.vertices.clear();
+    data.vertices.reserve(vertices.size());
+    for (const vec3& vertex : vertices) {
+      data.vertices.emplace_back(vertex, 0.0f);
+    }
+
+    write_page(data);
+  }
+
+  meshes.emplace_back(paged_mesh);
+
+  Logging::get_logger() << "Paged mesh of " << num_triangles << " triangles into "
+                        << paged_mesh.num_pages << " pages" << std::endl;
+
+  // Pages are traversed as binary BVHs, which save one node per level below the root
+  if (max_depth - 1 > BVH::STACK_SIZE) {
+    Logging::get_logger() << "Page BVHs of depth " << max_depth << " need " << max_depth - 1
+                          << " traversal stack entries but rays have " << BVH::STACK_SIZE
+                          << ", hits behind the dropped nodes will be missed" << std::endl;
+  }
+
+  return static_cast<int>(meshes.size()) - 1;
+}
+
+void GeometryPages::Writer::write_page(const PageData& data)
+{
+  Page page = {};
+  page.bounds = { vec3(data.nodes.front().min), vec3(data.nodes.front().max) };
+  page.offset = output.align();
+  page.num_nodes = static_cast<uint32_t>(data.nodes.size());
+  page.num_triangles = static_cast<uint32_t>(data.triangles.size());
+  page.num_vertices = static_cast<uint32_t>(data.vertices.size());
+
+  write_records(output, data.nodes);
+  write_records(output, data.vertices);
+  write_records(output, data.triangles);
+  write_records(output, data.indices);
+
+  pages.emplace_back(page);
+}
+
+void GeometryPages::Writer::close()
+{
+  output.end_section();
+  write_records(output, pages);
+  output.end_section();
+  write_records(output, meshes);
+  output.end_section();
+  output.close();
+
+  Logging::get_logger() << "Wrote " << pages.size() << " pages of " << meshes.size()
+                        << " meshes to " << path << std::endl;
+}
+
+GeometryPages::GeometryPages(const std::string& path)
+  : file(path, FORMAT, 0, NUM_SECTIONS)
+{
+  const SectionedFile::Section& page_data = file.get_section(PAGE_DATA);
+  const SectionedFile::Section& page_table = file.get_section(PAGES);
+  const SectionedFile::Section& mesh_table = file.get_section(MESHES);
+
+  if (page_table.size % sizeof (Page) != 0 || mesh_table.size % sizeof (Mesh) != 0) {
+    throw LoaderException("Page file " + path + " has a malformed table");
+  }
+
+  copy_records(static_cast<const char*>(page_table.data), page_table.size / sizeof (Page), pages);
+  copy_records(static_cast<const char*>(mesh_table.data), mesh_table.size / sizeof (Mesh), meshes);
+
+  for (const Page& page : pages) {
+    if (page.num_nodes == 0 || page.offset > page_data.size ||
+        get_page_size(page) > page_data.size - page.offset) {
+      throw LoaderException("Page file " + path + " has a malformed page");
+    }
+
+    max_nodes = std::max(max_nodes, static_cast<size_t>(page.num_nodes));
+    max_triangles = std::max(max_triangles, static_cast<size_t>(page.num_triangles));
+    max_vertices = std::max(max_vertices, static_cast<size_t>(page.num_vertices));
+  }
+
+  for (const Mesh& mesh : meshes) {
+    if (mesh.first_page > pages.size() || mesh.num_pages > pages.size() - mesh.first_page) {
+      throw LoaderException("Page file " + path + " has a malformed mesh");
+    }
+  }
+
+  Logging::get_logger() << "Mapped page file " << path << ", " << pages.size() << " pages of "
+                        << meshes.size() << " meshes" << std::endl;
+}
+
+bool GeometryPages::is_page_file(const std::string& path)
+{
+  return std::filesystem::path(path).extension() == EXTENSION;
+}
+
+size_t GeometryPages::get_num_pages() const
+{
+  return pages.size();
+}
+
+const GeometryPages::Page& GeometryPages::get_page(size_t index) const
+{
+  return pages[index];
+}
+
+size_t GeometryPages::get_num_meshes() const
+{
+  return meshes.size();
+}
+
+const GeometryPages::Mesh& GeometryPages::get_mesh(size_t index) const
+{
+  return meshes[index];
+}
+
+size_t GeometryPages::get_max_nodes() const
+{
+  return max_nodes;
+}
+
+size_t GeometryPages::get_max_triangles() const
+{
+  return max_triangles;
+}
+
+size_t GeometryPages::get_max_vertices() const
+{
+  return max_vertices;
+}
+
+size_t GeometryPages::get_page_size(const Page& page)
+{
+  return page.num_nodes * sizeof (BVHNode) + page.num_vertices * sizeof (vec4) +
+         page.num_triangles * (sizeof (ivec3) + sizeof (int));
+}
+
+void GeometryPages::load_page(size_t index, PageData& data) const
+{
+  const Page& page = pages[index];
+  const char* bytes = static_cast<const char*>(file.get_section(PAGE_DATA).data) + page.offset;
+
+  copy_records(bytes, page.num_nodes, data.nodes);
+  bytes += page.num_nodes * sizeof (BVHNode);
+  copy_records(bytes, page.num_vertices, data.vertices);
+  bytes += page.num_vertices * sizeof (vec4);
+  copy_records(bytes, page.num_triangles, data.triangles);
+  bytes += page.num_triangles * sizeof (ivec3);
+  copy_records(bytes, page.num_triangles, data.indices);
+}
@@ -0,0 +1,119 @@
+#ifndef GEOMETRY_PAGES_H
+#define GEOMETRY_PAGES_H
+
+#include "model/bvh/bvh.h"
+#include "model/intersectable/triangle_mesh.h"
+#include "util/sectioned_file.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+using namespace glm;
+
+// Meshes cut into pages of nearby triangles, each with vertices and a BVH of its own, for scenes
+// whose meshes do not fit in memory. A loaded file stays memory mapped and only its page table is
+// read, so pages reach host memory only when GeometryStreamer loads them. Pages follow each other
+// in one section of a SectionedFile, with the page and mesh tables in the two after it.
+class GeometryPages
+{
+public:
+  // Bumped whenever the layout of a page changes, older files are rejected
+  static constexpr uint32_t VERSION = 2;
+  // Triangles per page unless the writer is given another count, a slot holding a page of
+  // this size takes about 6 MB on the GPU
+  static constexpr int DEFAULT_PAGE_TRIANGLES = 1 << 16;
+
+  struct Page {
+    // Object space bounds of the triangles of the page
+    Bounds bounds;
+    // Start of the page in the section of pages
+    uint64_t offset;
+    uint32_t num_nodes;
+    // Leaves list each triangle once, so this is also the number of indices
+    uint32_t num_triangles;
+    uint32_t num_vertices;
+    uint32_t padding;
+  };
+
+  struct Mesh {
+    uint32_t first_page;
+    uint32_t num_pages;
+  };
+
+  // A page as loaded: node offsets, leaf indices and triangle vertices count from 0 in the page
+  struct PageData {
+    std::vector<BVHNode> nodes;
+    std::vector<int> indices;
+    std::vector<ivec3> triangles;
+    std::vector<vec4> vertices;
+  };
+
+  // Pages meshes one at a time, so only the mesh being added is ever in memory
+  class Writer {
+  public:
+    // Throws LoaderException when the file cannot be created. The unfinished file is removed
+    // unless the writer was closed.
+    Writer(const std::string& path, int page_triangles = DEFAULT_PAGE_TRIANGLES);
+
+    // Sorts the triangles along a Morton curve and cuts them into pages. Returns the index of
+    // the mesh to instance it with.
+    int add_mesh(const TriangleMesh& mesh);
+    // Writes the page table. Throws LoaderException when the file could not be written.
+    void close();
+
+  private:
+    void write_page(const PageData& data);
+
+    std::string path;
+    SectionedFile::Writer output;
+    int page_triangles;
+    std::vector<Page> pages;
+    std::vector<Mesh> meshes;
+  };
+
+  // Maps the file, throwing LoaderException when it is missing, truncated or of another version
+  GeometryPages(const std::string& path);
+
+  // Whether a path names a page file rather than a scene or mesh
+  static bool is_page_file(const std::string& path);
+
+  size_t get_num_pages() const;
+  const Page& get_page(size_t index) const;
+  size_t get_num_meshes() const;
+  const Mesh& get_mesh(size_t index) const;
+  // Largest record counts of any page, which size the slots pages are streamed into
+  size_t get_max_nodes() const;
+  size_t get_max_triangles() const;
+  size_t get_max_vertices() const;
+  // Bytes a page takes in the file and on the GPU
+  static size_t get_page_size(const Page& page);
+
+  // Copies a page out of the mapping, which reads it from disk unless the OS has it cached.
+  // Safe to call from several threads.
+  void load_page(size_t index, PageData& data) const;
+
+private:
+  // Sections in file order
+  enum SectionIndex : size_t {
+    PAGE_DATA,
+    PAGES,
+    MESHES,
+    NUM_SECTIONS,
+  };
+
+  static constexpr SectionedFile::Format FORMAT = {
+    "page file", { 'R', 'T', 'P', 'A', 'G', 'E', 'S', '\0' }, VERSION,
+  };
+  static constexpr const char* EXTENSION = ".rtpages";
+
+  SectionedFile file;
+  std::vector<Page> pages;
+  std::vector<Mesh> meshes;
+  size_t max_nodes = 0;
+  size_t max_triangles = 0;
+  size_t max_vertices = 0;
+};
+
+#endif // GEOMETRY_PAGES_H
@@ -0,0 +1,316 @@
+#include "geometry_streamer.h"
+#include "util/logging.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+double GeometryStreamer::Stats::get_hit_rate() const
+{
+  return num_requests > 0 ? static_cast<double>(num_hits) / static_cast<double>(num_requests)
+                          : 1.0;
+}
+
+double GeometryStreamer::Stats::get_bandwidth() const
+{
+  return load_seconds > 0.0 ? static_cast<double>(bytes_streamed) / load_seconds : 0.0;
+}
+
+GeometryStreamer::GeometryStreamer(std::shared_ptr<const GeometryPages> pages, size_t num_slots)
+  : pages(std::move(pages)), num_slots(std::max(num_slots, size_t(1)))
+{
+  slot_nodes = this->pages->get_max_nodes();
+  slot_triangles = this->pages->get_max_triangles();
+  slot_vertices = this->pages->get_max_vertices();
+}
+
+GeometryStreamer::~GeometryStreamer()
+{
+  if (loader.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    jobs_ready.notify_all();
+    loader.join();
+  }
+
+  for (GLsync fence : fences) {
+    if (fence) {
+      glDeleteSync(fence);
+    }
+  }
+
+  // Deleting the buffer also unmaps it
+  if (requests) {
+    glDeleteBuffers(1, &requests);
+  }
+}
+
+const GeometryPages& GeometryStreamer::get_pages() const
+{
+  return *pages;
+}
+
+size_t GeometryStreamer::get_num_slots() const
+{
+  return num_slots;
+}
+
+size_t GeometryStreamer::get_slot_nodes() const
+{
+  return slot_nodes;
+}
+
+size_t GeometryStreamer::get_slot_triangles() const
+{
+  return slot_triangles;
+}
+
+size_t GeometryStreamer::get_slot_vertices() const
+{
+  return slot_vertices;
+}
+
+void GeometryStreamer::start(const Pool& pool, std::vector<std::vector<int>>&& page_instances)
+{
+  this->pool = pool;
+  this->page_instances = std::move(page_instances);
+
+  const size_t num_pages = pages->get_num_pages();
+  slot_pages.assign(num_slots, -1);
+  slot_frames.assign(num_slots, 0);
+  slot_loading.assign(num_slots, false);
+  page_slots.assign(num_pages, -1);
+
+  // One flag per page, binding 24 in raytrace.comp. Rays set the flags of the pages they reach
+  // and the CPU reads them back through a coherent mapping.
+  int alignment = 1;
+  glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  const size_t offset_alignment = static_cast<size_t>(std::max(alignment, 1));
+  const size_t size = std::max(num_pages, size_t(1)) * sizeof (uint32_t);
+  region_size = (size + offset_alignment - 1) / offset_alignment * offset_alignment;
+
+  constexpr GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT |
+                               GL_MAP_COHERENT_BIT;
+  const long total_size = static_cast<long>(region_size * NUM_REGIONS);
+
+  glGenBuffers(1, &requests);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, requests);
+  glBufferStorage(GL_SHADER_STORAGE_BUFFER, total_size, nullptr, flags);
+  request_mapping = static_cast<uint32_t*>(glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0,
+                                                            total_size, flags));
+  std::memset(request_mapping, 0, region_size * NUM_REGIONS);
+
+  region = 0;
+  glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 24, requests, 0, static_cast<long>(size));
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  loader = std::thread(&GeometryStreamer::load_pages, this);
+
+  Logging::get_logger() << "Streaming " << num_pages << " pages through " << num_slots
+                        << " slots of " << slot_triangles << " triangles" << std::endl;
+}
+
+void GeometryStreamer::begin_frame()
+{
+  if (!request_mapping) {
+    return;
+  }
+
+  std::vector<LoadedPage> uploads;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    uploads.swap(loaded_pages);
+  }
+  for (const LoadedPage& page : uploads) {
+    upload(page);
+  }
+
+  region = (region + 1) % NUM_REGIONS;
+  uint32_t* region_requests = request_mapping + region * region_size / sizeof (uint32_t);
+
+  // The region was last written NUM_REGIONS frames ago, which is usually done by now
+  if (fences[region]) {
+    while (glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) ==
+           GL_TIMEOUT_EXPIRED) {
+    }
+    glDeleteSync(fences[region]);
+    fences[region] = nullptr;
+
+    process_requests(region_requests);
+    std::memset(region_requests, 0, pages->get_num_pages() * sizeof (uint32_t));
+  }
+
+  glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 24, requests,
+                    static_cast<long>(region * region_size),
+                    static_cast<long>(std::max(pages->get_num_pages(), size_t(1)) *
+                                      sizeof (uint32_t)));
+}
+
+void GeometryStreamer::end_frame()
+{
+  if (!request_mapping) {
+    return;
+  }
+
+  // Shader writes reach a persistent mapping only after this barrier
+  glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+
+  if (fences[region]) {
+    glDeleteSync(fences[region]);
+  }
+  fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+const GeometryStreamer::Stats& GeometryStreamer::get_stats() const
+{
+  return stats;
+}
+
+void GeometryStreamer::process_requests(const uint32_t* requests)
+{
+  frame++;
+
+  std::vector<int> misses;
+  for (size_t page = 0; page < page_slots.size(); page++) {
+    if (!requests[page]) {
+      continue;
+    }
+
+    stats.num_requests++;
+    const int slot = page_slots[page];
+    if (slot < 0) {
+      misses.push_back(static_cast<int>(page));
+    } else if (!slot_loading[static_cast<size_t>(slot)]) {
+      stats.num_hits++;
+      slot_frames[static_cast<size_t>(slot)] = frame;
+    }
+  }
+
+  if (misses.empty()) {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (int page : misses) {
+      // Least recently requested slot that this frame did not need, empty slots first
+      int victim = -1;
+      for (size_t slot = 0; slot < num_slots; slot++) {
+        if (slot_loading[slot] || slot_frames[slot] == frame) {
+          continue;
+        }
+        if (victim < 0 || slot_frames[slot] < slot_frames[static_cast<size_t>(victim)]) {
+          victim = static_cast<int>(slot);
+        }
+      }
+
+      // Every slot holds a page of this frame, the rest wait for later frames
+      if (victim < 0) {
+        break;
+      }
+
+      const size_t slot = static_cast<size_t>(victim);
+      if (slot_pages[slot] >= 0) {
+        set_roots(slot_pages[slot], -1);
+        page_slots[static_cast<size_t>(slot_pages[slot])] = -1;
+        stats.num_evictions++;
+      }
+
+      slot_pages[slot] = page;
+      slot_frames[slot] = frame;
+      slot_loading[slot] = true;
+      page_slots[static_cast<size_t>(page)] = victim;
+      jobs.push_back({ page, victim });
+    }
+  }
+  jobs_ready.notify_one();
+}
+
+void GeometryStreamer::load_pages()
+{
+  for (;;) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      jobs_ready.wait(lock, [this]() { return stopping || !jobs.empty(); });
+      if (stopping) {
+        return;
+      }
+      job = jobs.front();
+      jobs.pop_front();
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    LoadedPage page = { job.page, job.slot, {}, 0.0 };
+    pages->load_page(static_cast<size_t>(job.page), page.data);
+    page.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    rebase(page.data, job.slot);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    loaded_pages.emplace_back(std::move(page));
+  }
+}
+
+void GeometryStreamer::rebase(GeometryPages::PageData& data, int slot) const
+{
+  const size_t index = static_cast<size_t>(slot);
+  const int node_base = static_cast<int>(pool.first_node + index * slot_nodes);
+  const int index_base = static_cast<int>(pool.first_index + index * slot_triangles);
+  const int primitive_base = pool.first_primitive + static_cast<int>(index * slot_triangles);
+  const int vertex_base = static_cast<int>(pool.first_vertex + index * slot_vertices);
+
+  // As IntersectableManager::append_bvh places mesh BVHs after the scene BVH
+  for (BVHNode& node : data.nodes) {
+    node.offset += node.count > 0 ? index_base : node_base;
+  }
+  for (int& primitive : data.indices) {
+    primitive += primitive_base;
+  }
+  for (ivec3& triangle : data.triangles) {
+    triangle += ivec3(vertex_base);
+  }
+}
+
+void GeometryStreamer::upload(const LoadedPage& page)
+{
+  const size_t slot = static_cast<size_t>(page.slot);
+  const auto upload_records = [](unsigned int buffer, size_t first, const auto& records) {
+    using Record = typename std::decay_t<decltype(records)>::value_type;
+    if (!records.empty()) {
+      glNamedBufferSubData(buffer, static_cast<long>(first * sizeof (Record)),
+                           static_cast<long>(records.size() * sizeof (Record)), records.data());
+    }
+  };
+
+  upload_records(pool.nodes, pool.first_node + slot * slot_nodes, page.data.nodes);
+  upload_records(pool.indices, pool.first_index + slot * slot_triangles, page.data.indices);
+  upload_records(pool.triangles, pool.first_triangle + slot * slot_triangles,
+                 page.data.triangles);
+  upload_records(pool.vertices, pool.first_vertex + slot * slot_vertices, page.data.vertices);
+
+  // Instances reach the page only once its data is in place
+  set_roots(page.page, static_cast<int>(pool.first_node + slot * slot_nodes));
+  slot_loading[slot] = false;
+
+  stats.num_loads++;
+  stats.bytes_streamed += GeometryPages::get_page_size(pages->get_page(static_cast<size_t>(
+    page.page)));
+  stats.load_seconds += page.seconds;
+}
+
+void GeometryStreamer::set_roots(int page, int root)
+{
+  for (int instance : page_instances[static_cast<size_t>(page)]) {
+    glNamedBufferSubData(pool.instances,
+                         static_cast<long>(static_cast<size_t>(instance) * sizeof (BVHInstance) +
+                                           offsetof(BVHInstance, root)),
+                         sizeof (int), &root);
+  }
+}
@@ -0,0 +1,139 @@
+#ifndef GEOMETRY_STREAMER_H
+#define GEOMETRY_STREAMER_H
+
+#include "model/geometry_pages.h"
+
+#include <glad/glad.h>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Residency cache of geometry pages on the GPU. Slots sized for the largest page follow the
+// resident scene in the node, index, triangle and vertex buffers, and the instances of a page
+// point at its slot while it is resident and at no root otherwise. raytrace.comp flags every page
+// its rays reach in a request buffer. Flagged pages that are not resident are loaded on a thread
+// into the least recently used slots, and appear in a frame after the one that missed them.
+class GeometryStreamer
+{
+public:
+  // Frames in flight before the requests of one are read back
+  static constexpr size_t NUM_REGIONS = 2;
+  // Slots unless the scene asks for another count
+  static constexpr size_t DEFAULT_NUM_SLOTS = 32;
+
+  struct Stats {
+    // Pages reached by rays, summed over frames
+    uint64_t num_requests;
+    // Requests for pages that were resident
+    uint64_t num_hits;
+    uint64_t num_loads;
+    uint64_t num_evictions;
+    // Bytes of loaded pages, as read from the file and uploaded
+    uint64_t bytes_streamed;
+    // Time the loader thread spent reading pages
+    double load_seconds;
+
+    // Fraction of requests that hit, 1 without requests
+    double get_hit_rate() const;
+    // Bytes per second the loader read pages at
+    double get_bandwidth() const;
+  };
+
+  // Buffers of IntersectableManager the slots live in, and where the first slot starts in each
+  struct Pool {
+    unsigned int nodes;
+    unsigned int indices;
+    unsigned int triangles;
+    unsigned int vertices;
+    unsigned int instances;
+    size_t first_node;
+    size_t first_index;
+    size_t first_triangle;
+    size_t first_vertex;
+    // Primitive index of the first triangle of the first slot, after the resident primitives
+    int first_primitive;
+  };
+
+  GeometryStreamer(std::shared_ptr<const GeometryPages> pages, size_t num_slots);
+  // Stops the loader thread
+  ~GeometryStreamer();
+
+  GeometryStreamer(const GeometryStreamer&) = delete;
+  GeometryStreamer& operator=(const GeometryStreamer&) = delete;
+
+  const GeometryPages& get_pages() const;
+  size_t get_num_slots() const;
+  // Records a slot takes in each buffer, indices are one per triangle
+  size_t get_slot_nodes() const;
+  size_t get_slot_triangles() const;
+  size_t get_slot_vertices() const;
+
+  // Starts streaming into the slots of pool, which must have storage for all of them.
+  // page_instances lists the instances of each page in the instance buffer.
+  void start(const Pool& pool, std::vector<std::vector<int>>&& page_instances);
+  // Uploads the pages loaded since the last frame, reads back the requests of the oldest frame
+  // in flight to queue the pages it missed, and binds a cleared request region for this frame
+  void begin_frame();
+  // Makes the requests of the frame visible to the mapping and fences them
+  void end_frame();
+
+  const Stats& get_stats() const;
+
+private:
+  struct Job {
+    int page;
+    int slot;
+  };
+
+  struct LoadedPage {
+    int page;
+    int slot;
+    GeometryPages::PageData data;
+    double seconds;
+  };
+
+  void load_pages();
+  void process_requests(const uint32_t* requests);
+  void upload(const LoadedPage& page);
+  void rebase(GeometryPages::PageData& data, int slot) const;
+  void set_roots(int page, int root);
+
+  std::shared_ptr<const GeometryPages> pages;
+  size_t num_slots;
+  size_t slot_nodes;
+  size_t slot_triangles;
+  size_t slot_vertices;
+  Pool pool = {};
+  std::vector<std::vector<int>> page_instances;
+
+  // Page held by each slot or -1, and the last frame it was requested in
+  std::vector<int> slot_pages;
+  std::vector<uint64_t> slot_frames;
+  // Slots whose page is still being loaded, which are neither hits nor evictable
+  std::vector<bool> slot_loading;
+  // Slot of each page, -1 when it has none
+  std::vector<int> page_slots;
+  uint64_t frame = 0;
+
+  unsigned int requests = 0;
+  uint32_t* request_mapping = nullptr;
+  // Bytes per region, rounded up to the storage buffer offset alignment
+  size_t region_size = 0;
+  size_t region = 0;
+  GLsync fences[NUM_REGIONS] = {};
+
+  std::thread loader;
+  std::mutex mutex;
+  std::condition_variable jobs_ready;
+  std::deque<Job> jobs;
+  std::vector<LoadedPage> loaded_pages;
+  bool stopping = false;
+
+  Stats stats = {};
+};
+
+#endif // GEOMETRY_STREAMER_H
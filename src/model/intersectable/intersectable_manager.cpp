@@ -1,26 +1,47 @@
 #include "intersectable_manager.h"
 
+#include "cpu/kernels.h"
+#include "model/bvh/primitive_store.h"
+#include "util/exception.h"
+#include "util/logging.h"
+#include "util/thread_pool.h"
+
 #include <glad/glad.h>
 #include <algorithm>
+#include <array>
+#include <map>
 #include <memory>
+#include <utility>
 
 IntersectableManager::IntersectableManager()
 {
-  glGenBuffers(1, &intersectables);
-  glGenBuffers(1, &num_intersectables);
-  glGenBuffers(1, &materials);
 }
 
 IntersectableManager::~IntersectableManager()
 {
-  glDeleteBuffers(1, &intersectables);
-  glDeleteBuffers(1, &num_intersectables);
-  glDeleteBuffers(1, &materials);
+  // Buffers are only created on finalize, so a CPU-only manager never touches GL
+  if (intersectables) {
+    glDeleteBuffers(1, &intersectables);
+    glDeleteBuffers(1, &num_intersectables);
+    glDeleteBuffers(1, &materials);
+    glDeleteBuffers(1, &bvh_nodes);
+    glDeleteBuffers(1, &bvh_indices);
+    glDeleteBuffers(1, &instance_transforms);
+    glDeleteBuffers(1, &wide_bvh_nodes);
+    glDeleteBuffers(1, &quantized_bvh_nodes);
+    glDeleteBuffers(1, &vertices);
+    glDeleteBuffers(1, &triangle_indices);
+    glDeleteBuffers(1, &material_indices);
+  }
 }
 
 void IntersectableManager::add_triangle(Triangle&& triangle, Material&& material)
 {
-  triangles.emplace_back(std::move(triangle), std::move(material));
+  const int first_vertex = static_cast<int>(triangle_vertices.size());
+  triangle_vertices.insert(triangle_vertices.end(), triangle.vertices, triangle.vertices + 3);
+  triangles.emplace_back(first_vertex, first_vertex + 1, first_vertex + 2,
+                         static_cast<int>(triangle_materials.size()));
+  triangle_materials.emplace_back(std::move(material));
 }
 
 void IntersectableManager::add_sphere(Sphere&& sphere, Material&& material)
@@ -33,73 +54,997 @@ void IntersectableManager::add_aabb(AABB&& aabb, Material&& material)
   aabbs.emplace_back(std::move(aabb), std::move(material));
 }
 
-void IntersectableManager::finalize()
+void IntersectableManager::add_triangles(const TriangleMesh& mesh,
+                                         const std::vector<Material>& materials)
 {
-  const std::vector<int> num_objects = {
-    static_cast<int>(spheres.size()),
-    static_cast<int>(triangles.size()),
-    static_cast<int>(aabbs.size())
-  };
+  const ivec3 vertex_offset(static_cast<int>(triangle_vertices.size()));
+  const int material_offset = static_cast<int>(triangle_materials.size());
+  triangle_vertices.insert(triangle_vertices.end(), mesh.positions.begin(), mesh.positions.end());
+  triangle_materials.insert(triangle_materials.end(), materials.begin(), materials.end());
+  triangles.reserve(triangles.size() + mesh.get_num_triangles());
 
-  const size_t total_size = spheres.size() + triangles.size() + aabbs.size();
-  constexpr size_t intersectable_stride = 3;
-  constexpr size_t material_stride = 3;
+  for (size_t i = 0; i < mesh.get_num_triangles(); i++) {
+    const ivec3 indices(mesh.indices[i * 3], mesh.indices[i * 3 + 1], mesh.indices[i * 3 + 2]);
+    triangles.emplace_back(indices + vertex_offset, material_offset + mesh.groups[i]);
+  }
+}
 
-  glBindBuffer(GL_UNIFORM_BUFFER, num_intersectables);
-  glBufferData(GL_UNIFORM_BUFFER, static_cast<long>(num_objects.size() * sizeof (int)),
-               num_objects.data(), GL_STATIC_DRAW);
-  glBindBufferBase(GL_UNIFORM_BUFFER, 3, num_intersectables);
+int IntersectableManager::add_mesh(std::vector<Triangle>&& triangles)
+{
+  Mesh& mesh = meshes.emplace_back();
+  mesh.vertices.reserve(triangles.size() * 3);
+  mesh.triangles.reserve(triangles.size());
+
+  for (const Triangle& triangle : triangles) {
+    const int first_vertex = static_cast<int>(mesh.vertices.size());
+    mesh.vertices.insert(mesh.vertices.end(), triangle.vertices, triangle.vertices + 3);
+    mesh.triangles.emplace_back(first_vertex, first_vertex + 1, first_vertex + 2);
+  }
+
+  return static_cast<int>(meshes.size()) - 1;
+}
+
+int IntersectableManager::add_mesh(const TriangleMesh& triangle_mesh)
+{
+  Mesh& mesh = meshes.emplace_back();
+  mesh.vertices = triangle_mesh.positions;
+  mesh.triangles.reserve(triangle_mesh.get_num_triangles());
+
+  for (size_t i = 0; i < triangle_mesh.get_num_triangles(); i++) {
+    const int* indices = &triangle_mesh.indices[i * 3];
+    mesh.triangles.emplace_back(indices[0], indices[1], indices[2]);
+  }
+
+  return static_cast<int>(meshes.size()) - 1;
+}
+
+void IntersectableManager::add_instance(int mesh, const mat4& transform, Material&& material)
+{
+  instances.push_back({ mesh, transform, std::move(material) });
+}
+
+void IntersectableManager::update_triangle(int index, Triangle&& triangle)
+{
+  ensure_bvhs_built();
+
+  // Scene triangles lead the vertex data, so their vertex indices need no offset
+  const ivec4& indices = triangles[static_cast<size_t>(index)];
+  std::vector<int> moved_triangles;
+  for (int i = 0; i < 3; i++) {
+    const size_t vertex = static_cast<size_t>(indices[i]);
+    triangle_vertices[vertex] = triangle.vertices[i];
+    vertex_data[vertex] = vec4(triangle.vertices[i], 0.0f);
+    dirty_vertices.emplace_back(indices[i]);
+
+    // Triangles of add_triangles share vertices, so the neighbours move too
+    moved_triangles.insert(moved_triangles.end(),
+                           vertex_triangles.begin() + vertex_triangle_offsets[vertex],
+                           vertex_triangles.begin() + vertex_triangle_offsets[vertex + 1]);
+  }
+
+  std::sort(moved_triangles.begin(), moved_triangles.end());
+  moved_triangles.erase(std::unique(moved_triangles.begin(), moved_triangles.end()),
+                        moved_triangles.end());
+
+  const int first_triangle = static_cast<int>(spheres.size() + aabbs.size());
+  for (int moved_triangle : moved_triangles) {
+    const ivec4& moved = triangles[static_cast<size_t>(moved_triangle)];
+    const vec3& a = triangle_vertices[static_cast<size_t>(moved.x)];
+    const vec3& b = triangle_vertices[static_cast<size_t>(moved.y)];
+    const vec3& c = triangle_vertices[static_cast<size_t>(moved.z)];
+    bvh.update_primitive(first_triangle + moved_triangle, PrimitiveStore::get_bounds(a, b, c));
+  }
+}
+
+void IntersectableManager::update_sphere(int index, Sphere&& sphere)
+{
+  ensure_bvhs_built();
+  spheres[static_cast<size_t>(index)].first = std::move(sphere);
+  update_intersectable(index, spheres[static_cast<size_t>(index)].first);
+}
 
-  std::vector<vec4> intersectable_data;
-  std::vector<vec4> material_data;
-  intersectable_data.reserve(total_size * intersectable_stride);
-  material_data.reserve(total_size * material_stride);
+void IntersectableManager::update_aabb(int index, AABB&& aabb)
+{
+  ensure_bvhs_built();
+  aabbs[static_cast<size_t>(index)].first = std::move(aabb);
+  update_intersectable(static_cast<int>(spheres.size()) + index,
+                       aabbs[static_cast<size_t>(index)].first);
+}
+
+void IntersectableManager::refit()
+{
+  ensure_bvhs_built();
+
+  const std::vector<int> dirty_nodes = bvh.refit();
+
+  std::sort(dirty_intersectables.begin(), dirty_intersectables.end());
+  dirty_intersectables.erase(std::unique(dirty_intersectables.begin(), dirty_intersectables.end()),
+                             dirty_intersectables.end());
+  std::sort(dirty_vertices.begin(), dirty_vertices.end());
+  dirty_vertices.erase(std::unique(dirty_vertices.begin(), dirty_vertices.end()),
+                       dirty_vertices.end());
+
+  // Only upload when the buffers exist, CPU-only managers just read the packed data
+  // The scene BVH is first in the node data, so its indices need no offset
+  for (int node_index : dirty_nodes) {
+    node_data[static_cast<size_t>(node_index)] = bvh.get_nodes()[static_cast<size_t>(node_index)];
+  }
+
+  // Wide nodes keep the children they were collapsed with, only bounds change
+  const std::vector<int> dirty_wide_nodes = refit_wide_nodes(dirty_nodes);
+
+  // Blocks hold copies of the primitives, so they are packed again
+  if (!primitive_blocks.empty() && (!dirty_intersectables.empty() || !dirty_vertices.empty())) {
+    pack_primitive_blocks();
+  }
+
+  if (intersectables) {
+    upload_ranges(bvh_nodes, dynamic_bvh_nodes, dirty_nodes, sizeof (BVHNode), node_data.data());
+    upload_ranges(intersectables, dynamic_intersectables, dirty_intersectables,
+                  intersectable_stride * sizeof (vec4), intersectable_data.data());
+    upload_ranges(vertices, dynamic_vertices, dirty_vertices, sizeof (vec4), vertex_data.data());
+
+    if (bvh_layout == BVH::Layout::Wide4) {
+      upload_ranges(wide_bvh_nodes, dynamic_wide_bvh_nodes, dirty_wide_nodes,
+                    sizeof (WideBVHNode<4>), wide4_node_data.data());
+    } else if (bvh_layout == BVH::Layout::Quantized4) {
+      upload_ranges(quantized_bvh_nodes, dynamic_quantized_bvh_nodes, dirty_wide_nodes,
+                    sizeof (QuantizedBVHNode), quantized4_node_data.data());
+    }
+  }
+
+  dirty_intersectables.clear();
+  dirty_vertices.clear();
+}
+
+void IntersectableManager::set_bvh_builder(BVH::Builder builder)
+{
+  bvh_builder = builder;
+}
+
+void IntersectableManager::set_bvh_max_duplication(float max_duplication)
+{
+  bvh_max_duplication = max_duplication;
+}
+
+void IntersectableManager::set_bvh_layout(BVH::Layout layout)
+{
+  bvh_layout = layout;
+}
+
+void IntersectableManager::pack()
+{
+  if (geometry_streamer) {
+    throw RenderException("Streamed geometry is GPU only, the CPU needs resident meshes");
+  }
+
+  leaf_block_size = PrimitiveBlock::SIZE;
+  pack_primitives();
+  build_bvhs();
+  pack_primitive_blocks();
+}
+
+void IntersectableManager::pack_primitives()
+{
+  // Spheres and boxes come first, so their records are indexed like the primitives
+  const size_t num_intersectables = spheres.size() + aabbs.size();
+  intersectable_data.resize(num_intersectables * intersectable_stride);
+
+  // Materials are interned, so primitives that share one share its record. Reflectance is
+  // derived from the other fields, which makes them the key.
+  std::map<std::array<float, 6>, int> interned_materials;
+  material_data.clear();
+
+  const auto intern_material = [&](const Material& material) {
+    const std::array<float, 6> key = {
+      material.albedo.x, material.albedo.y, material.albedo.z,
+      material.metallic, material.roughness, material.ao,
+    };
+    const auto [entry, inserted] = interned_materials.emplace(
+      key, static_cast<int>(interned_materials.size()));
+    if (!inserted) {
+      return entry->second;
+    }
+
+    if (interned_materials.size() > max_materials) {
+      throw RenderException("More than " + std::to_string(max_materials) + " distinct materials");
+    }
 
-  const auto add_material = [&material_data](const Material& material) {
     material_data.emplace_back(vec4(material.albedo, 0.0));
     material_data.emplace_back(vec4(material.metallic, material.roughness, material.ao, 0.0));
 
     vec3 f0 = glm::mix(vec3(0.04f), material.albedo, material.metallic);
     vec3 reflectance = (f0 + (vec3(1.0f) - f0) * pow(0.5f, 5.0f)) * (1.0f - material.roughness);
     material_data.emplace_back(vec4(reflectance, 0.0));
+    return entry->second;
   };
 
+  // One index per scene primitive, padded to whole uints for the GPU
+  material_index_data.clear();
+  material_index_data.reserve(num_intersectables + triangles.size() + 1);
+
+  vec4* data = intersectable_data.data();
+
   for (const auto& [sphere, material] : spheres) {
-    intersectable_data.emplace_back(vec4(sphere.center, sphere.radius * sphere.radius));
-    intersectable_data.insert(intersectable_data.end(), {{}, {}});
-    add_material(material);
+    pack_intersectable(sphere, data);
+    data += intersectable_stride;
+    material_index_data.emplace_back(static_cast<uint16_t>(intern_material(material)));
   }
 
-  for (const auto& [triangle, material] : triangles) {
-    vec3 e1 = triangle.vertices[1] - triangle.vertices[0];
-    vec3 e2 = triangle.vertices[2] - triangle.vertices[0];
-    vec3 n = glm::cross(e1, e2);
-    intersectable_data.emplace_back(vec4(triangle.vertices[0], e2.x));
-    intersectable_data.emplace_back(vec4(n, e2.y));
-    intersectable_data.emplace_back(vec4(e1, e2.z));
-    add_material(material);
+  for (const auto& [aabb, material] : aabbs) {
+    pack_intersectable(aabb, data);
+    data += intersectable_stride;
+    material_index_data.emplace_back(static_cast<uint16_t>(intern_material(material)));
   }
 
-  for (const auto& [aabb, material] : aabbs) {
-    intersectable_data.emplace_back(aabb.center - aabb.lengths / 2.0f);
-    intersectable_data.emplace_back(aabb.center + aabb.lengths / 2.0f);
-    intersectable_data.emplace_back();
-    add_material(material);
+  std::vector<uint16_t> triangle_material_indices;
+  triangle_material_indices.reserve(triangle_materials.size());
+  for (const Material& material : triangle_materials) {
+    triangle_material_indices.emplace_back(static_cast<uint16_t>(intern_material(material)));
   }
 
+  // Mesh triangles follow the scene ones, each mesh stored once however often it is instanced
+  size_t num_vertices = triangle_vertices.size();
+  size_t num_triangles = triangles.size();
+  for (const auto& mesh : meshes) {
+    num_vertices += mesh.vertices.size();
+    num_triangles += mesh.triangles.size();
+  }
+
+  vertex_data.clear();
+  vertex_data.reserve(num_vertices);
+  triangle_data.clear();
+  triangle_data.reserve(num_triangles);
+
+  for (const vec3& vertex : triangle_vertices) {
+    vertex_data.emplace_back(vertex, 0.0f);
+  }
+  for (const ivec4& triangle : triangles) {
+    triangle_data.emplace_back(triangle);
+    material_index_data.emplace_back(triangle_material_indices[static_cast<size_t>(triangle.w)]);
+  }
+
+  // Triangles of each scene vertex, which update_triangle refits along with the one it moves
+  vertex_triangle_offsets.assign(triangle_vertices.size() + 1, 0);
+  for (const ivec4& triangle : triangles) {
+    for (int i = 0; i < 3; i++) {
+      vertex_triangle_offsets[static_cast<size_t>(triangle[i]) + 1]++;
+    }
+  }
+  for (size_t i = 1; i < vertex_triangle_offsets.size(); i++) {
+    vertex_triangle_offsets[i] += vertex_triangle_offsets[i - 1];
+  }
+  vertex_triangles.resize(triangles.size() * 3);
+  std::vector<int> next_triangles(vertex_triangle_offsets.begin(),
+                                  vertex_triangle_offsets.end() - 1);
+  for (size_t i = 0; i < triangles.size(); i++) {
+    for (int corner = 0; corner < 3; corner++) {
+      const size_t vertex = static_cast<size_t>(triangles[i][corner]);
+      vertex_triangles[static_cast<size_t>(next_triangles[vertex]++)] = static_cast<int>(i);
+    }
+  }
+
+  if (material_index_data.size() % 2) {
+    material_index_data.emplace_back(0);
+  }
+
+  for (const auto& mesh : meshes) {
+    const ivec3 vertex_offset(static_cast<int>(vertex_data.size()));
+    for (const vec3& vertex : mesh.vertices) {
+      vertex_data.emplace_back(vertex, 0.0f);
+    }
+    for (const ivec3& triangle : mesh.triangles) {
+      triangle_data.emplace_back(triangle + vertex_offset);
+    }
+  }
+
+  // Mesh triangles have no index of their own, their instance carries the material
+  instance_materials.clear();
+  instance_materials.reserve(instances.size());
+  for (const auto& instance : instances) {
+    instance_materials.emplace_back(intern_material(instance.material));
+  }
+}
+
+void IntersectableManager::ensure_bvhs_built()
+{
+  // A cache hit skips the build, so the trees are built before the first update from the
+  // unchanged primitives. Builds are deterministic and reproduce the uploaded nodes.
+  if (!bvhs_built) {
+    build_bvhs();
+  }
+}
+
+void IntersectableManager::build_bvhs()
+{
+  const size_t total_size = spheres.size() + triangles.size() + aabbs.size();
+
+  // Leaves index the packed primitives, so they are listed in the same order
+  PrimitiveStore store;
+  store.reserve(total_size);
+  for (const auto& sphere : spheres) {
+    store.add(sphere.first);
+  }
+  for (const auto& aabb : aabbs) {
+    store.add(aabb.first);
+  }
+  store.add_triangles(triangle_vertices, triangles);
+
+  bvh.set_max_duplication(bvh_max_duplication);
+  bvh.set_leaf_block_size(leaf_block_size);
+  bvh.build(store, bvh_builder);
+
+  node_data.clear();
+  index_data.clear();
+  binary_roots.clear();
+  binary_roots.emplace_back(append_bvh(bvh, 0));
+
+  // Each mesh BVH is built once in object space, rebased into the shared node and index lists
+  int triangle_offset = static_cast<int>(total_size);
+
+  for (auto& mesh : meshes) {
+    store.clear();
+    store.add_triangles(mesh.vertices, mesh.triangles);
+
+    mesh.bvh.set_max_duplication(bvh_max_duplication);
+    mesh.bvh.set_leaf_block_size(leaf_block_size);
+    mesh.bvh.build(store, bvh_builder);
+    binary_roots.emplace_back(append_bvh(mesh.bvh, triangle_offset));
+    triangle_offset += static_cast<int>(mesh.triangles.size());
+  }
+
+  // Roots in the layout that is traversed, the scene BVH first
+  const std::vector<int> roots = pack_wide_nodes();
+
+  // The top level BVH is over instance bounds in world space, its leaves index instance_data
+  std::vector<BVHPrimitive> instance_primitives;
+  instance_primitives.reserve(instances.size());
+  instance_data.clear();
+  instance_data.reserve(instances.size());
+  page_instances.clear();
+  if (geometry_streamer) {
+    page_instances.resize(geometry_streamer->get_pages().get_num_pages());
+  }
+
+  for (size_t i = 0; i < instances.size(); i++) {
+    const Instance& instance = instances[i];
+    const mat4 world_to_object = glm::inverse(instance.transform);
+
+    BVHInstance packed_instance = {};
+    for (int row = 0; row < 3; row++) {
+      packed_instance.world_to_object[row] = vec4(world_to_object[0][row], world_to_object[1][row],
+                                                  world_to_object[2][row], world_to_object[3][row]);
+    }
+    packed_instance.material = instance_materials[i];
+
+    // The top level BVH is the proxy of streamed meshes: each page is an instance without a
+    // root until the streamer loads it
+    if (geometry_streamer) {
+      const GeometryPages& pages = geometry_streamer->get_pages();
+      const GeometryPages::Mesh& mesh = pages.get_mesh(static_cast<size_t>(instance.mesh));
+
+      for (uint32_t page = mesh.first_page; page < mesh.first_page + mesh.num_pages; page++) {
+        packed_instance.root = -1;
+        packed_instance.page = static_cast<int>(page);
+        page_instances[page].emplace_back(static_cast<int>(instance_data.size()));
+
+        instance_data.emplace_back(packed_instance);
+        instance_primitives.emplace_back(get_instance_primitive(instance.transform,
+                                                                pages.get_page(page).bounds));
+      }
+      continue;
+    }
+
+    const std::vector<BVHNode>& mesh_nodes = meshes[static_cast<size_t>(instance.mesh)].bvh
+                                               .get_nodes();
+    Bounds mesh_bounds;
+    if (!mesh_nodes.empty()) {
+      mesh_bounds = { vec3(mesh_nodes.front().min), vec3(mesh_nodes.front().max) };
+    }
+
+    packed_instance.root = roots[static_cast<size_t>(instance.mesh) + 1];
+    packed_instance.page = -1;
+
+    instance_data.emplace_back(packed_instance);
+    instance_primitives.emplace_back(get_instance_primitive(instance.transform, mesh_bounds));
+  }
+
+  tlas.set_max_duplication(bvh_max_duplication);
+  tlas.build(instance_primitives, bvh_builder);
+  const int tlas_root = append_bvh(tlas, 0);
+  check_stack_size(roots);
+
+  num_objects = {
+    static_cast<int>(spheres.size()),
+    static_cast<int>(triangles.size()),
+    static_cast<int>(aabbs.size()),
+    roots.front(),
+    tlas_root,
+    static_cast<int>(bvh_layout),
+  };
+
+  bvhs_built = true;
+}
+
+int IntersectableManager::append_bvh(const BVH& bvh, int primitive_offset)
+{
+  if (bvh.get_nodes().empty()) {
+    return -1;
+  }
+
+  const int node_offset = static_cast<int>(node_data.size());
+  const int index_offset = static_cast<int>(index_data.size());
+
+  for (BVHNode node : bvh.get_nodes()) {
+    node.offset += node.count > 0 ? index_offset : node_offset;
+    node_data.emplace_back(node);
+  }
+
+  for (int index : bvh.get_indices()) {
+    index_data.emplace_back(index + primitive_offset);
+  }
+
+  return node_offset;
+}
+
+std::vector<int> IntersectableManager::pack_wide_nodes()
+{
+  wide4_node_data.clear();
+  wide8_node_data.clear();
+  quantized4_node_data.clear();
+  wide_sources.clear();
+
+  std::vector<int> roots;
+  roots.reserve(binary_roots.size());
+
+  for (int root : binary_roots) {
+    switch (bvh_layout) {
+      case BVH::Layout::Binary:
+        roots.emplace_back(root);
+        break;
+      case BVH::Layout::Wide4:
+      case BVH::Layout::Quantized4:
+        roots.emplace_back(WideBVH::collapse(node_data, root, wide4_node_data, wide_sources));
+        break;
+      case BVH::Layout::Wide8:
+        roots.emplace_back(WideBVH::collapse(node_data, root, wide8_node_data, wide_sources));
+        break;
+    }
+  }
+
+  // Quantized nodes keep the indices of the wide nodes they come from
+  if (bvh_layout == BVH::Layout::Quantized4) {
+    WideBVH::quantize(wide4_node_data, quantized4_node_data);
+    wide4_node_data.clear();
+  }
+
+  // Wide node holding each binary node as a child, which refit_wide_nodes refits when it
+  // changes
+  const int width = bvh_layout == BVH::Layout::Wide8 ? 8 : 4;
+  wide_parents.assign(bvh_layout == BVH::Layout::Binary ? 0 : node_data.size(), -1);
+  for (size_t slot = 0; slot < wide_sources.size(); slot++) {
+    if (wide_sources[slot] >= 0) {
+      wide_parents[static_cast<size_t>(wide_sources[slot])] = static_cast<int>(slot) / width;
+    }
+  }
+
+  return roots;
+}
+
+std::vector<int> IntersectableManager::refit_wide_nodes(const std::vector<int>& dirty_nodes)
+{
+  std::vector<int> dirty_wide_nodes;
+  if (wide_parents.empty()) {
+    return dirty_wide_nodes;
+  }
+
+  for (int node_index : dirty_nodes) {
+    const int parent = wide_parents[static_cast<size_t>(node_index)];
+    if (parent >= 0) {
+      dirty_wide_nodes.emplace_back(parent);
+    }
+  }
+  std::sort(dirty_wide_nodes.begin(), dirty_wide_nodes.end());
+  dirty_wide_nodes.erase(std::unique(dirty_wide_nodes.begin(), dirty_wide_nodes.end()),
+                         dirty_wide_nodes.end());
+
+  for (int wide_index : dirty_wide_nodes) {
+    const size_t index = static_cast<size_t>(wide_index);
+    switch (bvh_layout) {
+      case BVH::Layout::Binary:
+        break;
+      case BVH::Layout::Wide4:
+        WideBVH::refit(node_data, wide_sources, wide_index, wide4_node_data[index]);
+        break;
+      case BVH::Layout::Wide8:
+        WideBVH::refit(node_data, wide_sources, wide_index, wide8_node_data[index]);
+        break;
+      case BVH::Layout::Quantized4:
+        WideBVH::refit(node_data, wide_sources, wide_index, quantized4_node_data[index]);
+        break;
+    }
+  }
+
+  return dirty_wide_nodes;
+}
+
+void IntersectableManager::check_stack_size(const std::vector<int>& roots) const
+{
+  // Binary traversals save one node per level below the root
+  int max_depth = std::max(bvh.get_stats().max_depth, tlas.get_stats().max_depth);
+  for (const auto& mesh : meshes) {
+    max_depth = std::max(max_depth, mesh.bvh.get_stats().max_depth);
+  }
+  int stack_size = max_depth - 1;
+
+  // Wide traversals on the GPU save all but one child of each wide node, and hold the root
+  // first. The CPU sizes its wide stacks for any BVH within the binary limit.
+  for (int root : roots) {
+    if (bvh_layout == BVH::Layout::Wide4) {
+      stack_size = std::max(stack_size, 3 * WideBVH::get_max_depth(wide4_node_data, root) + 1);
+    } else if (bvh_layout == BVH::Layout::Quantized4) {
+      stack_size = std::max(stack_size,
+                            3 * WideBVH::get_max_depth(quantized4_node_data, root) + 1);
+    }
+  }
+
+  if (stack_size > BVH::STACK_SIZE) {
+    Logging::get_logger() << "BVHs of depth " << max_depth << " need " << stack_size
+                          << " traversal stack entries but rays have " << BVH::STACK_SIZE
+                          << ", hits behind the dropped nodes will be missed" << std::endl;
+  }
+}
+
+void IntersectableManager::pack_primitive_blocks()
+{
+  // The instance BVH is last in the node data and its leaves list instances, so it is left out
+  const int tlas_root = num_objects[4];
+  const size_t num_nodes = tlas_root < 0 ? node_data.size() : static_cast<size_t>(tlas_root);
+
+  PrimitiveBlocks::pack(node_data, num_nodes, index_data, intersectable_data, vertex_data,
+                        triangle_data, static_cast<int>(spheres.size()),
+                        static_cast<int>(aabbs.size()), primitive_blocks, block_offsets);
+}
+
+BVHPrimitive IntersectableManager::get_instance_primitive(const mat4& transform,
+                                                          const Bounds& object_bounds)
+{
+  BVHPrimitive primitive;
+
+  // An empty mesh is a point at its origin, it is never hit since it has no root
+  if (object_bounds.is_empty()) {
+    primitive.bounds.grow(vec3(transform[3]));
+  } else {
+    for (int corner = 0; corner < 8; corner++) {
+      vec3 point((corner & 1) ? object_bounds.max.x : object_bounds.min.x,
+                 (corner & 2) ? object_bounds.max.y : object_bounds.min.y,
+                 (corner & 4) ? object_bounds.max.z : object_bounds.min.z);
+      primitive.bounds.grow(vec3(transform * vec4(point, 1.0f)));
+    }
+  }
+
+  primitive.center = (primitive.bounds.min + primitive.bounds.max) * 0.5f;
+  return primitive;
+}
+
+void IntersectableManager::pack_intersectable(const Sphere& sphere, vec4* data)
+{
+  data[0] = vec4(sphere.center, sphere.radius * sphere.radius);
+  data[1] = vec4();
+  data[2] = vec4();
+}
+
+void IntersectableManager::pack_intersectable(const AABB& aabb, vec4* data)
+{
+  data[0] = aabb.center - aabb.lengths / 2.0f;
+  data[1] = aabb.center + aabb.lengths / 2.0f;
+  data[2] = vec4();
+}
+
+template <typename T>
+void IntersectableManager::update_intersectable(int index, const T& intersectable)
+{
+  pack_intersectable(intersectable,
+                     &intersectable_data[static_cast<size_t>(index) * intersectable_stride]);
+  bvh.update_primitive(index, PrimitiveStore::get_bounds(intersectable));
+  dirty_intersectables.emplace_back(index);
+}
+
+void IntersectableManager::upload_ranges(unsigned int buffer, DynamicBuffer& dynamic_buffer,
+                                         const std::vector<int>& indices, size_t element_size,
+                                         const void* data)
+{
+  // Merge sorted indices into contiguous runs, one upload each
+  for (size_t begin = 0; begin < indices.size();) {
+    size_t end = begin + 1;
+    while (end < indices.size() && indices[end] == indices[end - 1] + 1) {
+      end++;
+    }
+
+    upload_range(buffer, dynamic_buffer, static_cast<size_t>(indices[begin]) * element_size,
+                 (end - begin) * element_size, data);
+    begin = end;
+  }
+}
+
+void IntersectableManager::upload_range(unsigned int buffer, DynamicBuffer& dynamic_buffer,
+                                        size_t offset, size_t size, const void* data)
+{
+  // Dynamic buffers copy the range into each region when the GPU is done with it
+  if (dynamic_buffer.is_created()) {
+    dynamic_buffer.mark_dirty(offset, size);
+  } else {
+    glNamedBufferSubData(buffer, static_cast<long>(offset), static_cast<long>(size),
+                         static_cast<const char*>(data) + offset);
+  }
+}
+
+void IntersectableManager::finalize()
+{
+  // raytrace.comp only traverses binary and 4 wide nodes, quantized or not
+  if (bvh_layout == BVH::Layout::Wide8) {
+    Logging::get_logger() << "BVH8 is CPU only, using BVH4 on the GPU" << std::endl;
+    bvh_layout = BVH::Layout::Wide4;
+  }
+
+  if (geometry_streamer) {
+    if (dynamic) {
+      throw RenderException("Streamed geometry cannot be combined with dynamic mode");
+    }
+    if (!meshes.empty()) {
+      throw RenderException("Streamed scenes take all of their meshes from the pages");
+    }
+    // Instance roots are patched to slots of binary page BVHs as pages arrive
+    if (bvh_layout != BVH::Layout::Binary) {
+      Logging::get_logger() << "Streamed geometry uses the binary layout" << std::endl;
+      bvh_layout = BVH::Layout::Binary;
+    }
+  }
+
+  // The GPU intersects leaf primitives one at a time
+  leaf_block_size = 1;
+  pack_primitives();
+
+  // Buffers come from the cache file when one matches the scene, or are built and saved
+  BVHCache cache;
+  std::vector<BVHCache::Section> sections;
+  // Pages are not part of the hash, so streamed scenes are always built
+  const bool use_cache = !cache_directory.empty() && !geometry_streamer;
+  const uint64_t scene_hash = use_cache ? hash_scene() : 0;
+  const std::string cache_path = BVHCache::get_path(cache_directory, scene_hash);
+
+  if (use_cache && cache.load(cache_path, scene_hash, NUM_CACHE_SECTIONS)) {
+    Logging::get_logger() << "Loaded BVH from " << cache_path << std::endl;
+
+    const BVHCache::Section& cached_objects = cache.get_section(CACHE_NUM_OBJECTS);
+    const int* num_objects_data = static_cast<const int*>(cached_objects.data);
+    num_objects.assign(num_objects_data, num_objects_data + cached_objects.size / sizeof (int));
+
+    for (size_t i = 0; i < NUM_CACHE_SECTIONS; i++) {
+      sections.emplace_back(cache.get_section(i));
+    }
+  } else {
+    build_bvhs();
+    sections = get_cache_sections();
+
+    if (use_cache) {
+      BVHCache::save(cache_path, scene_hash, sections);
+    }
+  }
+
+  glGenBuffers(1, &intersectables);
+  glGenBuffers(1, &num_intersectables);
+  glGenBuffers(1, &materials);
+  glGenBuffers(1, &bvh_nodes);
+  glGenBuffers(1, &bvh_indices);
+  glGenBuffers(1, &instance_transforms);
+  glGenBuffers(1, &wide_bvh_nodes);
+  glGenBuffers(1, &quantized_bvh_nodes);
+  glGenBuffers(1, &vertices);
+  glGenBuffers(1, &triangle_indices);
+  glGenBuffers(1, &material_indices);
+
+  glBindBuffer(GL_UNIFORM_BUFFER, num_intersectables);
+  glBufferData(GL_UNIFORM_BUFFER, static_cast<long>(num_objects.size() * sizeof (int)),
+               num_objects.data(), GL_STATIC_DRAW);
+  glBindBufferBase(GL_UNIFORM_BUFFER, 3, num_intersectables);
+
   constexpr GLenum buffer_type = GL_SHADER_STORAGE_BUFFER;
 
-  glBindBuffer(buffer_type, intersectables);
-  glBufferStorage(buffer_type,
-                  static_cast<long>(total_size * intersectable_stride * sizeof (vec4)),
-                  intersectable_data.data(), 0);
-  glBindBufferBase(buffer_type, 4, intersectables);
+  // Empty buffer storage is invalid, so unused buffers get a placeholder element. Reserved
+  // bytes after the data hold the slots of streamed pages.
+  const auto create_storage = [](unsigned int buffer, unsigned int binding,
+                                 const BVHCache::Section& data, size_t element_size,
+                                 GLbitfield flags, size_t reserved = 0) {
+    glBindBuffer(buffer_type, buffer);
+    glBufferStorage(buffer_type, static_cast<long>(std::max(data.size + reserved, element_size)),
+                    data.size > 0 && reserved == 0 ? data.data : nullptr, flags);
+    if (data.size > 0 && reserved > 0) {
+      glBufferSubData(buffer_type, 0, static_cast<long>(data.size), data.data);
+    }
+    glBindBufferBase(buffer_type, binding, buffer);
+  };
+
+  // Buffers that refit writes to, persistently mapped in dynamic mode
+  const auto create_updated_storage = [this, &create_storage](unsigned int buffer,
+                                                              DynamicBuffer& dynamic_buffer,
+                                                              unsigned int binding,
+                                                              const BVHCache::Section& data,
+                                                              size_t element_size,
+                                                              size_t reserved = 0) {
+    if (dynamic) {
+      dynamic_buffer.create(binding, data.data, data.size, element_size);
+    } else {
+      create_storage(buffer, binding, data, element_size, GL_DYNAMIC_STORAGE_BIT, reserved);
+    }
+  };
+
+  // Streamed pages are written into the buffers they need, after the resident data
+  const size_t num_slots = geometry_streamer ? geometry_streamer->get_num_slots() : 0;
+  const GLbitfield streamed_flags = geometry_streamer ? GL_DYNAMIC_STORAGE_BIT : 0;
+  size_t slot_nodes = 0, slot_triangles = 0, slot_vertices = 0;
+  if (geometry_streamer) {
+    slot_nodes = geometry_streamer->get_slot_nodes();
+    slot_triangles = geometry_streamer->get_slot_triangles();
+    slot_vertices = geometry_streamer->get_slot_vertices();
+  }
+
+  create_updated_storage(intersectables, dynamic_intersectables, 4,
+                         { intersectable_data.data(), intersectable_data.size() * sizeof (vec4) },
+                         intersectable_stride * sizeof (vec4));
+  create_storage(materials, 5, { material_data.data(), material_data.size() * sizeof (vec4) },
+                 material_stride * sizeof (vec4), 0);
+  create_updated_storage(vertices, dynamic_vertices, 21,
+                         { vertex_data.data(), vertex_data.size() * sizeof (vec4) },
+                         sizeof (vec4), num_slots * slot_vertices * sizeof (vec4));
+  create_storage(triangle_indices, 22,
+                 { triangle_data.data(), triangle_data.size() * sizeof (ivec3) },
+                 sizeof (ivec3), streamed_flags, num_slots * slot_triangles * sizeof (ivec3));
+  create_storage(material_indices, 23,
+                 { material_index_data.data(), material_index_data.size() * sizeof (uint16_t) },
+                 sizeof (uint32_t), 0);
 
-  glBindBuffer(buffer_type, materials);
-  glBufferStorage(buffer_type,
-                  static_cast<long>(total_size * material_stride * sizeof (vec4)),
-                  material_data.data(), 0);
-  glBindBufferBase(buffer_type, 5, materials);
+  create_updated_storage(bvh_nodes, dynamic_bvh_nodes, 8, sections[CACHE_NODES],
+                         sizeof (BVHNode), num_slots * slot_nodes * sizeof (BVHNode));
+  create_storage(bvh_indices, 9, sections[CACHE_INDICES], sizeof (int), streamed_flags,
+                 num_slots * slot_triangles * sizeof (int));
+  create_storage(instance_transforms, 10, sections[CACHE_INSTANCES], sizeof (BVHInstance),
+                 streamed_flags);
+  create_updated_storage(wide_bvh_nodes, dynamic_wide_bvh_nodes, 11, sections[CACHE_WIDE4_NODES],
+                         sizeof (WideBVHNode<4>));
+  create_updated_storage(quantized_bvh_nodes, dynamic_quantized_bvh_nodes, 12,
+                         sections[CACHE_QUANTIZED4_NODES], sizeof (QuantizedBVHNode));
 
   glBindBuffer(buffer_type, 0);
+
+  if (geometry_streamer) {
+    const GeometryStreamer::Pool pool = {
+      bvh_nodes, bvh_indices, triangle_indices, vertices, instance_transforms,
+      node_data.size(), index_data.size(), triangle_data.size(), vertex_data.size(),
+      static_cast<int>(spheres.size() + aabbs.size() + triangle_data.size()),
+    };
+    geometry_streamer->start(pool, std::vector<std::vector<int>>(page_instances));
+  }
+}
+
+void IntersectableManager::set_cache_directory(const std::string& directory)
+{
+  cache_directory = directory;
+}
+
+void IntersectableManager::set_dynamic(bool dynamic)
+{
+  this->dynamic = dynamic;
+}
+
+void IntersectableManager::set_geometry_pages(std::shared_ptr<const GeometryPages> pages,
+                                              size_t num_slots)
+{
+  geometry_streamer = std::make_unique<GeometryStreamer>(std::move(pages), num_slots);
+}
+
+const GeometryStreamer* IntersectableManager::get_geometry_streamer() const
+{
+  return geometry_streamer.get();
+}
+
+void IntersectableManager::begin_frame()
+{
+  if (geometry_streamer) {
+    geometry_streamer->begin_frame();
+  }
+  dynamic_intersectables.begin_frame(intersectable_data.data());
+  dynamic_vertices.begin_frame(vertex_data.data());
+  dynamic_bvh_nodes.begin_frame(node_data.data());
+  dynamic_wide_bvh_nodes.begin_frame(wide4_node_data.data());
+  dynamic_quantized_bvh_nodes.begin_frame(quantized4_node_data.data());
+}
+
+void IntersectableManager::end_frame()
+{
+  dynamic_intersectables.end_frame();
+  dynamic_vertices.end_frame();
+  dynamic_bvh_nodes.end_frame();
+  dynamic_wide_bvh_nodes.end_frame();
+  dynamic_quantized_bvh_nodes.end_frame();
+
+  if (geometry_streamer) {
+    geometry_streamer->end_frame();
+  }
+}
+
+uint64_t IntersectableManager::hash_scene() const
+{
+  // Everything the built buffers depend on: the packed primitives, how they split into types,
+  // meshes and instances, and the build settings
+  const int settings[] = {
+    static_cast<int>(bvh_builder),
+    static_cast<int>(bvh_layout),
+    static_cast<int>(spheres.size()),
+    static_cast<int>(triangles.size()),
+    static_cast<int>(aabbs.size()),
+  };
+
+  uint64_t hash = BVHCache::hash(settings, sizeof (settings));
+  hash = BVHCache::hash(&bvh_max_duplication, sizeof (bvh_max_duplication), hash);
+  hash = BVHCache::hash(intersectable_data.data(), intersectable_data.size() * sizeof (vec4), hash);
+  hash = BVHCache::hash(material_data.data(), material_data.size() * sizeof (vec4), hash);
+  hash = BVHCache::hash(vertex_data.data(), vertex_data.size() * sizeof (vec4), hash);
+  hash = BVHCache::hash(triangle_data.data(), triangle_data.size() * sizeof (ivec3), hash);
+  hash = BVHCache::hash(material_index_data.data(),
+                        material_index_data.size() * sizeof (uint16_t), hash);
+
+  for (const auto& mesh : meshes) {
+    const size_t num_triangles = mesh.triangles.size();
+    hash = BVHCache::hash(&num_triangles, sizeof (num_triangles), hash);
+  }
+
+  // The material of an instance is packed into its BVHInstance, the cached instance section
+  for (size_t i = 0; i < instances.size(); i++) {
+    hash = BVHCache::hash(&instances[i].mesh, sizeof (instances[i].mesh), hash);
+    hash = BVHCache::hash(&instances[i].transform, sizeof (instances[i].transform), hash);
+    hash = BVHCache::hash(&instance_materials[i], sizeof (instance_materials[i]), hash);
+  }
+
+  return hash;
+}
+
+std::vector<BVHCache::Section> IntersectableManager::get_cache_sections() const
+{
+  std::vector<BVHCache::Section> sections(NUM_CACHE_SECTIONS);
+  sections[CACHE_NUM_OBJECTS] = { num_objects.data(), num_objects.size() * sizeof (int) };
+  sections[CACHE_NODES] = { node_data.data(), node_data.size() * sizeof (BVHNode) };
+  sections[CACHE_INDICES] = { index_data.data(), index_data.size() * sizeof (int) };
+  sections[CACHE_INSTANCES] = {
+    instance_data.data(), instance_data.size() * sizeof (BVHInstance)
+  };
+  sections[CACHE_WIDE4_NODES] = {
+    wide4_node_data.data(), wide4_node_data.size() * sizeof (WideBVHNode<4>)
+  };
+  sections[CACHE_QUANTIZED4_NODES] = {
+    quantized4_node_data.data(), quantized4_node_data.size() * sizeof (QuantizedBVHNode)
+  };
+  return sections;
+}
+
+const std::vector<int>& IntersectableManager::get_num_objects() const
+{
+  return num_objects;
+}
+
+const std::vector<vec4>& IntersectableManager::get_intersectable_data() const
+{
+  return intersectable_data;
+}
+
+const std::vector<vec4>& IntersectableManager::get_vertex_data() const
+{
+  return vertex_data;
+}
+
+const std::vector<ivec3>& IntersectableManager::get_triangle_data() const
+{
+  return triangle_data;
+}
+
+const std::vector<uint16_t>& IntersectableManager::get_material_index_data() const
+{
+  return material_index_data;
+}
+
+const std::vector<vec4>& IntersectableManager::get_material_data() const
+{
+  return material_data;
+}
+
+std::string IntersectableManager::get_shader_defines()
+{
+  return "#define BVH_STACK_SIZE " + std::to_string(BVH::STACK_SIZE) + "\n";
+}
+
+const BVH& IntersectableManager::get_bvh() const
+{
+  return bvh;
+}
+
+const std::vector<BVHNode>& IntersectableManager::get_node_data() const
+{
+  return node_data;
+}
+
+const std::vector<int>& IntersectableManager::get_index_data() const
+{
+  return index_data;
+}
+
+const std::vector<BVHInstance>& IntersectableManager::get_instance_data() const
+{
+  return instance_data;
+}
+
+const std::vector<WideBVHNode<4>>& IntersectableManager::get_wide4_node_data() const
+{
+  return wide4_node_data;
+}
+
+const std::vector<WideBVHNode<8>>& IntersectableManager::get_wide8_node_data() const
+{
+  return wide8_node_data;
+}
+
+const std::vector<QuantizedBVHNode>& IntersectableManager::get_quantized4_node_data() const
+{
+  return quantized4_node_data;
+}
+
+int IntersectableManager::get_binary_bvh_root() const
+{
+  return binary_roots.empty() ? -1 : binary_roots.front();
+}
+
+const std::vector<PrimitiveBlock>& IntersectableManager::get_primitive_blocks() const
+{
+  return primitive_blocks;
+}
+
+const std::vector<int>& IntersectableManager::get_block_offsets() const
+{
+  return block_offsets;
+}
+
+namespace {
+  // Rays per task, a few thousand packets
+  constexpr size_t QUERY_GRAIN_SIZE = 4096;
+}
+
+void IntersectableManager::intersect(const RayQuery* rays, size_t num_rays, RayHit* hits) const
+{
+  ensure_queryable();
+  const CPU::SceneData scene = CPU::get_scene_data(*this);
+  CPU::IntersectKernel* kernel = CPU::get_kernels(CPU::get_supported_isa()).intersect;
+
+  ThreadPool::get_global().parallel_for(0, num_rays, QUERY_GRAIN_SIZE,
+                                        [&](size_t begin, size_t end) {
+    kernel(scene, rays + begin, end - begin, hits + begin);
+  });
+}
+
+void IntersectableManager::occluded(const RayQuery* rays, size_t num_rays, bool* occluded) const
+{
+  ensure_queryable();
+  const CPU::SceneData scene = CPU::get_scene_data(*this);
+  CPU::OccludedKernel* kernel = CPU::get_kernels(CPU::get_supported_isa()).occluded;
+
+  ThreadPool::get_global().parallel_for(0, num_rays, QUERY_GRAIN_SIZE,
+                                        [&](size_t begin, size_t end) {
+    kernel(scene, rays + begin, end - begin, occluded + begin);
+  });
+}
+
+void IntersectableManager::ensure_queryable() const
+{
+  const bool has_bvh = !num_objects.empty() && (num_objects[3] >= 0 || num_objects[4] >= 0);
+  if (num_objects.empty() || (has_bvh && node_data.empty())) {
+    throw RenderException("Ray queries need the BVH buffers of pack()");
+  }
 }
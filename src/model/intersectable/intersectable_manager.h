@@ -1,12 +1,22 @@
 #ifndef INTERSECTABLEMANAGER_H
 #define INTERSECTABLEMANAGER_H
 
+#include <cstdint>
+#include <memory>
+#include <string>
 #include <vector>
 #include <glm/glm.hpp>
 
 #include "sphere.h"
 #include "triangle.h"
 #include "aabb.h"
+#include "triangle_mesh.h"
+#include "model/bvh/bvh.h"
+#include "model/bvh/bvh_cache.h"
+#include "model/bvh/primitive_block.h"
+#include "model/bvh/wide_bvh.h"
+#include "model/geometry_streamer.h"
+#include "shader/dynamic_buffer.h"
 
 using namespace glm;
 
@@ -23,16 +33,225 @@ public:
     float ao;
   };
 
+  // Triangles are stored indexed: this one gets three vertices of its own
   void add_triangle(Triangle&& triangle, Material&& material);
   void add_sphere(Sphere&& sphere, Material&& material);
   void add_aabb(AABB&& aabb, Material&& material);
+  // Adds every triangle of a loaded mesh with the material of its group, sharing its vertices
+  void add_triangles(const TriangleMesh& mesh, const std::vector<Material>& materials);
+  void set_bvh_builder(BVH::Builder builder);
+  // Budget for references duplicated by spatial splits, as a fraction of the primitives
+  void set_bvh_max_duplication(float max_duplication);
+  // Layout of the scene and mesh BVHs, the instance BVH is always binary
+  void set_bvh_layout(BVH::Layout layout);
+
+  // Adds a mesh whose triangles and BVH are stored once and shared by all of its instances.
+  // Returns the index to instance it with.
+  int add_mesh(std::vector<Triangle>&& triangles);
+  int add_mesh(const TriangleMesh& mesh);
+  // Places a mesh with an object to world transform, e.g. from Object::get_model_matrix
+  void add_instance(int mesh, const mat4& transform, Material&& material);
+
+  // Move a primitive after finalize, indexed in the order it was added among its type.
+  // Changes take effect on the next refit. A triangle moves its three vertices, and the
+  // triangles of add_triangles that share them are refit with it.
+  void update_triangle(int index, Triangle&& triangle);
+  void update_sphere(int index, Sphere&& sphere);
+  void update_aabb(int index, AABB&& aabb);
+  // Refits the BVH to the updated primitives and uploads only the changed ranges
+  void refit();
+
+  // Packs intersectables and materials into the layout read by raytrace.comp and builds
+  // the BVH over them, without touching any GL state. Also packs the leaf blocks for the CPU.
+  void pack();
+  // Packs and uploads to the GPU. With a cache directory, BVH buffers saved by an earlier run
+  // of the same scene are uploaded instead of building the BVHs, and get_node_data() and the
+  // other BVH buffers stay empty until the next refit.
   void finalize();
+  void set_cache_directory(const std::string& directory);
+  // Set before finalize to edit the scene every frame: the buffers updates write to become
+  // DynamicBuffers, and refit only marks the ranges it changed. begin_frame copies them into a
+  // region the GPU is done with before rendering, and end_frame fences the frame after it.
+  void set_dynamic(bool dynamic);
+  void begin_frame();
+  void end_frame();
+  // Set before finalize to stream meshes from pages instead of add_mesh: add_instance then
+  // indexes the meshes of the pages, and each page of an instance becomes an instance of its own
+  // in the top level BVH. Pages are loaded into num_slots slots on the GPU once rays reach them,
+  // so they appear a few frames late. GPU only, with the binary layout and without dynamic mode.
+  void set_geometry_pages(std::shared_ptr<const GeometryPages> pages, size_t num_slots);
+  // Residency and bandwidth of streamed pages, null without them
+  const GeometryStreamer* get_geometry_streamer() const;
+
+  const std::vector<int>& get_num_objects() const;
+  // Spheres then boxes, intersectable_stride vec4s each
+  const std::vector<vec4>& get_intersectable_data() const;
+  // Vertices of the scene triangles followed by those of each mesh, w unused
+  const std::vector<vec4>& get_vertex_data() const;
+  // Scene triangles followed by mesh triangles, three indices into get_vertex_data() each
+  const std::vector<ivec3>& get_triangle_data() const;
+  // Distinct materials, material_stride vec4s each
+  const std::vector<vec4>& get_material_data() const;
+  // Material of each sphere, box and scene triangle in get_material_data(), padded to an even
+  // count. Mesh triangles take the material of their instance.
+  const std::vector<uint16_t>& get_material_index_data() const;
+  const BVH& get_bvh() const;
+  // Scene, mesh and instance BVHs concatenated as uploaded, with roots in get_num_objects()
+  const std::vector<BVHNode>& get_node_data() const;
+  const std::vector<int>& get_index_data() const;
+  const std::vector<BVHInstance>& get_instance_data() const;
+  // Wide nodes of the scene and mesh BVHs for the wide layouts, indexing the same index data
+  const std::vector<WideBVHNode<4>>& get_wide4_node_data() const;
+  const std::vector<WideBVHNode<8>>& get_wide8_node_data() const;
+  const std::vector<QuantizedBVHNode>& get_quantized4_node_data() const;
+  // Root of the scene BVH in get_node_data(), which holds the binary nodes in every layout
+  int get_binary_bvh_root() const;
+  // Primitives of the scene and mesh BVH leaves in blocks, for the CPU only. See
+  // PrimitiveBlocks::pack for how leaves find their blocks.
+  const std::vector<PrimitiveBlock>& get_primitive_blocks() const;
+  const std::vector<int>& get_block_offsets() const;
+
+  // Ray of a batched query, from origin along a normalized direction up to t_max
+  struct RayQuery {
+    vec3 origin;
+    vec3 direction;
+    float t_max;
+  };
+
+  // Closest hit of a query. primitive counts spheres, boxes and then triangles as in
+  // get_triangle_data(), and is -1 with an infinite distance when nothing was hit. Hits on mesh
+  // instances give the triangle of the mesh and the instance, with the normal in world space.
+  struct RayHit {
+    float distance;
+    int primitive;
+    int instance;
+    vec3 normal;
+  };
+
+  // Queries the packed scene on the CPU, without a GL context, splitting the rays over the
+  // global thread pool and tracing them in SIMD packets with the best kernels the CPU supports.
+  // Consecutive rays should be coherent, such as the rays of neighbouring texels. Needs the BVH
+  // buffers, so after pack() or finalize() without a cache.
+  void intersect(const RayQuery* rays, size_t num_rays, RayHit* hits) const;
+  // Any-hit variant that only tells whether something lies before t_max, stopping at the first
+  // primitive found
+  void occluded(const RayQuery* rays, size_t num_rays, bool* occluded) const;
+
+  static constexpr size_t intersectable_stride = 3;
+  static constexpr size_t material_stride = 3;
+  // Distinct materials a 16 bit index can address, pack() throws beyond this
+  static constexpr size_t max_materials = 1 << 16;
+
+  // Defines raytrace.comp is compiled with, for the constants it shares with the BVHs
+  static std::string get_shader_defines();
 
 private:
-  unsigned int intersectables, num_intersectables, materials;
-  std::vector<std::pair<Triangle, Material>> triangles;
+  struct Mesh {
+    std::vector<vec3> vertices;
+    std::vector<ivec3> triangles;
+    BVH bvh;
+  };
+
+  struct Instance {
+    int mesh;
+    mat4 transform;
+    Material material;
+  };
+
+  // Sections of the BVH cache file, in file order
+  enum CacheSection : size_t {
+    CACHE_NUM_OBJECTS,
+    CACHE_NODES,
+    CACHE_INDICES,
+    CACHE_INSTANCES,
+    CACHE_WIDE4_NODES,
+    CACHE_QUANTIZED4_NODES,
+    NUM_CACHE_SECTIONS,
+  };
+
+  void pack_primitives();
+  void build_bvhs();
+  void ensure_bvhs_built();
+  void ensure_queryable() const;
+  uint64_t hash_scene() const;
+  std::vector<BVHCache::Section> get_cache_sections() const;
+  int append_bvh(const BVH& bvh, int primitive_offset);
+  std::vector<int> pack_wide_nodes();
+  // Refits the wide nodes above the refit binary nodes, returning their indices
+  std::vector<int> refit_wide_nodes(const std::vector<int>& dirty_nodes);
+  void check_stack_size(const std::vector<int>& roots) const;
+  void pack_primitive_blocks();
+  static BVHPrimitive get_instance_primitive(const mat4& transform, const Bounds& object_bounds);
+  static void pack_intersectable(const Sphere& sphere, vec4* data);
+  static void pack_intersectable(const AABB& aabb, vec4* data);
+  template <typename T>
+  void update_intersectable(int index, const T& intersectable);
+  static void upload_ranges(unsigned int buffer, DynamicBuffer& dynamic_buffer,
+                            const std::vector<int>& indices, size_t element_size,
+                            const void* data);
+  static void upload_range(unsigned int buffer, DynamicBuffer& dynamic_buffer, size_t offset,
+                           size_t size, const void* data);
+
+  unsigned int intersectables = 0, num_intersectables = 0, materials = 0;
+  unsigned int bvh_nodes = 0, bvh_indices = 0, instance_transforms = 0, wide_bvh_nodes = 0;
+  unsigned int quantized_bvh_nodes = 0, vertices = 0, triangle_indices = 0;
+  unsigned int material_indices = 0;
+  // Indexed triangles, w is the material in triangle_materials
+  std::vector<vec3> triangle_vertices;
+  std::vector<ivec4> triangles;
+  std::vector<Material> triangle_materials;
   std::vector<std::pair<Sphere, Material>> spheres;
   std::vector<std::pair<AABB, Material>> aabbs;
+  std::vector<Mesh> meshes;
+  std::vector<Instance> instances;
+
+  std::vector<int> num_objects;
+  std::vector<vec4> intersectable_data;
+  std::vector<vec4> vertex_data;
+  std::vector<ivec3> triangle_data;
+  std::vector<vec4> material_data;
+  std::vector<uint16_t> material_index_data;
+  // Index in material_data of each instance
+  std::vector<int> instance_materials;
+  // Scene triangles using each vertex of triangle_vertices, from vertex_triangle_offsets[v] to
+  // vertex_triangle_offsets[v + 1]
+  std::vector<int> vertex_triangle_offsets;
+  std::vector<int> vertex_triangles;
+  BVH bvh;
+  BVH tlas;
+  std::vector<BVHNode> node_data;
+  std::vector<int> index_data;
+  std::vector<BVHInstance> instance_data;
+  std::vector<WideBVHNode<4>> wide4_node_data;
+  std::vector<WideBVHNode<8>> wide8_node_data;
+  std::vector<QuantizedBVHNode> quantized4_node_data;
+  std::vector<PrimitiveBlock> primitive_blocks;
+  std::vector<int> block_offsets;
+  // Binary roots of the scene BVH followed by each mesh BVH
+  std::vector<int> binary_roots;
+  // Binary node of each wide node slot as in WideBVH::collapse, and the wide node holding
+  // each binary node of node_data, -1 for none
+  std::vector<int> wide_sources;
+  std::vector<int> wide_parents;
+  BVH::Builder bvh_builder = BVH::Builder::BinnedSAH;
+  float bvh_max_duplication = BVH::DEFAULT_MAX_DUPLICATION;
+  BVH::Layout bvh_layout = BVH::Layout::Binary;
+  std::string cache_directory;
+  bool dynamic = false;
+  // Used instead of the static buffers of the same names in dynamic mode
+  DynamicBuffer dynamic_intersectables;
+  DynamicBuffer dynamic_vertices;
+  DynamicBuffer dynamic_bvh_nodes;
+  DynamicBuffer dynamic_wide_bvh_nodes;
+  DynamicBuffer dynamic_quantized_bvh_nodes;
+  bool bvhs_built = false;
+  // Primitives the leaves of the scene and mesh BVHs are costed in, blocks on the CPU
+  int leaf_block_size = 1;
+  std::vector<int> dirty_intersectables;
+  std::vector<int> dirty_vertices;
+  std::unique_ptr<GeometryStreamer> geometry_streamer;
+  // Entries of instance_data for each page, whose roots the streamer sets
+  std::vector<std::vector<int>> page_instances;
 };
 
 #endif // INTERSECTABLEMANAGER_H
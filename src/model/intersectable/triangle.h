@@ -12,7 +12,7 @@ public:
   vec3 get_center() const override;
   vec2 get_bounds(Axis axis) const override;
 
-  vec3 vertices[4];
+  vec3 vertices[3];
 };
 
 #endif // TRIANGLE_H
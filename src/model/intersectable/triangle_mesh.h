@@ -0,0 +1,27 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+using namespace glm;
+
+// Indexed triangles as loaded from a mesh file. Each triangle belongs to a group, named after
+// its material in the file, or to a single group for files without materials.
+struct TriangleMesh {
+  std::vector<vec3> positions;
+  // Three positions per triangle
+  std::vector<int> indices;
+  // Group of each triangle, indexing group_names
+  std::vector<int> groups;
+  std::vector<std::string> group_names;
+  // Material libraries named by an OBJ file, relative to it
+  std::vector<std::string> material_libraries;
+
+  size_t get_num_triangles() const {
+    return indices.size() / 3;
+  }
+};
+
+#endif // TRIANGLE_MESH_H
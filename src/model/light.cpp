@@ -5,14 +5,14 @@
 
 Light::Light()
 {
-  glGenBuffers(1, &lights);
-  glGenBuffers(1, &num_lights);
 }
 
 Light::~Light()
 {
-  glDeleteBuffers(1, &lights);
-  glDeleteBuffers(1, &num_lights);
+  if (lights) {
+    glDeleteBuffers(1, &lights);
+    glDeleteBuffers(1, &num_lights);
+  }
 }
 
 void Light::add_point_light(PointLight &&light)
@@ -20,30 +20,87 @@ void Light::add_point_light(PointLight &&light)
   point_lights.emplace_back(std::move(light));
 }
 
-void Light::finalize()
+void Light::update_point_light(int index, PointLight&& light)
 {
-  int num_point_lights = static_cast<int>(point_lights.size());
-  glBindBuffer(GL_UNIFORM_BUFFER, num_lights);
-  glBufferData(GL_UNIFORM_BUFFER, sizeof (int), &num_point_lights, GL_STATIC_DRAW);
-  glBindBufferBase(GL_UNIFORM_BUFFER, 6, num_lights);
+  point_lights[static_cast<size_t>(index)] = std::move(light);
+  if (light_data.empty()) {
+    return;
+  }
 
-  constexpr unsigned int light_stride = 2;
+  const size_t offset = static_cast<size_t>(index) * light_stride;
+  light_data[offset] = vec4(point_lights[static_cast<size_t>(index)].position, 0.0);
+  light_data[offset + 1] = vec4(point_lights[static_cast<size_t>(index)].color, 0.0);
+
+  const size_t size = light_stride * sizeof (vec4);
+  if (dynamic_lights.is_created()) {
+    dynamic_lights.mark_dirty(offset * sizeof (vec4), size);
+  } else if (lights) {
+    glNamedBufferSubData(lights, static_cast<long>(offset * sizeof (vec4)),
+                         static_cast<long>(size), &light_data[offset]);
+  }
+}
 
-  std::vector<vec4> light_data;
+void Light::pack()
+{
+  light_data.clear();
   light_data.reserve(point_lights.size() * light_stride);
 
   for (const auto& light : point_lights) {
     light_data.emplace_back(vec4(light.position, 0.0));
     light_data.emplace_back(vec4(light.color, 0.0));
   }
+}
+
+void Light::finalize()
+{
+  pack();
+
+  glGenBuffers(1, &lights);
+  glGenBuffers(1, &num_lights);
+
+  int num_point_lights = get_num_point_lights();
+  glBindBuffer(GL_UNIFORM_BUFFER, num_lights);
+  glBufferData(GL_UNIFORM_BUFFER, sizeof (int), &num_point_lights, GL_STATIC_DRAW);
+  glBindBufferBase(GL_UNIFORM_BUFFER, 6, num_lights);
 
   constexpr GLenum buffer_type = GL_SHADER_STORAGE_BUFFER;
 
+  if (dynamic) {
+    dynamic_lights.create(7, light_data.data(), light_data.size() * sizeof (vec4),
+                          light_stride * sizeof (vec4));
+    return;
+  }
+
   glBindBuffer(buffer_type, lights);
   glBufferStorage(buffer_type,
-                  static_cast<long>(point_lights.size() * light_stride * sizeof (vec4)),
-                  light_data.data(), 0);
+                  static_cast<long>(light_data.size() * sizeof (vec4)),
+                  light_data.data(), GL_DYNAMIC_STORAGE_BIT);
   glBindBufferBase(buffer_type, 7, lights);
 
   glBindBuffer(buffer_type, 0);
 }
+
+void Light::set_dynamic(bool dynamic)
+{
+  this->dynamic = dynamic;
+}
+
+void Light::begin_frame()
+{
+  dynamic_lights.begin_frame(light_data.data());
+}
+
+void Light::end_frame()
+{
+  dynamic_lights.end_frame();
+}
+
+int Light::get_num_point_lights() const
+{
+  return static_cast<int>(point_lights.size());
+}
+
+const std::vector<vec4>& Light::get_light_data() const
+{
+  return light_data;
+}
@@ -1,6 +1,8 @@
 #ifndef LIGHT_H
 #define LIGHT_H
 
+#include "shader/dynamic_buffer.h"
+
 #include <vector>
 #include <glm/glm.hpp>
 
@@ -18,11 +20,28 @@ public:
   };
 
   void add_point_light(PointLight&& light);
+  // Moves or recolours a light, uploading only its record once finalized
+  void update_point_light(int index, PointLight&& light);
+  // Packs lights into the layout read by raytrace.comp, without touching any GL state
+  void pack();
+  // Packs and uploads to the GPU
   void finalize();
+  // Set before finalize to update lights every frame, as in IntersectableManager::set_dynamic
+  void set_dynamic(bool dynamic);
+  void begin_frame();
+  void end_frame();
+
+  int get_num_point_lights() const;
+  const std::vector<vec4>& get_light_data() const;
+
+  static constexpr unsigned int light_stride = 2;
 
 private:
-  unsigned int lights, num_lights;
+  unsigned int lights = 0, num_lights = 0;
   std::vector<PointLight> point_lights;
+  std::vector<vec4> light_data;
+  bool dynamic = false;
+  DynamicBuffer dynamic_lights;
 };
 
 #endif // LIGHT_H
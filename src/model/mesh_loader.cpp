@@ -0,0 +1,742 @@
+#include "mesh_loader.h"
+#include "util/exception.h"
+#include "util/logging.h"
+#include "util/mapped_file.h"
+#include "util/thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+
+namespace {
+  using namespace std::chrono;
+
+  // Text files are split into chunks of about this size, each parsed by one task
+  constexpr size_t CHUNK_SIZE = 4 << 20;
+  // Faces of a PLY file per task
+  constexpr size_t FACES_PER_TASK = 1 << 16;
+
+  const std::string DEFAULT_GROUP = "default";
+
+  bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+  }
+
+  bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+  }
+
+  const char* skip_space(const char* p, const char* end) {
+    while (p < end && is_space(*p)) {
+      p++;
+    }
+    return p;
+  }
+
+  const char* skip_word(const char* p, const char* end) {
+    while (p < end && !is_space(*p)) {
+      p++;
+    }
+    return p;
+  }
+
+  // Whether the line at p starts with keyword followed by a space
+  bool starts_with(const char* p, const char* end, std::string_view keyword) {
+    return static_cast<size_t>(end - p) > keyword.size() &&
+           std::memcmp(p, keyword.data(), keyword.size()) == 0 && is_space(p[keyword.size()]);
+  }
+
+  // Rest of a line without the surrounding spaces
+  std::string get_rest(const char* p, const char* end) {
+    p = skip_space(p, end);
+    while (end > p && is_space(end[-1])) {
+      end--;
+    }
+    return std::string(p, end);
+  }
+
+  const char* parse_int(const char* p, const char* end, long& value) {
+    const bool negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) {
+      p++;
+    }
+
+    value = 0;
+    while (p < end && is_digit(*p)) {
+      value = value * 10 + (*p - '0');
+      p++;
+    }
+
+    value = negative ? -value : value;
+    return p;
+  }
+
+  // Decimal floats with an optional exponent, which covers what exporters write. Much faster
+  // than strtof, which also needs the null terminator a mapped file lacks.
+  const char* parse_float(const char* p, const char* end, float& value) {
+    static constexpr double POWERS_OF_TEN[] = {
+      1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+    };
+    constexpr int MAX_POWER = 22;
+
+    const bool negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) {
+      p++;
+    }
+
+    double mantissa = 0.0;
+    long exponent = 0;
+    while (p < end && is_digit(*p)) {
+      mantissa = mantissa * 10.0 + (*p - '0');
+      p++;
+    }
+
+    if (p < end && *p == '.') {
+      p++;
+      while (p < end && is_digit(*p)) {
+        mantissa = mantissa * 10.0 + (*p - '0');
+        exponent--;
+        p++;
+      }
+    }
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+      long written_exponent;
+      p = parse_int(p + 1, end, written_exponent);
+      exponent += written_exponent;
+    }
+
+    if (exponent >= -MAX_POWER && exponent <= MAX_POWER) {
+      mantissa = exponent < 0 ? mantissa / POWERS_OF_TEN[-exponent]
+                              : mantissa * POWERS_OF_TEN[exponent];
+    } else {
+      mantissa *= std::pow(10.0, static_cast<double>(exponent));
+    }
+
+    value = static_cast<float>(negative ? -mantissa : mantissa);
+    return p;
+  }
+
+  // Splits [data, data + size) into chunks of about chunk_size that end after a newline
+  std::vector<std::pair<const char*, const char*>> split_lines(const char* data, size_t size,
+                                                                size_t chunk_size) {
+    std::vector<std::pair<const char*, const char*>> chunks;
+    const char* end = data + size;
+    const char* begin = data;
+
+    while (begin < end) {
+      const char* chunk_end = begin + std::min(chunk_size, static_cast<size_t>(end - begin));
+      const void* newline = chunk_end < end ? std::memchr(chunk_end, '\n', end - chunk_end)
+                                            : nullptr;
+      chunk_end = newline ? static_cast<const char*>(newline) + 1 : end;
+      chunks.emplace_back(begin, chunk_end);
+      begin = chunk_end;
+    }
+
+    return chunks;
+  }
+
+  // What one task parsed of an OBJ file. Negative OBJ indices count back from the last
+  // position, so until the positions before the chunk are counted they are stored relative to
+  // its first position and listed in relative_indices.
+  struct ObjChunk {
+    std::vector<vec3> positions;
+    std::vector<int> indices;
+    std::vector<size_t> relative_indices;
+    // Triangle of the chunk from which each usemtl applies, and the material it names
+    std::vector<std::pair<size_t, std::string>> materials;
+    std::vector<std::string> material_libraries;
+    // Line that could not be parsed, if any
+    std::string error;
+  };
+
+  void parse_obj_chunk(const char* p, const char* end, ObjChunk& chunk) {
+    // Vertices of the current face, and whether each is relative
+    std::vector<std::pair<int, bool>> face;
+
+    while (p < end) {
+      const void* newline = std::memchr(p, '\n', static_cast<size_t>(end - p));
+      const char* line_end = newline ? static_cast<const char*>(newline) : end;
+      p = skip_space(p, line_end);
+
+      if (starts_with(p, line_end, "v")) {
+        vec3 position;
+        const char* q = p + 1;
+        for (int axis = 0; axis < 3; axis++) {
+          q = parse_float(skip_space(q, line_end), line_end, position[axis]);
+        }
+        chunk.positions.push_back(position);
+      } else if (starts_with(p, line_end, "f")) {
+        face.clear();
+        const char* q = skip_space(p + 1, line_end);
+
+        while (q < line_end) {
+          long index;
+          const char* index_end = parse_int(q, line_end, index);
+
+          if (index_end == q || index == 0) {
+            chunk.error = get_rest(p, line_end);
+            return;
+          }
+
+          // Positions are counted from 1, and backwards from the last one when negative
+          if (index > 0) {
+            face.emplace_back(static_cast<int>(index - 1), false);
+          } else {
+            face.emplace_back(static_cast<int>(chunk.positions.size() + index), true);
+          }
+
+          // Texture coordinate and normal indices follow after slashes
+          q = skip_space(skip_word(index_end, line_end), line_end);
+        }
+
+        for (size_t i = 2; i < face.size(); i++) {
+          for (const auto& [index, relative] : { face[0], face[i - 1], face[i] }) {
+            if (relative) {
+              chunk.relative_indices.push_back(chunk.indices.size());
+            }
+            chunk.indices.push_back(index);
+          }
+        }
+      } else if (starts_with(p, line_end, "usemtl")) {
+        chunk.materials.emplace_back(chunk.indices.size() / 3, get_rest(p + 6, line_end));
+      } else if (starts_with(p, line_end, "mtllib")) {
+        chunk.material_libraries.push_back(get_rest(p + 6, line_end));
+      }
+
+      p = line_end + 1;
+    }
+  }
+
+  // Scalar types of PLY properties
+  enum class PlyType {
+    Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64,
+  };
+
+  struct PlyProperty {
+    std::string name;
+    PlyType type;
+    // Lists store a count of count_type, then that many values of type
+    bool is_list;
+    PlyType count_type;
+  };
+
+  struct PlyElement {
+    std::string name;
+    size_t count;
+    std::vector<PlyProperty> properties;
+  };
+
+  PlyType get_ply_type(const std::string& name) {
+    static const std::unordered_map<std::string, PlyType> TYPES = {
+      { "char", PlyType::Int8 }, { "int8", PlyType::Int8 },
+      { "uchar", PlyType::UInt8 }, { "uint8", PlyType::UInt8 },
+      { "short", PlyType::Int16 }, { "int16", PlyType::Int16 },
+      { "ushort", PlyType::UInt16 }, { "uint16", PlyType::UInt16 },
+      { "int", PlyType::Int32 }, { "int32", PlyType::Int32 },
+      { "uint", PlyType::UInt32 }, { "uint32", PlyType::UInt32 },
+      { "float", PlyType::Float32 }, { "float32", PlyType::Float32 },
+      { "double", PlyType::Float64 }, { "float64", PlyType::Float64 },
+    };
+
+    auto type = TYPES.find(name);
+    if (type == TYPES.end()) {
+      throw LoaderException("Unknown PLY property type " + name);
+    }
+    return type->second;
+  }
+
+  size_t get_size(PlyType type) {
+    switch (type) {
+      case PlyType::Int8:
+      case PlyType::UInt8:
+        return 1;
+      case PlyType::Int16:
+      case PlyType::UInt16:
+        return 2;
+      case PlyType::Int32:
+      case PlyType::UInt32:
+      case PlyType::Float32:
+        return 4;
+      case PlyType::Float64:
+        return 8;
+    }
+    return 0;
+  }
+
+  // Copies a value of size bytes, reversing it when the file has the other endianness
+  template <typename T>
+  T read_raw(const char* p, bool swap) {
+    char bytes[sizeof (T)];
+    std::memcpy(bytes, p, sizeof (T));
+    if (swap) {
+      std::reverse(bytes, bytes + sizeof (T));
+    }
+
+    T value;
+    std::memcpy(&value, bytes, sizeof (T));
+    return value;
+  }
+
+  double read_value(const char* p, PlyType type, bool swap) {
+    switch (type) {
+      case PlyType::Int8:
+        return read_raw<int8_t>(p, swap);
+      case PlyType::UInt8:
+        return read_raw<uint8_t>(p, swap);
+      case PlyType::Int16:
+        return read_raw<int16_t>(p, swap);
+      case PlyType::UInt16:
+        return read_raw<uint16_t>(p, swap);
+      case PlyType::Int32:
+        return read_raw<int32_t>(p, swap);
+      case PlyType::UInt32:
+        return read_raw<uint32_t>(p, swap);
+      case PlyType::Float32:
+        return read_raw<float>(p, swap);
+      case PlyType::Float64:
+        return read_raw<double>(p, swap);
+    }
+    return 0.0;
+  }
+
+  // Size of the record of an element at p, which only needs reading for lists
+  size_t get_record_size(const PlyElement& element, const char* p, bool swap) {
+    size_t size = 0;
+    for (const PlyProperty& property : element.properties) {
+      if (property.is_list) {
+        const size_t count = static_cast<size_t>(read_value(p + size, property.count_type, swap));
+        size += get_size(property.count_type) + count * get_size(property.type);
+      } else {
+        size += get_size(property.type);
+      }
+    }
+    return size;
+  }
+
+  // Size of the record when it has no lists, or 0
+  size_t get_fixed_record_size(const PlyElement& element) {
+    size_t size = 0;
+    for (const PlyProperty& property : element.properties) {
+      if (property.is_list) {
+        return 0;
+      }
+      size += get_size(property.type);
+    }
+    return size;
+  }
+
+  std::string get_extension(const std::string& path) {
+    const size_t dot = path.find_last_of('.');
+    std::string extension = dot == std::string::npos ? "" : path.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return extension;
+  }
+
+  std::string get_directory(const std::string& path) {
+    const size_t slash = path.find_last_of('/');
+    return slash == std::string::npos ? "" : path.substr(0, slash + 1);
+  }
+
+  void log_load(const std::string& path, const TriangleMesh& mesh, size_t size,
+                steady_clock::time_point start) {
+    const double seconds = duration_cast<duration<double>>(steady_clock::now() - start).count();
+    Logging::get_logger() << "Loaded " << path << ": " << mesh.positions.size() << " positions, "
+                          << mesh.get_num_triangles() << " triangles in " << seconds * 1e3
+                          << " ms, " << static_cast<double>(size) / seconds / (1 << 20)
+                          << " MB/s" << std::endl;
+  }
+}
+
+TriangleMesh MeshLoader::load(const std::string& path)
+{
+  const std::string extension = get_extension(path);
+  TriangleMesh mesh;
+
+  if (extension == "obj") {
+    mesh = load_obj(path);
+  } else if (extension == "ply") {
+    mesh = load_ply(path);
+  } else {
+    throw LoaderException("Unknown mesh format " + path);
+  }
+
+  if (!mesh.get_num_triangles()) {
+    throw LoaderException("No triangles in " + path);
+  }
+  return mesh;
+}
+
+TriangleMesh MeshLoader::load_obj(const std::string& path)
+{
+  const auto start = steady_clock::now();
+  const MappedFile file(path);
+  ThreadPool& pool = ThreadPool::get_global();
+
+  const auto ranges = split_lines(file.get_data(), file.get_size(), CHUNK_SIZE);
+  std::vector<ObjChunk> chunks(ranges.size());
+
+  pool.parallel_for(0, chunks.size(), 1, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      parse_obj_chunk(ranges[i].first, ranges[i].second, chunks[i]);
+    }
+  });
+
+  // First positions and triangles of each chunk in the whole mesh
+  std::vector<size_t> position_offsets(chunks.size() + 1, 0);
+  std::vector<size_t> triangle_offsets(chunks.size() + 1, 0);
+  TriangleMesh mesh;
+
+  for (size_t i = 0; i < chunks.size(); i++) {
+    if (!chunks[i].error.empty()) {
+      throw LoaderException("Malformed face in " + path + ": " + chunks[i].error);
+    }
+
+    position_offsets[i + 1] = position_offsets[i] + chunks[i].positions.size();
+    triangle_offsets[i + 1] = triangle_offsets[i] + chunks[i].indices.size() / 3;
+    mesh.material_libraries.insert(mesh.material_libraries.end(),
+                                   chunks[i].material_libraries.begin(),
+                                   chunks[i].material_libraries.end());
+  }
+
+  // Groups in order of their first usemtl. A chunk starts in the group the previous one ended in.
+  std::unordered_map<std::string, int> group_indices;
+  std::vector<int> first_groups(chunks.size());
+  std::vector<std::vector<std::pair<size_t, int>>> group_starts(chunks.size());
+  int group = -1;
+
+  const auto get_group = [&](const std::string& name) {
+    auto [entry, inserted] = group_indices.emplace(name, static_cast<int>(group_indices.size()));
+    if (inserted) {
+      mesh.group_names.push_back(name);
+    }
+    return entry->second;
+  };
+
+  for (size_t i = 0; i < chunks.size(); i++) {
+    // Triangles before the first usemtl of the file go to the default group
+    if (group < 0 && (chunks[i].materials.empty() ? !chunks[i].indices.empty()
+                                                  : chunks[i].materials.front().first > 0)) {
+      group = get_group(DEFAULT_GROUP);
+    }
+
+    first_groups[i] = group;
+    for (const auto& [triangle, name] : chunks[i].materials) {
+      group = get_group(name);
+      group_starts[i].emplace_back(triangle, group);
+    }
+  }
+
+  const size_t num_positions = position_offsets.back();
+  mesh.positions.resize(num_positions);
+  mesh.indices.resize(triangle_offsets.back() * 3);
+  mesh.groups.resize(triangle_offsets.back());
+  std::vector<char> out_of_range(chunks.size(), false);
+
+  pool.parallel_for(0, chunks.size(), 1, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+      ObjChunk& chunk = chunks[i];
+      const int position_offset = static_cast<int>(position_offsets[i]);
+
+      for (size_t relative_index : chunk.relative_indices) {
+        chunk.indices[relative_index] += position_offset;
+      }
+      out_of_range[i] = std::any_of(chunk.indices.begin(), chunk.indices.end(), [&](int index) {
+        return index < 0 || static_cast<size_t>(index) >= num_positions;
+      });
+
+      std::copy(chunk.positions.begin(), chunk.positions.end(),
+                mesh.positions.begin() + static_cast<long>(position_offsets[i]));
+      std::copy(chunk.indices.begin(), chunk.indices.end(),
+                mesh.indices.begin() + static_cast<long>(triangle_offsets[i] * 3));
+
+      auto groups = mesh.groups.begin() + static_cast<long>(triangle_offsets[i]);
+      size_t triangle = 0;
+      int chunk_group = first_groups[i];
+      for (const auto& [start, next_group] : group_starts[i]) {
+        std::fill(groups + static_cast<long>(triangle), groups + static_cast<long>(start),
+                  chunk_group);
+        triangle = start;
+        chunk_group = next_group;
+      }
+      std::fill(groups + static_cast<long>(triangle),
+                groups + static_cast<long>(chunk.indices.size() / 3), chunk_group);
+
+      chunk = ObjChunk();
+    }
+  });
+
+  if (std::find(out_of_range.begin(), out_of_range.end(), true) != out_of_range.end()) {
+    throw LoaderException("Face index out of range in " + path);
+  }
+
+  if (mesh.group_names.empty()) {
+    mesh.group_names.push_back(DEFAULT_GROUP);
+  }
+
+  log_load(path, mesh, file.get_size(), start);
+  return mesh;
+}
+
+TriangleMesh MeshLoader::load_ply(const std::string& path)
+{
+  const auto start = steady_clock::now();
+  const MappedFile file(path);
+  ThreadPool& pool = ThreadPool::get_global();
+
+  const char* data = file.get_data();
+  const char* const end = data + file.get_size();
+  const char* p = data;
+
+  // The header is text, one statement per line, up to end_header
+  const auto next_line = [&]() {
+    const void* newline = std::memchr(p, '\n', static_cast<size_t>(end - p));
+    if (!newline) {
+      throw LoaderException("Truncated PLY header in " + path);
+    }
+    std::string line(p, static_cast<const char*>(newline));
+    p = static_cast<const char*>(newline) + 1;
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    return line;
+  };
+
+  if (file.get_size() < 4 || next_line() != "ply") {
+    throw LoaderException("Not a PLY file " + path);
+  }
+
+  bool swap = false;
+  std::vector<PlyElement> elements;
+
+  for (std::string line = next_line(); line != "end_header"; line = next_line()) {
+    std::vector<std::string> words;
+    for (size_t begin = 0, word_end; begin < line.size(); begin = word_end + 1) {
+      word_end = std::min(line.find(' ', begin), line.size());
+      if (word_end > begin) {
+        words.push_back(line.substr(begin, word_end - begin));
+      }
+    }
+
+    if (words.empty() || words[0] == "comment" || words[0] == "obj_info") {
+      continue;
+    }
+
+    if (words[0] == "format" && words.size() > 1) {
+      // Files are little endian wherever this runs
+      if (words[1] == "binary_little_endian") {
+        swap = false;
+      } else if (words[1] == "binary_big_endian") {
+        swap = true;
+      } else {
+        throw LoaderException("Only binary PLY files are supported, " + path + " is " + words[1]);
+      }
+    } else if (words[0] == "element" && words.size() == 3) {
+      elements.push_back({ words[1], std::stoul(words[2]), {} });
+    } else if (words[0] == "property" && !elements.empty() && words.size() == 3) {
+      elements.back().properties.push_back({ words[2], get_ply_type(words[1]), false,
+                                             PlyType::UInt8 });
+    } else if (words[0] == "property" && !elements.empty() && words.size() == 5 &&
+               words[1] == "list") {
+      elements.back().properties.push_back({ words[4], get_ply_type(words[3]), true,
+                                             get_ply_type(words[2]) });
+    } else {
+      throw LoaderException("Unsupported PLY header line in " + path + ": " + line);
+    }
+  }
+
+  TriangleMesh mesh;
+  mesh.group_names.push_back(DEFAULT_GROUP);
+
+  for (const PlyElement& element : elements) {
+    const size_t fixed_size = get_fixed_record_size(element);
+
+    if (element.name == "vertex") {
+      if (!fixed_size) {
+        throw LoaderException("PLY vertices with lists are not supported in " + path);
+      }
+      if (static_cast<size_t>(end - p) < element.count * fixed_size) {
+        throw LoaderException("Truncated PLY vertices in " + path);
+      }
+
+      // Offset and type of x, y and z in a vertex record
+      size_t offsets[3];
+      PlyType types[3];
+      int num_found = 0;
+      size_t offset = 0;
+      for (const PlyProperty& property : element.properties) {
+        const int axis = property.name == "x" ? 0 : property.name == "y" ? 1
+                       : property.name == "z" ? 2 : -1;
+        if (axis >= 0) {
+          offsets[axis] = offset;
+          types[axis] = property.type;
+          num_found++;
+        }
+        offset += get_size(property.type);
+      }
+      if (num_found != 3) {
+        throw LoaderException("PLY vertices without x, y and z in " + path);
+      }
+
+      mesh.positions.resize(element.count);
+      const char* vertices = p;
+      pool.parallel_for(0, element.count, FACES_PER_TASK, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+          const char* record = vertices + i * fixed_size;
+          for (int axis = 0; axis < 3; axis++) {
+            mesh.positions[i][axis] = static_cast<float>(read_value(record + offsets[axis],
+                                                                    types[axis], swap));
+          }
+        }
+      });
+
+      p += element.count * fixed_size;
+    } else if (element.name == "face") {
+      // Offset of the vertex index list in a face record, after any scalar properties
+      const PlyProperty* indices = nullptr;
+      size_t list_offset = 0;
+      for (const PlyProperty& property : element.properties) {
+        if (property.is_list && (property.name == "vertex_indices" ||
+                                 property.name == "vertex_index")) {
+          indices = &property;
+          break;
+        }
+        list_offset += property.is_list ? 0 : get_size(property.type);
+      }
+      if (!indices || element.properties.back().is_list != (indices == &element.properties.back())
+          || std::count_if(element.properties.begin(), element.properties.end(),
+                           [](const PlyProperty& property) { return property.is_list; }) > 1) {
+        throw LoaderException("PLY faces need vertex_indices as their only list in " + path);
+      }
+
+      // First record and triangle of each block of faces. The records only vary in size
+      // through the index count, so the blocks are found by hopping from count to count.
+      const size_t num_blocks = (element.count + FACES_PER_TASK - 1) / FACES_PER_TASK;
+      std::vector<const char*> block_starts(num_blocks + 1);
+      std::vector<size_t> block_triangles(num_blocks + 1, 0);
+      const char* record = p;
+
+      for (size_t i = 0; i < element.count; i++) {
+        if (i % FACES_PER_TASK == 0) {
+          block_starts[i / FACES_PER_TASK] = record;
+          block_triangles[i / FACES_PER_TASK + 1] = block_triangles[i / FACES_PER_TASK];
+        }
+        if (static_cast<size_t>(end - record) < list_offset + get_size(indices->count_type)) {
+          throw LoaderException("Truncated PLY faces in " + path);
+        }
+
+        const size_t count = static_cast<size_t>(read_value(record + list_offset,
+                                                            indices->count_type, swap));
+        block_triangles[i / FACES_PER_TASK + 1] += count > 2 ? count - 2 : 0;
+        record += get_record_size(element, record, swap);
+      }
+      if (record > end) {
+        throw LoaderException("Truncated PLY faces in " + path);
+      }
+      block_starts[num_blocks] = record;
+
+      mesh.indices.resize(block_triangles[num_blocks] * 3);
+      mesh.groups.assign(block_triangles[num_blocks], 0);
+      std::vector<char> out_of_range(num_blocks, false);
+
+      pool.parallel_for(0, num_blocks, 1, [&](size_t begin, size_t end) {
+        for (size_t block = begin; block < end; block++) {
+          const char* face = block_starts[block];
+          int* out = &mesh.indices[block_triangles[block] * 3];
+          const size_t index_size = get_size(indices->type);
+
+          while (face < block_starts[block + 1]) {
+            const char* list = face + list_offset;
+            const size_t count = static_cast<size_t>(read_value(list, indices->count_type,
+                                                                swap));
+            const char* values = list + get_size(indices->count_type);
+            const auto get_index = [&](size_t i) {
+              const double index = read_value(values + i * index_size, indices->type, swap);
+              out_of_range[block] |= index < 0.0 ||
+                                     index >= static_cast<double>(mesh.positions.size());
+              return static_cast<int>(index);
+            };
+
+            const int first = count > 2 ? get_index(0) : 0;
+            for (size_t i = 2; i < count; i++) {
+              *out++ = first;
+              *out++ = get_index(i - 1);
+              *out++ = get_index(i);
+            }
+
+            face += get_record_size(element, face, swap);
+          }
+        }
+      });
+
+      if (std::find(out_of_range.begin(), out_of_range.end(), true) != out_of_range.end()) {
+        throw LoaderException("Face index out of range in " + path);
+      }
+
+      p = record;
+    } else {
+      // Other elements are skipped, record by record when they hold lists
+      const size_t fixed_size = get_fixed_record_size(element);
+      for (size_t i = 0; i < element.count && p <= end; i++) {
+        p += fixed_size ? fixed_size : get_record_size(element, p, swap);
+      }
+      if (p > end) {
+        throw LoaderException("Truncated PLY element " + element.name + " in " + path);
+      }
+    }
+  }
+
+  log_load(path, mesh, file.get_size(), start);
+  return mesh;
+}
+
+std::vector<IntersectableManager::Material> MeshLoader::load_materials(
+  const std::string& path, const TriangleMesh& mesh,
+  const IntersectableManager::Material& default_material)
+{
+  std::unordered_map<std::string, IntersectableManager::Material> library;
+
+  for (const std::string& library_path : mesh.material_libraries) {
+    std::ifstream file(get_directory(path) + library_path);
+    if (!file.is_open()) {
+      Logging::get_logger() << "Cannot open material library " << library_path << std::endl;
+      continue;
+    }
+
+    IntersectableManager::Material* material = nullptr;
+    std::string line;
+
+    while (std::getline(file, line)) {
+      const char* p = skip_space(line.data(), line.data() + line.size());
+      const char* line_end = line.data() + line.size();
+
+      if (starts_with(p, line_end, "newmtl")) {
+        material = &library.insert_or_assign(get_rest(p + 6, line_end),
+                                             default_material).first->second;
+      } else if (material && starts_with(p, line_end, "Kd")) {
+        p += 2;
+        for (int i = 0; i < 3; i++) {
+          p = parse_float(skip_space(p, line_end), line_end, material->albedo[i]);
+        }
+      } else if (material && starts_with(p, line_end, "Pm")) {
+        parse_float(skip_space(p + 2, line_end), line_end, material->metallic);
+      } else if (material && starts_with(p, line_end, "Pr")) {
+        parse_float(skip_space(p + 2, line_end), line_end, material->roughness);
+      }
+    }
+  }
+
+  std::vector<IntersectableManager::Material> materials;
+  materials.reserve(mesh.group_names.size());
+  for (const std::string& name : mesh.group_names) {
+    auto material = library.find(name);
+    materials.push_back(material == library.end() ? default_material : material->second);
+  }
+
+  return materials;
+}
@@ -0,0 +1,35 @@
+#ifndef MESH_LOADER_H
+#define MESH_LOADER_H
+
+#include "model/intersectable/intersectable_manager.h"
+#include "model/intersectable/triangle_mesh.h"
+
+#include <string>
+#include <vector>
+
+// Loads triangle meshes from files. The file is memory mapped and split into chunks that are
+// parsed in parallel on the global thread pool. Throws LoaderException for files that cannot be
+// read or parsed.
+class MeshLoader
+{
+public:
+  MeshLoader() = delete;
+
+  // Picks the format by the extension, .obj or .ply, and rejects meshes without triangles
+  static TriangleMesh load(const std::string& path);
+  // Wavefront OBJ positions and faces, triangulated as fans and grouped by usemtl. Texture
+  // coordinates, normals and other statements are skipped.
+  static TriangleMesh load_obj(const std::string& path);
+  // Binary PLY of either endianness, with the x, y, z of each vertex and the vertex_indices of
+  // each face. Faces are triangulated as fans and form a single group.
+  static TriangleMesh load_ply(const std::string& path);
+
+  // Material of each group of a mesh loaded from path, read from the MTL libraries it names:
+  // Kd as the albedo, and Pm and Pr of the PBR extension as metallic and roughness. Groups the
+  // libraries lack, or every group when there are none, get default_material.
+  static std::vector<IntersectableManager::Material> load_materials(
+    const std::string& path, const TriangleMesh& mesh,
+    const IntersectableManager::Material& default_material);
+};
+
+#endif // MESH_LOADER_H
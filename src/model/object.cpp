@@ -81,25 +81,32 @@ void Object::finalize_setup()
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 
+mat4 Object::get_model_matrix(const Transform& transform)
+{
+  const auto& [scale, rotate, translate] = transform;
+
+  mat4 model(1.0f);
+  if (translate.has_value()) {
+    model *= glm::translate(translate.value());
+  }
+  if (rotate.has_value()) {
+    auto [angle, axis] = rotate.value();
+    model *= glm::rotate(angle, axis);
+  }
+  if (scale.has_value()) {
+    model *= glm::scale(scale.value());
+  }
+
+  return model;
+}
+
 void Object::set_model_transforms(const std::vector<Transform>& transforms)
 {
   std::vector<mat4> model_matrices;
   model_matrices.reserve(transforms.size());
 
-  for (const auto& [scale, rotate, translate] : transforms) {
-    mat4 model(1.0f);
-    if (translate.has_value()) {
-      model *= glm::translate(translate.value());
-    }
-    if (rotate.has_value()) {
-      auto [angle, axis] = rotate.value();
-      model *= glm::rotate(angle, axis);
-    }
-    if (scale.has_value()) {
-      model *= glm::scale(scale.value());
-    }
-
-    model_matrices.emplace_back(std::move(model));
+  for (const auto& transform : transforms) {
+    model_matrices.emplace_back(get_model_matrix(transform));
   }
 
   glBindBuffer(GL_SHADER_STORAGE_BUFFER, SSBO);
@@ -31,6 +31,7 @@ public:
   void add_vertex_attribs(std::initializer_list<int> vertex_attrib_sizes);
   void finalize_setup();
 
+  static mat4 get_model_matrix(const Transform& transform);
   static void set_model_transforms(const std::vector<Transform>& transforms);
   static void set_world_space_transform(mat4 perspective, mat4 view);
 
@@ -0,0 +1,167 @@
+#include "scene.h"
+#include "model/object.h"
+#include "model/mesh_loader.h"
+
+#include <glm/gtc/constants.hpp>
+#include <cmath>
+#include <memory>
+#include <random>
+
+namespace {
+  // Lights scale with the mesh so any unit renders alike
+  void add_mesh_lights(Light& light, const Bounds& bounds)
+  {
+    const vec3 center = (bounds.min + bounds.max) * 0.5f;
+    const float size = length(bounds.get_extent());
+    light.add_point_light({ center + vec3(0.0f, size, 0.0f), vec3(2.0f * size * size) });
+    light.add_point_light({ center + vec3(size, 0.5f * size, size) * 0.7f,
+                            vec3(0.8f, 0.7f, 0.5f) * size * size });
+  }
+}
+
+void Scene::load_default(IntersectableManager& intersectables, Light& light)
+{
+  intersectables.add_sphere({ vec3(0.0f, 0.8f, 1.0f), 0.8f },
+                            { vec3(0.2f, 1.0f, 0.2f), 0.8f, 0.5f, 0.6f });
+  intersectables.add_sphere({ vec3(3.0f, 1.0f, 0.0f), 1.0f },
+                            { vec3(1.0f, 0.2f, 0.2f), 1.0f, 0.1f, 0.6f });
+  intersectables.add_sphere({ vec3(-3.0f, 0.5f, -0.5f), 0.5f },
+                            { vec3(0.2f, 0.2f, 1.0f), 0.2f, 1.0f, 0.7f });
+  intersectables.add_sphere({ vec3(1.0f, 0.75f, -2.0f), 0.75f },
+                            { vec3(1.0f, 1.0f, 0.2f), 0.2f, 0.1f, 0.5f });
+  intersectables.add_sphere({ vec3(-2.0f, 0.6f, -3.0f), 0.6f },
+                            { vec3(1.0f), 1.0f, 0.1f, 0.0f });
+
+  intersectables.add_triangle({ vec3(8.0f, 0.0f, 8.0f), vec3(8.0f, 0.0f, -8.0f), vec3(-8.0f, 0.0f, -8.0f) },
+                             { vec3(0.2f), 0.2f, 0.2f, 0.0f });
+  intersectables.add_triangle({ vec3(8.0f, 0.0f, 8.0f), vec3(-8.0f, 0.0f, -8.0f), vec3(-8.0f, 0.0f, 8.0f) },
+                             { vec3(0.2f), 0.2f, 0.2f, 0.0f });
+
+  intersectables.add_aabb(
+    { vec3(-1.0f, 1.0f, -1.0f), vec3(1.0f, 2.0f, 1.0f) },
+    { vec3(1.0f, 0.5f, 1.0f), 1.0f, 0.1f, 0.2f }
+  );
+
+  light.add_point_light({ vec3(5.0, 5.0, -2.0), vec3(50.0, 50.0, 8.0) });
+  light.add_point_light({ vec3(-5.0, 5.0, -2.0), vec3(8.0, 8.0, 50.0) });
+  light.add_point_light({ vec3(0.0, 5.0, 2.0), vec3(50.0) });
+  light.add_point_light({ vec3(-3.0, 10.0, 1.0), vec3(50.0) });
+  light.add_point_light({ vec3(4.0, 10.0, -4.0), vec3(50.0) });
+}
+
+// Low poly tree in a unit cell: a box trunk under a cone of leaves
+static std::vector<Triangle> create_tree_mesh()
+{
+  constexpr int NUM_SEGMENTS = 12;
+  constexpr float TRUNK_WIDTH = 0.1f;
+  constexpr float TRUNK_HEIGHT = 0.4f;
+  constexpr float CONE_RADIUS = 0.45f;
+  constexpr float CONE_HEIGHT = 1.2f;
+
+  std::vector<Triangle> triangles;
+
+  // Trunk sides, bottom and top are hidden by the ground and the cone
+  const vec3 corners[4] = {
+    vec3(-TRUNK_WIDTH, 0.0f, -TRUNK_WIDTH), vec3(TRUNK_WIDTH, 0.0f, -TRUNK_WIDTH),
+    vec3(TRUNK_WIDTH, 0.0f, TRUNK_WIDTH), vec3(-TRUNK_WIDTH, 0.0f, TRUNK_WIDTH),
+  };
+  const vec3 up(0.0f, TRUNK_HEIGHT, 0.0f);
+  for (int i = 0; i < 4; i++) {
+    const vec3& a = corners[i];
+    const vec3& b = corners[(i + 1) % 4];
+    triangles.emplace_back(a, b + up, b);
+    triangles.emplace_back(a, a + up, b + up);
+  }
+
+  // Cone sides and base
+  const vec3 base(0.0f, TRUNK_HEIGHT, 0.0f);
+  const vec3 tip(0.0f, TRUNK_HEIGHT + CONE_HEIGHT, 0.0f);
+  for (int i = 0; i < NUM_SEGMENTS; i++) {
+    const float angle1 = 2.0f * glm::pi<float>() * static_cast<float>(i) / NUM_SEGMENTS;
+    const float angle2 = 2.0f * glm::pi<float>() * static_cast<float>(i + 1) / NUM_SEGMENTS;
+    const vec3 a = base + CONE_RADIUS * vec3(std::cos(angle1), 0.0f, std::sin(angle1));
+    const vec3 b = base + CONE_RADIUS * vec3(std::cos(angle2), 0.0f, std::sin(angle2));
+    triangles.emplace_back(a, tip, b);
+    triangles.emplace_back(a, b, base);
+  }
+
+  return triangles;
+}
+
+void Scene::load_forest(IntersectableManager& intersectables, Light& light, int num_trees)
+{
+  constexpr float SPACING = 1.5f;
+
+  const int side = static_cast<int>(std::ceil(std::sqrt(static_cast<float>(num_trees))));
+  const float half_extent = static_cast<float>(side) * SPACING / 2.0f;
+  const float ground = half_extent + SPACING;
+
+  intersectables.add_triangle({ vec3(ground, 0.0f, ground), vec3(ground, 0.0f, -ground), vec3(-ground, 0.0f, -ground) },
+                             { vec3(0.3f, 0.25f, 0.2f), 0.0f, 0.9f, 0.2f });
+  intersectables.add_triangle({ vec3(ground, 0.0f, ground), vec3(-ground, 0.0f, -ground), vec3(-ground, 0.0f, ground) },
+                             { vec3(0.3f, 0.25f, 0.2f), 0.0f, 0.9f, 0.2f });
+
+  const int tree = intersectables.add_mesh(create_tree_mesh());
+
+  // Fixed seed so renders are reproducible
+  std::mt19937 generator(1);
+  std::uniform_real_distribution<float> angle(0.0f, 2.0f * glm::pi<float>());
+  std::uniform_real_distribution<float> scale(0.7f, 1.3f);
+  std::uniform_real_distribution<float> jitter(-0.3f, 0.3f);
+  std::uniform_real_distribution<float> shade(0.2f, 0.6f);
+
+  for (int i = 0; i < num_trees; i++) {
+    const vec2 cell = (vec2(i % side, i / side) + 0.5f) * SPACING - half_extent;
+    const vec2 offset { jitter(generator), jitter(generator) };
+    const vec3 position(cell.x + offset.x, 0.0f, cell.y + offset.y);
+    const Object::Transform transform = {
+      vec3(scale(generator)),
+      std::make_pair(angle(generator), vec3(0.0f, 1.0f, 0.0f)),
+      position,
+    };
+
+    intersectables.add_instance(tree, Object::get_model_matrix(transform),
+                                { vec3(0.1f, shade(generator), 0.1f), 0.0f, 0.8f, 0.5f });
+  }
+
+  light.add_point_light({ vec3(0.0f, 20.0f, 0.0f), vec3(1500.0f) });
+  light.add_point_light({ vec3(half_extent, 10.0f, half_extent), vec3(800.0f, 700.0f, 500.0f) });
+}
+
+Bounds Scene::load_mesh(IntersectableManager& intersectables, Light& light,
+                        const std::string& path)
+{
+  const TriangleMesh mesh = MeshLoader::load(path);
+  const std::vector<IntersectableManager::Material> materials = MeshLoader::load_materials(
+    path, mesh, { vec3(0.8f), 0.0f, 0.5f, 0.5f });
+  intersectables.add_triangles(mesh, materials);
+
+  Bounds bounds;
+  for (const vec3& position : mesh.positions) {
+    bounds.grow(position);
+  }
+
+  add_mesh_lights(light, bounds);
+  return bounds;
+}
+
+Bounds Scene::load_pages(IntersectableManager& intersectables, Light& light,
+                         const std::string& path, size_t num_slots)
+{
+  const auto pages = std::make_shared<const GeometryPages>(path);
+  intersectables.set_geometry_pages(pages, num_slots);
+
+  for (size_t mesh = 0; mesh < pages->get_num_meshes(); mesh++) {
+    intersectables.add_instance(static_cast<int>(mesh), mat4(1.0f),
+                                { vec3(0.8f), 0.0f, 0.5f, 0.5f });
+  }
+
+  // Only the page table is read, the bounds of the pages cover the meshes
+  Bounds bounds;
+  for (size_t page = 0; page < pages->get_num_pages(); page++) {
+    bounds.grow(pages->get_page(page).bounds);
+  }
+
+  add_mesh_lights(light, bounds);
+  return bounds;
+}
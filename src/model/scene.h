@@ -0,0 +1,29 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "model/intersectable/intersectable_manager.h"
+#include "model/light.h"
+#include "model/bvh/bounds.h"
+
+#include <string>
+
+class Scene
+{
+public:
+  Scene() = delete;
+
+  // Adds the demo scene to the managers, shared by the GPU display and the CPU renderer
+  static void load_default(IntersectableManager& intersectables, Light& light);
+  // Adds a grid of instanced trees over a ground plane, all sharing one mesh
+  static void load_forest(IntersectableManager& intersectables, Light& light, int num_trees);
+  // Adds an OBJ or PLY mesh lit from above, returning its bounds to frame the camera
+  static Bounds load_mesh(IntersectableManager& intersectables, Light& light,
+                          const std::string& path);
+  // Instances each mesh of a page file in place, lit as by load_mesh. The pages are streamed
+  // into num_slots slots on the GPU as rays reach them. Returns the bounds of all pages.
+  static Bounds load_pages(IntersectableManager& intersectables, Light& light,
+                           const std::string& path,
+                           size_t num_slots = GeometryStreamer::DEFAULT_NUM_SLOTS);
+};
+
+#endif // SCENE_H
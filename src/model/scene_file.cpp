@@ -0,0 +1,168 @@
+#include "scene_file.h"
+#include "model/intersectable/intersectable_manager.h"
+#include "model/light.h"
+#include "util/exception.h"
+#include "util/logging.h"
+
+#include <glad/glad.h>
+#include <algorithm>
+#include <filesystem>
+#include <iterator>
+#include <utility>
+
+namespace {
+  // Size of one record of each section. The info and object counts are a single record.
+  constexpr size_t record_sizes[SceneFile::NUM_SECTIONS] = {
+    sizeof (SceneFile::Info),
+    6 * sizeof (int),
+    IntersectableManager::intersectable_stride * sizeof (vec4),
+    sizeof (vec4),
+    sizeof (ivec3),
+    IntersectableManager::material_stride * sizeof (vec4),
+    sizeof (uint16_t),
+    Light::light_stride * sizeof (vec4),
+    sizeof (BVHNode),
+    sizeof (int),
+    sizeof (BVHInstance),
+    sizeof (WideBVHNode<4>),
+    sizeof (WideBVHNode<8>),
+    sizeof (QuantizedBVHNode),
+    sizeof (PrimitiveBlock),
+    sizeof (int),
+  };
+
+  template <typename T>
+  SceneFile::Section get_bytes(const std::vector<T>& data)
+  {
+    return { data.data(), data.size() * sizeof (T) };
+  }
+}
+
+SceneFile::SceneFile(const std::string& path)
+  : file(path, FORMAT, 0, NUM_SECTIONS)
+{
+  for (size_t i = 0; i < NUM_SECTIONS; i++) {
+    const size_t section_size = file.get_section(i).size;
+    const bool single_record = i == INFO || i == NUM_OBJECTS;
+    if (single_record ? section_size != record_sizes[i] : section_size % record_sizes[i] != 0) {
+      throw LoaderException("Scene file " + path + " has a malformed section");
+    }
+  }
+
+  Logging::get_logger() << "Mapped scene file " << path << ", " << file.get_size() << " bytes"
+                        << std::endl;
+}
+
+SceneFile::~SceneFile()
+{
+  if (!buffers.empty()) {
+    glDeleteBuffers(static_cast<int>(buffers.size()), buffers.data());
+  }
+}
+
+void SceneFile::save(const std::string& path, const IntersectableManager& intersectables,
+                     const Light& light, const vec3& camera_position,
+                     const vec3& camera_direction)
+{
+  const std::vector<int>& num_objects = intersectables.get_num_objects();
+  const bool has_bvh = !num_objects.empty() && (num_objects[3] >= 0 || num_objects[4] >= 0);
+  if (num_objects.empty() || (has_bvh && intersectables.get_node_data().empty())) {
+    throw RenderException("Scene files need the BVH buffers of pack()");
+  }
+
+  const Info info = {
+    camera_position, intersectables.get_binary_bvh_root(), camera_direction, 0,
+  };
+
+  std::vector<Section> sections(NUM_SECTIONS);
+  sections[INFO] = { &info, sizeof (info) };
+  sections[NUM_OBJECTS] = get_bytes(num_objects);
+  sections[INTERSECTABLES] = get_bytes(intersectables.get_intersectable_data());
+  sections[VERTICES] = get_bytes(intersectables.get_vertex_data());
+  sections[TRIANGLES] = get_bytes(intersectables.get_triangle_data());
+  sections[MATERIALS] = get_bytes(intersectables.get_material_data());
+  sections[MATERIAL_INDICES] = get_bytes(intersectables.get_material_index_data());
+  sections[LIGHTS] = get_bytes(light.get_light_data());
+  sections[NODES] = get_bytes(intersectables.get_node_data());
+  sections[INDICES] = get_bytes(intersectables.get_index_data());
+  sections[INSTANCES] = get_bytes(intersectables.get_instance_data());
+  sections[WIDE4_NODES] = get_bytes(intersectables.get_wide4_node_data());
+  sections[WIDE8_NODES] = get_bytes(intersectables.get_wide8_node_data());
+  sections[QUANTIZED4_NODES] = get_bytes(intersectables.get_quantized4_node_data());
+  sections[PRIMITIVE_BLOCKS] = get_bytes(intersectables.get_primitive_blocks());
+  sections[BLOCK_OFFSETS] = get_bytes(intersectables.get_block_offsets());
+
+  SectionedFile::save(path, FORMAT, 0, sections);
+}
+
+bool SceneFile::is_scene_file(const std::string& path)
+{
+  return std::filesystem::path(path).extension() == EXTENSION;
+}
+
+const SceneFile::Section& SceneFile::get_section(size_t index) const
+{
+  return file.get_section(index);
+}
+
+const SceneFile::Info& SceneFile::get_info() const
+{
+  return *static_cast<const Info*>(file.get_section(INFO).data);
+}
+
+void SceneFile::upload()
+{
+  // Instances point at roots in the saved layout, and raytrace.comp has no BVH8 traversal
+  const Section& num_objects = file.get_section(NUM_OBJECTS);
+  if (static_cast<const int*>(num_objects.data)[5] == static_cast<int>(BVH::Layout::Wide8)) {
+    throw RenderException("Scene files with BVH8 nodes are CPU only");
+  }
+  const int num_point_lights = static_cast<int>(file.get_section(LIGHTS).size /
+                                                record_sizes[LIGHTS]);
+
+  // Storage buffers straight from the mapping, by binding in raytrace.comp
+  const std::pair<SectionIndex, unsigned int> bindings[] = {
+    { INTERSECTABLES, 4 },
+    { MATERIALS, 5 },
+    { LIGHTS, 7 },
+    { NODES, 8 },
+    { INDICES, 9 },
+    { INSTANCES, 10 },
+    { WIDE4_NODES, 11 },
+    { QUANTIZED4_NODES, 12 },
+    { VERTICES, 21 },
+    { TRIANGLES, 22 },
+    { MATERIAL_INDICES, 23 },
+  };
+
+  // The two counts come first
+  buffers.resize(std::size(bindings) + 2);
+  glGenBuffers(static_cast<int>(buffers.size()), buffers.data());
+
+  glBindBuffer(GL_UNIFORM_BUFFER, buffers[0]);
+  glBufferData(GL_UNIFORM_BUFFER, static_cast<long>(num_objects.size), num_objects.data,
+               GL_STATIC_DRAW);
+  glBindBufferBase(GL_UNIFORM_BUFFER, 3, buffers[0]);
+
+  glBindBuffer(GL_UNIFORM_BUFFER, buffers[1]);
+  glBufferData(GL_UNIFORM_BUFFER, sizeof (int), &num_point_lights, GL_STATIC_DRAW);
+  glBindBufferBase(GL_UNIFORM_BUFFER, 6, buffers[1]);
+
+  constexpr GLenum buffer_type = GL_SHADER_STORAGE_BUFFER;
+
+  // Empty buffer storage is invalid, so unused buffers get a placeholder record
+  for (size_t i = 0; i < std::size(bindings); i++) {
+    const auto [index, binding] = bindings[i];
+    const Section& section = file.get_section(index);
+    const unsigned int buffer = buffers[i + 2];
+    // Material indices are read as whole uints
+    const size_t record_size = index == MATERIAL_INDICES ? sizeof (uint32_t) : record_sizes[index];
+
+    glBindBuffer(buffer_type, buffer);
+    glBufferStorage(buffer_type, static_cast<long>(std::max(section.size, record_size)),
+                    section.size > 0 ? section.data : nullptr, 0);
+    glBindBufferBase(buffer_type, binding, buffer);
+  }
+
+  glBindBuffer(buffer_type, 0);
+}
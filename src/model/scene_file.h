@@ -0,0 +1,91 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include "util/sectioned_file.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+using namespace glm;
+
+class IntersectableManager;
+class Light;
+
+// Packed scene saved in the layouts the raytracers read: each section is one buffer of
+// IntersectableManager or Light, stored as in memory and aligned for every record type. A loaded
+// file stays memory mapped, so the GPU buffers are created and the CPU traces straight from the
+// mapping. Files are written in the byte order of the machine and are not portable across it.
+class SceneFile
+{
+public:
+  // Bumped whenever the layout of a section changes, older files are rejected
+  static constexpr uint32_t VERSION = 3;
+
+  using Section = SectionedFile::Section;
+
+  // Sections in file order
+  enum SectionIndex : size_t {
+    INFO,
+    NUM_OBJECTS,
+    INTERSECTABLES,
+    VERTICES,
+    TRIANGLES,
+    MATERIALS,
+    MATERIAL_INDICES,
+    LIGHTS,
+    NODES,
+    INDICES,
+    INSTANCES,
+    WIDE4_NODES,
+    WIDE8_NODES,
+    QUANTIZED4_NODES,
+    PRIMITIVE_BLOCKS,
+    BLOCK_OFFSETS,
+    NUM_SECTIONS,
+  };
+
+  // What is saved besides the buffers: the camera to view the scene from, and the root of the
+  // scene BVH in the binary nodes for layouts whose roots index other nodes
+  struct Info {
+    vec3 camera_position;
+    int binary_root;
+    vec3 camera_direction;
+    int padding;
+  };
+
+  // Maps the file, throwing LoaderException when it is missing, truncated or of another version
+  SceneFile(const std::string& path);
+  ~SceneFile();
+
+  SceneFile(const SceneFile&) = delete;
+  SceneFile& operator=(const SceneFile&) = delete;
+
+  // Saves the buffers of pack() and Light::pack(), so a CPU render of the file is identical to
+  // one of the managers. Throws RenderException before pack() and LoaderException when the file
+  // cannot be written.
+  static void save(const std::string& path, const IntersectableManager& intersectables,
+                   const Light& light, const vec3& camera_position, const vec3& camera_direction);
+  // Whether a path names a scene file rather than a scene or mesh
+  static bool is_scene_file(const std::string& path);
+
+  const Section& get_section(size_t index) const;
+  const Info& get_info() const;
+
+  // Creates the GPU buffers from the mapping, at the bindings of IntersectableManager::finalize
+  // and Light::finalize. The scene is static, there is nothing to refit. Throws RenderException
+  // for files saved with the CPU only BVH8 layout.
+  void upload();
+
+private:
+  static constexpr SectionedFile::Format FORMAT = {
+    "scene file", { 'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0' }, VERSION,
+  };
+  static constexpr const char* EXTENSION = ".rtscene";
+
+  SectionedFile file;
+  std::vector<unsigned int> buffers;
+};
+
+#endif // SCENE_FILE_H
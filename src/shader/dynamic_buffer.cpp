@@ -0,0 +1,101 @@
+#include "dynamic_buffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+DynamicBuffer::~DynamicBuffer()
+{
+  for (GLsync fence : fences) {
+    if (fence) {
+      glDeleteSync(fence);
+    }
+  }
+
+  // Deleting the buffer also unmaps it
+  if (buffer) {
+    glDeleteBuffers(1, &buffer);
+  }
+}
+
+void DynamicBuffer::create(unsigned int binding, const void* data, size_t size, size_t min_size)
+{
+  this->binding = binding;
+  this->size = std::max(size, min_size);
+
+  int alignment = 1;
+  glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  const size_t offset_alignment = static_cast<size_t>(std::max(alignment, 1));
+  region_size = (this->size + offset_alignment - 1) / offset_alignment * offset_alignment;
+
+  constexpr GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+  const long total_size = static_cast<long>(region_size * NUM_REGIONS);
+
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+  glBufferStorage(GL_SHADER_STORAGE_BUFFER, total_size, nullptr, flags);
+  mapping = static_cast<unsigned char*>(glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, total_size,
+                                                         flags));
+
+  if (size > 0) {
+    for (size_t i = 0; i < NUM_REGIONS; i++) {
+      std::memcpy(mapping + i * region_size, data, size);
+    }
+  }
+
+  region = 0;
+  glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, buffer, 0, static_cast<long>(this->size));
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+bool DynamicBuffer::is_created() const
+{
+  return mapping != nullptr;
+}
+
+void DynamicBuffer::mark_dirty(size_t offset, size_t size)
+{
+  for (auto& ranges : dirty_ranges) {
+    ranges.push_back({ offset, size });
+  }
+}
+
+void DynamicBuffer::begin_frame(const void* data)
+{
+  // An up to date region is only read by the GPU, so frames keep reading it without waiting
+  if (!is_created() || dirty_ranges[region].empty()) {
+    return;
+  }
+
+  region = (region + 1) % NUM_REGIONS;
+
+  if (fences[region]) {
+    while (glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) ==
+           GL_TIMEOUT_EXPIRED) {
+    }
+    glDeleteSync(fences[region]);
+    fences[region] = nullptr;
+  }
+
+  // The mapping is coherent, so the copies are visible to commands issued after them
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  unsigned char* region_data = mapping + region * region_size;
+  for (const Range& range : dirty_ranges[region]) {
+    std::memcpy(region_data + range.offset, bytes + range.offset, range.size);
+  }
+  dirty_ranges[region].clear();
+
+  glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, buffer,
+                    static_cast<long>(region * region_size), static_cast<long>(size));
+}
+
+void DynamicBuffer::end_frame()
+{
+  if (!is_created()) {
+    return;
+  }
+
+  if (fences[region]) {
+    glDeleteSync(fences[region]);
+  }
+  fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
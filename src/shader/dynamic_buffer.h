@@ -0,0 +1,55 @@
+#ifndef DYNAMIC_BUFFER_H
+#define DYNAMIC_BUFFER_H
+
+#include <glad/glad.h>
+#include <cstddef>
+#include <vector>
+
+// Shader storage buffer that the CPU writes while the GPU renders from it. The buffer holds
+// NUM_REGIONS copies of the data and stays persistently and coherently mapped. Changes are
+// copied into a region only once the GPU has finished the frame that last read it, so writes
+// never stall on or race with rendering.
+class DynamicBuffer
+{
+public:
+  static constexpr size_t NUM_REGIONS = 3;
+
+  DynamicBuffer() = default;
+  ~DynamicBuffer();
+
+  DynamicBuffer(const DynamicBuffer&) = delete;
+  DynamicBuffer& operator=(const DynamicBuffer&) = delete;
+
+  // Allocates the regions with size bytes of data each and binds the first one. Empty storage is
+  // invalid, so an empty buffer gets min_size bytes.
+  void create(unsigned int binding, const void* data, size_t size, size_t min_size);
+  bool is_created() const;
+
+  // Bytes offset to offset + size of the data have changed, and are copied into each region
+  // before the GPU next reads it
+  void mark_dirty(size_t offset, size_t size);
+  // Binds the region the next frame reads. A region behind on changes is swapped for the next
+  // one, which receives the dirty ranges of data after waiting for the GPU to release it.
+  void begin_frame(const void* data);
+  // Fences the commands of the frame, which read the bound region
+  void end_frame();
+
+private:
+  struct Range {
+    size_t offset;
+    size_t size;
+  };
+
+  unsigned int buffer = 0;
+  unsigned int binding = 0;
+  unsigned char* mapping = nullptr;
+  size_t size = 0;
+  // Size rounded up to the storage buffer offset alignment
+  size_t region_size = 0;
+  size_t region = 0;
+  GLsync fences[NUM_REGIONS] = {};
+  // Changes each region has not received yet
+  std::vector<Range> dirty_ranges[NUM_REGIONS];
+};
+
+#endif // DYNAMIC_BUFFER_H
@@ -39,10 +39,12 @@ Shader::Shader(const char* path_vertex, const char* path_fragment) {
   }
 }
 
-Shader::Shader(const char* path_compute, unsigned int x, unsigned int y, unsigned int z)
+Shader::Shader(const char* path_compute, unsigned int x, unsigned int y, unsigned int z,
+               std::string_view defines)
   : x(x), y(y), z(z)
 {
   std::string compute_source = read_source(path_compute);
+  compute_source.insert(compute_source.find('\n') + 1, defines);
   const char* compute_source_cstr = compute_source.c_str();
 
   compute_shader = glCreateShader(GL_COMPUTE_SHADER);
@@ -79,6 +81,11 @@ void Shader::dispatch_compute() const
   glDispatchCompute(x / 32, y / 24, z);
 }
 
+void Shader::dispatch_compute_indirect(long offset) const
+{
+  glDispatchComputeIndirect(offset);
+}
+
 int Shader::get_uniform_location(std::string_view uniform) const {
   return glGetUniformLocation(shader_program, uniform.data());
 }
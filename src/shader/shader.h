@@ -6,11 +6,15 @@
 class Shader {
 public:
   Shader(const char* path_vertex, const char* path_fragment);
-  Shader(const char* path_compute, unsigned int x, unsigned int y, unsigned int z);
+  // defines are inserted after the #version line, to compile variants of one source
+  Shader(const char* path_compute, unsigned int x, unsigned int y, unsigned int z,
+         std::string_view defines = "");
   ~Shader();
 
   void use() const;
   void dispatch_compute() const;
+  // Reads the group counts from the buffer bound to GL_DISPATCH_INDIRECT_BUFFER at offset
+  void dispatch_compute_indirect(long offset) const;
   int get_uniform_location(std::string_view uniform) const;
 
 private:
@@ -5,3 +5,5 @@ GENERATE_EXCEPTION_IMPL(WindowException)
 GENERATE_EXCEPTION_IMPL(DisplayException)
 GENERATE_EXCEPTION_IMPL(LoggingException)
 GENERATE_EXCEPTION_IMPL(ImageException)
+GENERATE_EXCEPTION_IMPL(RenderException)
+GENERATE_EXCEPTION_IMPL(LoaderException)
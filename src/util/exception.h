@@ -17,5 +17,7 @@ GENERATE_EXCEPTION_HEADER(WindowException)
 GENERATE_EXCEPTION_HEADER(DisplayException)
 GENERATE_EXCEPTION_HEADER(LoggingException)
 GENERATE_EXCEPTION_HEADER(ImageException)
+GENERATE_EXCEPTION_HEADER(RenderException)
+GENERATE_EXCEPTION_HEADER(LoaderException)
 
 #endif // EXCEPTION_H
@@ -0,0 +1,56 @@
+#include "mapped_file.h"
+#include "util/exception.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const std::string& path)
+{
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw LoaderException("Cannot open file " + path);
+  }
+
+  struct stat status;
+  if (fstat(fd, &status) != 0) {
+    close(fd);
+    throw LoaderException("Cannot read the size of " + path);
+  }
+
+  size = static_cast<size_t>(status.st_size);
+
+  // An empty file cannot be mapped, and has nothing to parse anyway
+  if (size > 0) {
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+      close(fd);
+      throw LoaderException("Cannot map file " + path);
+    }
+
+    // Each chunk is parsed front to back, so read ahead aggressively
+    madvise(mapping, size, MADV_SEQUENTIAL);
+    data = static_cast<const char*>(mapping);
+  }
+
+  // The mapping keeps the file alive
+  close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+  if (data) {
+    munmap(const_cast<char*>(data), size);
+  }
+}
+
+const char* MappedFile::get_data() const
+{
+  return data;
+}
+
+size_t MappedFile::get_size() const
+{
+  return size;
+}
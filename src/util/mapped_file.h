@@ -0,0 +1,27 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory map of a whole file, so that loaders can parse it in place from several
+// threads while the OS pages it in
+class MappedFile
+{
+public:
+  // Throws LoaderException when the file cannot be opened or mapped
+  MappedFile(const std::string& path);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const char* get_data() const;
+  size_t get_size() const;
+
+private:
+  const char* data = nullptr;
+  size_t size = 0;
+};
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,54 @@
+#ifndef MORTON_H
+#define MORTON_H
+
+#include <cstdint>
+
+namespace Morton {
+  // Spreads the low 10 bits of x so that there are two zero bits between each
+  inline uint32_t expand_bits_10(uint32_t x) {
+    x &= 0x3ff;
+    x = (x | (x << 16)) & 0x030000ff;
+    x = (x | (x << 8)) & 0x0300f00f;
+    x = (x | (x << 4)) & 0x030c30c3;
+    x = (x | (x << 2)) & 0x09249249;
+    return x;
+  }
+
+  // Spreads the low 21 bits of x so that there are two zero bits between each
+  inline uint64_t expand_bits_21(uint64_t x) {
+    x &= 0x1fffff;
+    x = (x | (x << 32)) & 0x001f00000000ffff;
+    x = (x | (x << 16)) & 0x001f0000ff0000ff;
+    x = (x | (x << 8)) & 0x100f00f00f00f00f;
+    x = (x | (x << 4)) & 0x10c30c30c30c30c3;
+    x = (x | (x << 2)) & 0x1249249249249249;
+    return x;
+  }
+
+  // Spreads the low 16 bits of x so that there is one zero bit between each
+  inline uint32_t expand_bits_16(uint32_t x) {
+    x &= 0xffff;
+    x = (x | (x << 8)) & 0x00ff00ff;
+    x = (x | (x << 4)) & 0x0f0f0f0f;
+    x = (x | (x << 2)) & 0x33333333;
+    x = (x | (x << 1)) & 0x55555555;
+    return x;
+  }
+
+  // 30 bit code of coordinates quantized to 10 bits
+  inline uint32_t encode_30(uint32_t x, uint32_t y, uint32_t z) {
+    return (expand_bits_10(x) << 2) | (expand_bits_10(y) << 1) | expand_bits_10(z);
+  }
+
+  // 63 bit code of coordinates quantized to 21 bits
+  inline uint64_t encode_63(uint64_t x, uint64_t y, uint64_t z) {
+    return (expand_bits_21(x) << 2) | (expand_bits_21(y) << 1) | expand_bits_21(z);
+  }
+
+  // 32 bit code of 2D coordinates quantized to 16 bits
+  inline uint32_t encode_2d(uint32_t x, uint32_t y) {
+    return (expand_bits_16(x) << 1) | expand_bits_16(y);
+  }
+}
+
+#endif // MORTON_H
@@ -0,0 +1,81 @@
+#ifndef RADIX_SORT_H
+#define RADIX_SORT_H
+
+#include "util/thread_pool.h"
+
+#include <algorithm>
+#include <array>
+#include <vector>
+
+// Stable parallel LSD radix sort of keys, applying the same permutation to values.
+// Passes over digits that are equal for every key are skipped.
+template <typename Key, typename Value>
+void radix_sort(std::vector<Key>& keys, std::vector<Value>& values,
+                ThreadPool& pool = ThreadPool::get_global())
+{
+  constexpr int DIGIT_BITS = 8;
+  constexpr size_t NUM_DIGITS = 1 << DIGIT_BITS;
+  constexpr size_t MIN_CHUNK_SIZE = 1 << 14;
+  using Histogram = std::array<size_t, NUM_DIGITS>;
+
+  const size_t size = keys.size();
+  const size_t num_chunks = std::clamp(size / MIN_CHUNK_SIZE, size_t(1),
+                                       size_t(pool.get_num_threads()) * 4);
+  const size_t chunk_size = (size + num_chunks - 1) / num_chunks;
+
+  std::vector<Key> keys_out(size);
+  std::vector<Value> values_out(size);
+  std::vector<Histogram> histograms(num_chunks);
+
+  const auto for_each_chunk = [&](auto&& f) {
+    ThreadPool::TaskGroup group(pool);
+    for (size_t chunk = 0; chunk < num_chunks; chunk++) {
+      group.run([&f, chunk, chunk_size, size]() {
+        f(chunk, chunk * chunk_size, std::min((chunk + 1) * chunk_size, size));
+      });
+    }
+    group.wait();
+  };
+
+  for (size_t shift = 0; shift < sizeof (Key) * 8; shift += DIGIT_BITS) {
+    for_each_chunk([&](size_t chunk, size_t begin, size_t end) {
+      Histogram& histogram = histograms[chunk];
+      histogram.fill(0);
+      for (size_t i = begin; i < end; i++) {
+        histogram[(keys[i] >> shift) & (NUM_DIGITS - 1)]++;
+      }
+    });
+
+    // Exclusive scan by digit, then by chunk, turning counts into output offsets
+    size_t offset = 0;
+    bool is_uniform = false;
+    for (size_t digit = 0; digit < NUM_DIGITS; digit++) {
+      size_t digit_count = 0;
+      for (size_t chunk = 0; chunk < num_chunks; chunk++) {
+        size_t count = histograms[chunk][digit];
+        histograms[chunk][digit] = offset;
+        offset += count;
+        digit_count += count;
+      }
+      is_uniform |= digit_count == size;
+    }
+
+    if (is_uniform) {
+      continue;
+    }
+
+    for_each_chunk([&](size_t chunk, size_t begin, size_t end) {
+      Histogram& offsets = histograms[chunk];
+      for (size_t i = begin; i < end; i++) {
+        size_t destination = offsets[(keys[i] >> shift) & (NUM_DIGITS - 1)]++;
+        keys_out[destination] = keys[i];
+        values_out[destination] = values[i];
+      }
+    });
+
+    keys.swap(keys_out);
+    values.swap(values_out);
+  }
+}
+
+#endif // RADIX_SORT_H
@@ -0,0 +1,152 @@
+#include "sectioned_file.h"
+#include "util/exception.h"
+
+#include <cstring>
+#include <filesystem>
+
+SectionedFile::Writer::Writer(const std::string& path, const Format& format, uint64_t key,
+                              size_t num_sections)
+  : path(path), temp_path(path + ".tmp"), format(format), num_sections(num_sections)
+{
+  output.open(temp_path, std::ios::binary | std::ios::trunc);
+  if (!output) {
+    throw LoaderException("Cannot write " + std::string(format.name) + " " + path);
+  }
+
+  Header header = {};
+  std::memcpy(header.magic, format.magic, sizeof (header.magic));
+  header.version = format.version;
+  header.num_sections = static_cast<uint32_t>(num_sections);
+  header.key = key;
+  output.write(reinterpret_cast<const char*>(&header), sizeof (header));
+
+  // The sizes are written again by close, once they are known
+  sizes.reserve(num_sections);
+  const std::vector<uint64_t> placeholder_sizes(num_sections, 0);
+  output.write(reinterpret_cast<const char*>(placeholder_sizes.data()),
+               static_cast<std::streamsize>(num_sections * sizeof (uint64_t)));
+
+  offset = sizeof (Header) + num_sections * sizeof (uint64_t);
+  align();
+  section_offset = offset;
+}
+
+SectionedFile::Writer::~Writer()
+{
+  if (!closed) {
+    output.close();
+    std::error_code error;
+    std::filesystem::remove(temp_path, error);
+  }
+}
+
+void SectionedFile::Writer::write(const void* data, size_t size)
+{
+  output.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+  offset += size;
+}
+
+size_t SectionedFile::Writer::align()
+{
+  // Sections start aligned, so aligning the file offset aligns within the section
+  const char padding[ALIGNMENT] = {};
+  output.write(padding, static_cast<std::streamsize>(SectionedFile::align(offset) - offset));
+  offset = SectionedFile::align(offset);
+  return offset - section_offset;
+}
+
+void SectionedFile::Writer::end_section()
+{
+  sizes.emplace_back(offset - section_offset);
+  align();
+  section_offset = offset;
+}
+
+void SectionedFile::Writer::close()
+{
+  output.seekp(static_cast<std::streamoff>(sizeof (Header)));
+  output.write(reinterpret_cast<const char*>(sizes.data()),
+               static_cast<std::streamsize>(sizes.size() * sizeof (uint64_t)));
+  output.close();
+
+  if (!output || sizes.size() != num_sections) {
+    throw LoaderException("Cannot write " + std::string(format.name) + " " + path);
+  }
+
+  std::error_code error;
+  std::filesystem::rename(temp_path, path, error);
+  if (error) {
+    throw LoaderException("Cannot write " + std::string(format.name) + " " + path + ": " +
+                          error.message());
+  }
+  closed = true;
+}
+
+SectionedFile::SectionedFile(const std::string& path, const Format& format, uint64_t key,
+                             size_t num_sections)
+  : file(path)
+{
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(file.get_data());
+  const size_t size = file.get_size();
+  const size_t sizes_offset = sizeof (Header);
+  size_t offset = align(sizes_offset + num_sections * sizeof (uint64_t));
+
+  const std::string name = format.name;
+  if (size < sizeof (Header)) {
+    throw LoaderException(path + " is a truncated " + name);
+  }
+
+  Header header;
+  std::memcpy(&header, bytes, sizeof (header));
+  if (std::memcmp(header.magic, format.magic, sizeof (header.magic)) != 0) {
+    throw LoaderException(path + " is not a " + name);
+  }
+  if (header.version != format.version || header.num_sections != num_sections) {
+    throw LoaderException(path + " is a " + name + " of another version");
+  }
+  if (header.key != key) {
+    throw LoaderException(path + " is a " + name + " for another key");
+  }
+  if (size < offset) {
+    throw LoaderException(path + " is a truncated " + name);
+  }
+
+  for (size_t i = 0; i < num_sections; i++) {
+    uint64_t section_size;
+    std::memcpy(&section_size, bytes + sizes_offset + i * sizeof (uint64_t),
+                sizeof (section_size));
+
+    if (offset > size || section_size > size - offset) {
+      throw LoaderException(path + " is a truncated " + name);
+    }
+
+    sections.push_back({ bytes + offset, static_cast<size_t>(section_size) });
+    offset = align(offset + static_cast<size_t>(section_size));
+  }
+}
+
+void SectionedFile::save(const std::string& path, const Format& format, uint64_t key,
+                         const std::vector<Section>& sections)
+{
+  Writer writer(path, format, key, sections.size());
+  for (const auto& section : sections) {
+    writer.write(section.data, section.size);
+    writer.end_section();
+  }
+  writer.close();
+}
+
+size_t SectionedFile::align(size_t offset)
+{
+  return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+size_t SectionedFile::get_size() const
+{
+  return file.get_size();
+}
+
+const SectionedFile::Section& SectionedFile::get_section(size_t index) const
+{
+  return sections[index];
+}
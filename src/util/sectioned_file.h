@@ -0,0 +1,95 @@
+#ifndef SECTIONED_FILE_H
+#define SECTIONED_FILE_H
+
+#include "util/mapped_file.h"
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Binary file of sections of bytes, the layout shared by scene files, BVH caches and page files.
+// A header with the magic, version, number of sections and a key the owner checks, such as a
+// hash of the scene, is followed by the size of each section and then the sections, each starting
+// on ALIGNMENT. A loaded file stays memory mapped and its sections point into the mapping. Files
+// are written in the byte order of the machine and are not portable across it.
+class SectionedFile
+{
+public:
+  // Sections start on this alignment, which covers every record type including primitive blocks
+  static constexpr size_t ALIGNMENT = 64;
+
+  struct Section {
+    const void* data;
+    size_t size;
+  };
+
+  // What tells one kind of file from another. The name is used in error messages.
+  struct Format {
+    const char* name;
+    char magic[8];
+    uint32_t version;
+  };
+
+  // Streams sections to a temporary file that close renames, so an interrupted write never
+  // leaves a partial file
+  class Writer {
+  public:
+    // Throws LoaderException when the file cannot be created
+    Writer(const std::string& path, const Format& format, uint64_t key, size_t num_sections);
+    // Removes the unfinished file unless it was closed
+    ~Writer();
+
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+
+    // Appends to the current section
+    void write(const void* data, size_t size);
+    // Pads the current section to ALIGNMENT from its start, returning its size so far
+    size_t align();
+    // Starts the next section
+    void end_section();
+    // Writes the section sizes once every section has ended. Throws LoaderException when the
+    // file could not be written.
+    void close();
+
+  private:
+    std::string path;
+    std::string temp_path;
+    Format format;
+    std::ofstream output;
+    std::vector<uint64_t> sizes;
+    size_t num_sections;
+    // Bytes written to the file and the offset at which the current section starts
+    size_t offset = 0;
+    size_t section_offset = 0;
+    bool closed = false;
+  };
+
+  // Maps the file, throwing LoaderException when it is missing or truncated, or was written for
+  // another format, version, key or number of sections
+  SectionedFile(const std::string& path, const Format& format, uint64_t key,
+                size_t num_sections);
+
+  // Writes whole sections in one go, throwing LoaderException when the file cannot be written
+  static void save(const std::string& path, const Format& format, uint64_t key,
+                   const std::vector<Section>& sections);
+
+  static size_t align(size_t offset);
+
+  size_t get_size() const;
+  const Section& get_section(size_t index) const;
+
+private:
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_sections;
+    uint64_t key;
+  };
+
+  MappedFile file;
+  std::vector<Section> sections;
+};
+
+#endif // SECTIONED_FILE_H
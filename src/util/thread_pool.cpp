@@ -0,0 +1,132 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned int num_threads)
+{
+  if (!num_threads) {
+    num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+
+  // The thread waiting on a task group also runs tasks, so it counts as one of the workers
+  for (unsigned int i = 1; i < num_threads; i++) {
+    workers.emplace_back(&ThreadPool::worker_loop, this);
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  condition.notify_all();
+
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+ThreadPool::TaskGroup::TaskGroup(ThreadPool& pool)
+  : pool(pool), num_pending(0)
+{
+}
+
+ThreadPool::TaskGroup::~TaskGroup()
+{
+  wait();
+}
+
+void ThreadPool::TaskGroup::run(std::function<void()>&& task)
+{
+  num_pending++;
+  pool.push([this, task = std::move(task)]() {
+    task();
+    num_pending--;
+  });
+}
+
+void ThreadPool::TaskGroup::wait()
+{
+  while (num_pending > 0) {
+    if (!pool.run_pending_task()) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void ThreadPool::parallel_for(size_t begin, size_t end, size_t grain_size,
+                              const std::function<void(size_t, size_t)>& f)
+{
+  if (end <= begin) {
+    return;
+  }
+
+  const size_t num_chunks = std::clamp((end - begin) / std::max(grain_size, size_t(1)),
+                                       size_t(1), size_t(get_num_threads()) * 4);
+  const size_t chunk_size = (end - begin + num_chunks - 1) / num_chunks;
+
+  TaskGroup group(*this);
+  for (size_t chunk_begin = begin; chunk_begin < end; chunk_begin += chunk_size) {
+    const size_t chunk_end = std::min(chunk_begin + chunk_size, end);
+    group.run([&f, chunk_begin, chunk_end]() { f(chunk_begin, chunk_end); });
+  }
+  group.wait();
+}
+
+unsigned int ThreadPool::get_num_threads() const
+{
+  return static_cast<unsigned int>(workers.size() + 1);
+}
+
+ThreadPool& ThreadPool::get_global()
+{
+  static ThreadPool pool;
+  return pool;
+}
+
+void ThreadPool::worker_loop()
+{
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      condition.wait(lock, [this]() { return stopping || !tasks.empty(); });
+
+      if (stopping && tasks.empty()) {
+        return;
+      }
+
+      task = std::move(tasks.front());
+      tasks.pop_front();
+    }
+    task();
+  }
+}
+
+void ThreadPool::push(std::function<void()>&& task)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    tasks.emplace_back(std::move(task));
+  }
+  condition.notify_one();
+}
+
+bool ThreadPool::run_pending_task()
+{
+  std::function<void()> task;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (tasks.empty()) {
+      return false;
+    }
+
+    // Most recently queued tasks are the smallest, so take them first to keep recursion shallow
+    task = std::move(tasks.back());
+    tasks.pop_back();
+  }
+  task();
+  return true;
+}
@@ -0,0 +1,56 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+  // num_threads of 0 uses every available core
+  ThreadPool(unsigned int num_threads = 0);
+  ~ThreadPool();
+
+  // Tracks a set of tasks so that a caller can wait on just those
+  class TaskGroup {
+  public:
+    TaskGroup(ThreadPool& pool);
+    ~TaskGroup();
+
+    // Tasks may themselves run more tasks in the same group
+    void run(std::function<void()>&& task);
+    // Blocks until every task in the group is done, running queued tasks meanwhile
+    void wait();
+
+  private:
+    ThreadPool& pool;
+    std::atomic<int> num_pending;
+  };
+
+  // Calls f(begin, end) over chunks of [begin, end) of at least grain_size elements
+  void parallel_for(size_t begin, size_t end, size_t grain_size,
+                    const std::function<void(size_t, size_t)>& f);
+
+  unsigned int get_num_threads() const;
+
+  // Pool shared by the acceleration structure builders and loaders
+  static ThreadPool& get_global();
+
+private:
+  void worker_loop();
+  void push(std::function<void()>&& task);
+  bool run_pending_task();
+
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> tasks;
+  std::mutex mutex;
+  std::condition_variable condition;
+  bool stopping = false;
+};
+
+#endif // THREAD_POOL_H